@@ -0,0 +1,2488 @@
+#define INTERP_NO_MAIN
+#include "main.c"
+
+#include <math.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+#define BENCH_DEFAULT_WARMUP 3
+#define BENCH_DEFAULT_REPETITIONS 20
+#define BENCH_DEFAULT_THRESHOLD 0.05
+#define BENCH_MAX_ARGS 4
+
+typedef enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1I_MISSES,
+    COUNTER_L1D_MISSES,
+    NUM_COUNTERS,
+} CounterKind;
+
+char const* const counter_names [NUM_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "branch_misses",
+    "l1i_misses",
+    "l1d_misses",
+};
+
+typedef struct {
+    int fds [NUM_COUNTERS];
+} Counters;
+
+typedef struct {
+    bool available [NUM_COUNTERS];
+    double values [NUM_COUNTERS];
+} CounterValues;
+
+typedef struct {
+    char const* name;
+    FunctionIndex (*encode) (stbds_arr(Function)* functions);
+    RegisterIndex num_args;
+    double args [BENCH_MAX_ARGS];
+    double (*reference) (double const* args);
+    // words of global 0 the workload needs as scratch memory, or NULL if it uses no globals
+    size_t (*scratch_words) (double const* args);
+} Workload;
+
+typedef struct {
+    char const* name;
+    size_t repetitions;
+    double result;
+    double min_ns;
+    double max_ns;
+    double mean_ns;
+    double median_ns;
+    double p99_ns;
+    double stddev_ns;
+    double ci_low_ns;
+    double ci_high_ns;
+    long peak_rss_kb;
+    uint64_t bytecode_instructions;
+    CounterValues counters;
+} BenchResult;
+
+uint64_t bench_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec) * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+long bench_peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// two sided 95% critical values of student's t for 1..30 degrees of freedom; beyond that the normal value is close enough
+double bench_t_critical(size_t degrees_of_freedom) {
+    static double const table [] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+
+    if (degrees_of_freedom == 0) return INFINITY;
+    if (degrees_of_freedom <= 30) return table[degrees_of_freedom - 1];
+    return 1.960;
+}
+
+#ifdef __linux__
+    int counter_open(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    #define CACHE_READ_MISS(cache) \
+        ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+// opens each counter on its own rather than as a group, so a machine that lacks one
+// event (common for L1i in virtual machines) still reports the others
+Counters counters_open() {
+    Counters counters;
+
+    #ifdef __linux__
+        counters.fds[COUNTER_CYCLES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        counters.fds[COUNTER_INSTRUCTIONS] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        counters.fds[COUNTER_BRANCH_MISSES] = counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        counters.fds[COUNTER_L1I_MISSES] = counter_open(PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1I));
+        counters.fds[COUNTER_L1D_MISSES] = counter_open(PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D));
+    #else
+        for (int i = 0; i < NUM_COUNTERS; i++) counters.fds[i] = -1;
+    #endif
+
+    return counters;
+}
+
+bool counters_any(Counters const* counters) {
+    for (int i = 0; i < NUM_COUNTERS; i++) {
+        if (counters->fds[i] >= 0) return true;
+    }
+    return false;
+}
+
+void counters_start(Counters const* counters) {
+    #ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counters->fds[i] < 0) continue;
+            ioctl(counters->fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counters->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    #endif
+}
+
+// accumulates into values, scaling for multiplexing when the kernel could not keep a counter scheduled the whole time
+void counters_stop(Counters const* counters, CounterValues* values) {
+    #ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counters->fds[i] < 0) continue;
+            ioctl(counters->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+            uint64_t data [3];
+            if (read(counters->fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+
+            values->available[i] = true;
+            values->values[i] += (double) data[0] * ((double) data[1] / (double) data[2]);
+        }
+    #endif
+}
+
+void counters_close(Counters* counters) {
+    #ifdef __linux__
+        for (int i = 0; i < NUM_COUNTERS; i++) {
+            if (counters->fds[i] >= 0) close(counters->fds[i]);
+            counters->fds[i] = -1;
+        }
+    #endif
+}
+
+int bench_compare_doubles(void const* a, void const* b) {
+    double x = *(double const*) a;
+    double y = *(double const*) b;
+    return (x > y) - (x < y);
+}
+
+
+FunctionIndex encode_fib (stbds_arr(Function)* functions) {
+    FunctionIndex fib = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+    uint64_t two = BITCAST(double, uint64_t, 2.0);
+
+    RegisterIndex n = 0;
+    RegisterIndex cond = 1;
+    RegisterIndex a = 2;
+    RegisterIndex b = 3;
+
+    InstructionPointer entry_block =
+        // n < 2
+        encode_2(&instructions, F_LT_IM_B_64, n, cond);
+        encode_im64(&instructions, two);
+        encode_2(&instructions, WHEN_NZ, 1, cond);
+
+        // fib(n - 1) + fib(n - 2)
+        encode_2(&instructions, F_SUB_IM_B_64, n, a);
+        encode_im64(&instructions, one);
+        encode_w1(&instructions, CALL_V, fib, a);
+        encode_registers(&instructions, 1, (RegisterIndex[]){a});
+
+        encode_2(&instructions, F_SUB_IM_B_64, n, b);
+        encode_im64(&instructions, two);
+        encode_w1(&instructions, CALL_V, fib, b);
+        encode_registers(&instructions, 1, (RegisterIndex[]){b});
+
+        encode_3(&instructions, F_ADD_64, a, b, a);
+        encode_1(&instructions, RET_V, a);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer n_lt_2 =
+        encode_1(&instructions, RET_V, n);
+
+    stbds_arrpush(blocks, n_lt_2);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, 4, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return fib;
+}
+
+double reference_fib_rec (double n) {
+    if (n < 2.0) return n;
+    return reference_fib_rec(n - 1.0) + reference_fib_rec(n - 2.0);
+}
+
+double reference_fib (double const* args) {
+    return reference_fib_rec(args[0]);
+}
+
+FunctionIndex encode_ackermann_workload (stbds_arr(Function)* functions) {
+    return encode_ackermann(functions);
+}
+
+double reference_ackermann (double const* args) {
+    return ackermann(args[0], args[1]);
+}
+
+FunctionIndex encode_nested_loops (stbds_arr(Function)* functions) {
+    FunctionIndex loops = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t zero = BITCAST(double, uint64_t, 0.0);
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+    RegisterIndex outer = 0;
+    RegisterIndex inner = 1;
+    RegisterIndex i = 2;
+    RegisterIndex j = 3;
+    RegisterIndex acc = 4;
+    RegisterIndex cond = 5;
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, acc);
+        encode_im64(&instructions, zero);
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, acc);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer outer_block =
+        encode_3(&instructions, F_EQ_64, i, outer, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_1(&instructions, COPY_IM_64, j);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, BLOCK, 2);
+
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, outer_block);
+
+    InstructionPointer inner_block =
+        encode_3(&instructions, F_EQ_64, j, inner, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_2(&instructions, F_ADD_IM_64, acc, acc);
+        encode_im64(&instructions, one);
+        encode_2(&instructions, F_ADD_IM_64, j, j);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, inner_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {2, 6, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return loops;
+}
+
+double reference_nested_loops (double const* args) {
+    double acc = 0.0;
+    for (double i = 0.0; i != args[0]; i += 1.0) {
+        for (double j = 0.0; j != args[1]; j += 1.0) {
+            acc += 1.0;
+        }
+    }
+    return acc;
+}
+
+FunctionIndex encode_call_overhead (stbds_arr(Function)* functions) {
+    FunctionIndex increment = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+        RegisterIndex x = 0;
+
+        InstructionPointer entry_block =
+            encode_2(&instructions, F_ADD_IM_64, x, x);
+            encode_im64(&instructions, one);
+            encode_1(&instructions, RET_V, x);
+
+        stbds_arrpush(blocks, entry_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {1, 1, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    FunctionIndex calls = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        uint64_t zero = BITCAST(double, uint64_t, 0.0);
+        uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+        RegisterIndex count = 0;
+        RegisterIndex i = 1;
+        RegisterIndex acc = 2;
+        RegisterIndex cond = 3;
+
+        InstructionPointer entry_block =
+            encode_1(&instructions, COPY_IM_64, i);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, COPY_IM_64, acc);
+            encode_im64(&instructions, zero);
+
+            encode_1(&instructions, BLOCK, 1);
+
+            encode_1(&instructions, RET_V, acc);
+
+        stbds_arrpush(blocks, entry_block);
+
+        InstructionPointer loop_block =
+            encode_3(&instructions, F_EQ_64, i, count, cond);
+            encode_2(&instructions, BR_NZ, 0, cond);
+
+            encode_w1(&instructions, CALL_V, increment, acc);
+            encode_registers(&instructions, 1, (RegisterIndex[]){acc});
+
+            encode_2(&instructions, F_ADD_IM_64, i, i);
+            encode_im64(&instructions, one);
+            encode_1(&instructions, RE, 0);
+
+        stbds_arrpush(blocks, loop_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {1, 4, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    return calls;
+}
+
+double reference_call_overhead (double const* args) {
+    return args[0];
+}
+
+FunctionIndex encode_tak (stbds_arr(Function)* functions) {
+    FunctionIndex tak = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+    RegisterIndex x = 0;
+    RegisterIndex y = 1;
+    RegisterIndex z = 2;
+    RegisterIndex cond = 3;
+    RegisterIndex a = 4;
+    RegisterIndex b = 5;
+    RegisterIndex c = 6;
+
+    InstructionPointer entry_block =
+        // y < x
+        encode_3(&instructions, F_LT_64, y, x, cond);
+        encode_2(&instructions, WHEN_NZ, 1, cond);
+        encode_1(&instructions, RET_V, z);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer y_lt_x =
+        // tak(tak(x - 1, y, z), tak(y - 1, z, x), tak(z - 1, x, y))
+        encode_2(&instructions, F_SUB_IM_B_64, x, a);
+        encode_im64(&instructions, one);
+        encode_w1(&instructions, CALL_V, tak, a);
+        encode_registers(&instructions, 3, (RegisterIndex[]){a, y, z});
+
+        encode_2(&instructions, F_SUB_IM_B_64, y, b);
+        encode_im64(&instructions, one);
+        encode_w1(&instructions, CALL_V, tak, b);
+        encode_registers(&instructions, 3, (RegisterIndex[]){b, z, x});
+
+        encode_2(&instructions, F_SUB_IM_B_64, z, c);
+        encode_im64(&instructions, one);
+        encode_w1(&instructions, CALL_V, tak, c);
+        encode_registers(&instructions, 3, (RegisterIndex[]){c, x, y});
+
+        encode_w0(&instructions, TAIL_CALL_V, tak);
+        encode_registers(&instructions, 3, (RegisterIndex[]){a, b, c});
+
+    stbds_arrpush(blocks, y_lt_x);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {3, 7, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return tak;
+}
+
+double reference_tak_rec (double x, double y, double z) {
+    if (!(y < x)) return z;
+    return reference_tak_rec(
+        reference_tak_rec(x - 1.0, y, z),
+        reference_tak_rec(y - 1.0, z, x),
+        reference_tak_rec(z - 1.0, x, y));
+}
+
+double reference_tak (double const* args) {
+    return reference_tak_rec(args[0], args[1], args[2]);
+}
+
+// a logistic map in its chaotic regime drives an IF_NZ whose direction the branch predictor cannot learn
+FunctionIndex encode_branches (stbds_arr(Function)* functions) {
+    FunctionIndex branches = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    RegisterIndex count = 0;
+    RegisterIndex i = 1;
+    RegisterIndex x = 2;
+    RegisterIndex acc = 3;
+    RegisterIndex r = 4;
+    RegisterIndex t = 5;
+    RegisterIndex one = 6;
+    RegisterIndex cond = 7;
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, x);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.3));
+        encode_1(&instructions, COPY_IM_64, acc);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, r);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 3.99));
+        encode_1(&instructions, COPY_IM_64, one);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, acc);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer loop_block =
+        encode_3(&instructions, F_EQ_64, i, count, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        // x = r * (x * (1 - x))
+        encode_3(&instructions, F_SUB_64, one, x, t);
+        encode_3(&instructions, F_MUL_64, x, t, t);
+        encode_3(&instructions, F_MUL_64, r, t, x);
+
+        encode_2(&instructions, F_LT_IM_B_64, x, cond);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.5));
+        encode_3(&instructions, IF_NZ, 2, 3, cond);
+
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, loop_block);
+
+    InstructionPointer low_block =
+        encode_3(&instructions, F_ADD_64, acc, x, acc);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, low_block);
+
+    InstructionPointer high_block =
+        encode_2(&instructions, F_SUB_IM_B_64, acc, acc);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.25));
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, high_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, 8, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return branches;
+}
+
+double reference_branches (double const* args) {
+    double x = 0.3;
+    double acc = 0.0;
+
+    for (double i = 0.0; i != args[0]; i += 1.0) {
+        double t = 1.0 - x;
+        t = x * t;
+        x = 3.99 * t;
+
+        if (x < 0.5) acc = acc + x;
+        else acc = acc - 0.25;
+    }
+
+    return acc;
+}
+
+// the same logistic map next to a state machine that steps through a SWITCH, with one state past the end of the
+// table so the default is taken as well
+FunctionIndex encode_dispatch (stbds_arr(Function)* functions) {
+    FunctionIndex dispatch = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    RegisterIndex count = 0;
+    RegisterIndex i = 1;
+    RegisterIndex x = 2;
+    RegisterIndex acc = 3;
+    RegisterIndex r = 4;
+    RegisterIndex t = 5;
+    RegisterIndex one = 6;
+    RegisterIndex cond = 7;
+    RegisterIndex state = 8;
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, x);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.3));
+        encode_1(&instructions, COPY_IM_64, acc);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, r);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 3.99));
+        encode_1(&instructions, COPY_IM_64, one);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 0);
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, acc);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer loop_block =
+        encode_3(&instructions, F_EQ_64, i, count, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        // x = r * (x * (1 - x))
+        encode_3(&instructions, F_SUB_64, one, x, t);
+        encode_3(&instructions, F_MUL_64, x, t, t);
+        encode_3(&instructions, F_MUL_64, r, t, x);
+
+        encode_2(&instructions, SWITCH, state, 4);
+        encode_blocks(&instructions, 5, (BlockIndex[]){6, 2, 3, 4, 5});
+
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, loop_block);
+
+    InstructionPointer state_0 =
+        encode_3(&instructions, F_ADD_64, acc, x, acc);
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 2);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, state_0);
+
+    InstructionPointer state_1 =
+        encode_2(&instructions, F_SUB_IM_B_64, acc, acc);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.25));
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 3);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, state_1);
+
+    InstructionPointer state_2 =
+        encode_3(&instructions, F_MUL_64, x, x, t);
+        encode_3(&instructions, F_ADD_64, acc, t, acc);
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 1);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, state_2);
+
+    InstructionPointer state_3 =
+        encode_3(&instructions, F_SUB_64, acc, x, acc);
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 4);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, state_3);
+
+    InstructionPointer other_states =
+        encode_3(&instructions, F_ADD_64, acc, one, acc);
+        encode_1(&instructions, COPY_IM_64, state);
+        encode_im64(&instructions, 0);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, other_states);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, 9, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return dispatch;
+}
+
+double reference_dispatch (double const* args) {
+    double x = 0.3;
+    double acc = 0.0;
+    uint64_t state = 0;
+
+    for (double i = 0.0; i != args[0]; i += 1.0) {
+        double t = 1.0 - x;
+        t = x * t;
+        x = 3.99 * t;
+
+        switch (state) {
+            case 0: acc = acc + x; state = 2; break;
+            case 1: acc = acc - 0.25; state = 3; break;
+            case 2: acc = acc + x * x; state = 1; break;
+            case 3: acc = acc - x; state = 4; break;
+            default: acc = acc + 1.0; state = 0; break;
+        }
+    }
+
+    return acc;
+}
+
+FunctionIndex encode_mandelbrot (stbds_arr(Function)* functions) {
+    FunctionIndex mandelbrot = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t zero = BITCAST(double, uint64_t, 0.0);
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+    RegisterIndex size = 0;
+    RegisterIndex max_iterations = 1;
+    RegisterIndex y = 2;
+    RegisterIndex x = 3;
+    RegisterIndex cr = 4;
+    RegisterIndex ci = 5;
+    RegisterIndex zr = 6;
+    RegisterIndex zi = 7;
+    RegisterIndex zr2 = 8;
+    RegisterIndex zi2 = 9;
+    RegisterIndex i = 10;
+    RegisterIndex t = 11;
+    RegisterIndex scale = 12;
+    RegisterIndex count = 13;
+    RegisterIndex cond = 14;
+    RegisterIndex num_registers = 15;
+
+    // read-only, F_MUL_64 and F_DIV_64 have no immediate forms
+    RegisterIndex two = encode_constant_register(&instructions, num_registers, BITCAST(double, uint64_t, 2.0));
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, count);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, y);
+        encode_im64(&instructions, zero);
+        encode_3(&instructions, F_DIV_64, two, size, scale);
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, count);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer row_block =
+        encode_3(&instructions, F_EQ_64, y, size, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_3(&instructions, F_MUL_64, y, scale, ci);
+        encode_2(&instructions, F_SUB_IM_B_64, ci, ci);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, COPY_IM_64, x);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, BLOCK, 2);
+
+        encode_2(&instructions, F_ADD_IM_64, y, y);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, row_block);
+
+    InstructionPointer column_block =
+        encode_3(&instructions, F_EQ_64, x, size, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_3(&instructions, F_MUL_64, x, scale, cr);
+        encode_2(&instructions, F_SUB_IM_B_64, cr, cr);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.5));
+        encode_1(&instructions, COPY_IM_64, zr);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, zi);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, BLOCK, 3);
+
+        encode_2(&instructions, F_ADD_IM_64, x, x);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, column_block);
+
+    InstructionPointer iterate_block =
+        encode_3(&instructions, F_EQ_64, i, max_iterations, cond);
+        encode_2(&instructions, WHEN_NZ, 4, cond);
+
+        // escape once |z|^2 > 4
+        encode_3(&instructions, F_MUL_64, zr, zr, zr2);
+        encode_3(&instructions, F_MUL_64, zi, zi, zi2);
+        encode_3(&instructions, F_ADD_64, zr2, zi2, t);
+        encode_2(&instructions, F_LT_IM_A_64, t, cond);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 4.0));
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        // z = z^2 + c
+        encode_3(&instructions, F_MUL_64, zr, zi, t);
+        encode_3(&instructions, F_MUL_64, t, two, t);
+        encode_3(&instructions, F_ADD_64, t, ci, zi);
+        encode_3(&instructions, F_SUB_64, zr2, zi2, t);
+        encode_3(&instructions, F_ADD_64, t, cr, zr);
+
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, iterate_block);
+
+    InstructionPointer bounded_block =
+        encode_2(&instructions, F_ADD_IM_64, count, count);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, BR, 1);
+
+    stbds_arrpush(blocks, bounded_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {2, num_registers, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return mandelbrot;
+}
+
+double reference_mandelbrot (double const* args) {
+    double size = args[0];
+    double max_iterations = args[1];
+    double scale = 2.0 / size;
+    double count = 0.0;
+
+    for (double y = 0.0; y != size; y += 1.0) {
+        double ci = y * scale;
+        ci = ci - 1.0;
+
+        for (double x = 0.0; x != size; x += 1.0) {
+            double cr = x * scale;
+            cr = cr - 1.5;
+
+            double zr = 0.0;
+            double zi = 0.0;
+
+            for (double i = 0.0; ; i += 1.0) {
+                if (i == max_iterations) {
+                    count += 1.0;
+                    break;
+                }
+
+                double zr2 = zr * zr;
+                double zi2 = zi * zi;
+                double t = zr2 + zi2;
+                if (4.0 < t) break;
+
+                t = zr * zi;
+                t = t * 2.0;
+                zi = t + ci;
+                t = zr2 - zi2;
+                zr = t + cr;
+            }
+        }
+    }
+
+    return count;
+}
+
+// global 0 holds the flags; integer registers index it while parallel double registers are compared against n
+FunctionIndex encode_sieve (stbds_arr(Function)* functions) {
+    FunctionIndex sieve = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+    uint64_t two = BITCAST(double, uint64_t, 2.0);
+
+    RegisterIndex n = 0;
+    RegisterIndex n_plus_1 = 1;
+    RegisterIndex i = 2;
+    RegisterIndex i_index = 3;
+    RegisterIndex j = 4;
+    RegisterIndex j_index = 5;
+    RegisterIndex one_index = 6;
+    RegisterIndex zero_word = 7;
+    RegisterIndex flag = 8;
+    RegisterIndex count = 9;
+    RegisterIndex cond = 10;
+
+    InstructionPointer entry_block =
+        encode_2(&instructions, F_ADD_IM_64, n, n_plus_1);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, COPY_IM_64, one_index);
+        encode_im64(&instructions, 1);
+        encode_1(&instructions, COPY_IM_64, zero_word);
+        encode_im64(&instructions, 0);
+        encode_1(&instructions, COPY_IM_64, count);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, two);
+        encode_1(&instructions, COPY_IM_64, i_index);
+        encode_im64(&instructions, 2);
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, two);
+        encode_1(&instructions, COPY_IM_64, i_index);
+        encode_im64(&instructions, 2);
+        encode_1(&instructions, BLOCK, 2);
+
+        encode_1(&instructions, RET_V, count);
+
+    stbds_arrpush(blocks, entry_block);
+
+    // flags[2..n] = 1, as a bottom tested loop
+    InstructionPointer clear_block =
+        encode_w2(&instructions, STORE_GLOBAL_64, 0, one_index, i_index);
+        encode_3(&instructions, I_ADD_64, i_index, one_index, i_index);
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, one);
+        encode_3(&instructions, F_LT_64, i, n_plus_1, cond);
+        encode_2(&instructions, RE_NZ, 0, cond);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, clear_block);
+
+    InstructionPointer scan_block =
+        encode_3(&instructions, F_LT_64, n, i, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_w2(&instructions, LOAD_GLOBAL_64, 0, flag, i_index);
+        encode_2(&instructions, WHEN_NZ, 3, flag);
+
+        encode_3(&instructions, I_ADD_64, i_index, one_index, i_index);
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, scan_block);
+
+    InstructionPointer prime_block =
+        encode_2(&instructions, F_ADD_IM_64, count, count);
+        encode_im64(&instructions, one);
+        encode_3(&instructions, F_ADD_64, i, i, j);
+        encode_3(&instructions, I_ADD_64, i_index, i_index, j_index);
+        encode_1(&instructions, BLOCK, 4);
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, prime_block);
+
+    InstructionPointer strike_block =
+        encode_3(&instructions, F_LT_64, n, j, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_w2(&instructions, STORE_GLOBAL_64, 0, zero_word, j_index);
+        encode_3(&instructions, I_ADD_64, j_index, i_index, j_index);
+        encode_3(&instructions, F_ADD_64, j, i, j);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, strike_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, 11, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return sieve;
+}
+
+size_t scratch_sieve (double const* args) {
+    return (size_t) args[0] + 1;
+}
+
+double reference_sieve (double const* args) {
+    size_t n = (size_t) args[0];
+    uint8_t* flags = malloc(n + 1);
+    double count = 0.0;
+
+    for (size_t i = 2; i <= n; i++) flags[i] = 1;
+
+    for (size_t i = 2; i <= n; i++) {
+        if (!flags[i]) continue;
+        count += 1.0;
+        for (size_t j = i + i; j <= n; j += i) flags[j] = 0;
+    }
+
+    free(flags);
+    return count;
+}
+
+// u, v and the intermediate vector live in global 0 at these word offsets
+#define SPECTRAL_MAX_N 1024
+#define SPECTRAL_U 0
+#define SPECTRAL_V SPECTRAL_MAX_N
+#define SPECTRAL_TMP (2 * SPECTRAL_MAX_N)
+
+FunctionIndex encode_spectral_eval_a (stbds_arr(Function)* functions) {
+    FunctionIndex eval_a = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+    RegisterIndex i = 0;
+    RegisterIndex j = 1;
+    RegisterIndex t = 2;
+    RegisterIndex u = 3;
+
+    InstructionPointer entry_block =
+        // 1 / ((i + j) * (i + j + 1) / 2 + i + 1)
+        encode_3(&instructions, F_ADD_64, i, j, t);
+        encode_2(&instructions, F_ADD_IM_64, t, u);
+        encode_im64(&instructions, one);
+        encode_3(&instructions, F_MUL_64, t, u, t);
+        encode_1(&instructions, COPY_IM_64, u);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.5));
+        encode_3(&instructions, F_MUL_64, t, u, t);
+        encode_3(&instructions, F_ADD_64, t, i, t);
+        encode_2(&instructions, F_ADD_IM_64, t, t);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, COPY_IM_64, u);
+        encode_im64(&instructions, one);
+        encode_3(&instructions, F_DIV_64, u, t, u);
+        encode_1(&instructions, RET_V, u);
+
+    stbds_arrpush(blocks, entry_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {2, 4, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return eval_a;
+}
+
+// out[i] = sum over j of A(i, j) * in[j], or A(j, i) when transposed
+FunctionIndex encode_spectral_mul (stbds_arr(Function)* functions, FunctionIndex eval_a, bool transpose) {
+    FunctionIndex mul = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t zero = BITCAST(double, uint64_t, 0.0);
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+    RegisterIndex n = 0;
+    RegisterIndex in = 1;
+    RegisterIndex out = 2;
+    RegisterIndex i = 3;
+    RegisterIndex i_index = 4;
+    RegisterIndex j = 5;
+    RegisterIndex j_index = 6;
+    RegisterIndex one_index = 7;
+    RegisterIndex index = 8;
+    RegisterIndex sum = 9;
+    RegisterIndex a = 10;
+    RegisterIndex value = 11;
+    RegisterIndex cond = 12;
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, one_index);
+        encode_im64(&instructions, 1);
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, i_index);
+        encode_im64(&instructions, 0);
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, n);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer row_block =
+        encode_3(&instructions, F_EQ_64, i, n, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_1(&instructions, COPY_IM_64, sum);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, j);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, j_index);
+        encode_im64(&instructions, 0);
+        encode_1(&instructions, BLOCK, 2);
+
+        encode_3(&instructions, I_ADD_64, out, i_index, index);
+        encode_w2(&instructions, STORE_GLOBAL_64, 0, sum, index);
+
+        encode_3(&instructions, I_ADD_64, i_index, one_index, i_index);
+        encode_2(&instructions, F_ADD_IM_64, i, i);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, row_block);
+
+    InstructionPointer column_block =
+        encode_3(&instructions, F_EQ_64, j, n, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        encode_w1(&instructions, CALL_V, eval_a, a);
+        encode_registers(&instructions, 2, transpose ? (RegisterIndex[]){j, i} : (RegisterIndex[]){i, j});
+
+        encode_3(&instructions, I_ADD_64, in, j_index, index);
+        encode_w2(&instructions, LOAD_GLOBAL_64, 0, value, index);
+        encode_3(&instructions, F_MUL_64, a, value, a);
+        encode_3(&instructions, F_ADD_64, sum, a, sum);
+
+        encode_3(&instructions, I_ADD_64, j_index, one_index, j_index);
+        encode_2(&instructions, F_ADD_IM_64, j, j);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, column_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {3, 13, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return mul;
+}
+
+FunctionIndex encode_spectral_norm (stbds_arr(Function)* functions) {
+    FunctionIndex eval_a = encode_spectral_eval_a(functions);
+    FunctionIndex mul_av = encode_spectral_mul(functions, eval_a, false);
+    FunctionIndex mul_atv = encode_spectral_mul(functions, eval_a, true);
+
+    FunctionIndex mul_atav = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        RegisterIndex n = 0;
+        RegisterIndex in = 1;
+        RegisterIndex out = 2;
+        RegisterIndex tmp = 3;
+        RegisterIndex r = 4;
+
+        InstructionPointer entry_block =
+            encode_1(&instructions, COPY_IM_64, tmp);
+            encode_im64(&instructions, SPECTRAL_TMP);
+            encode_w1(&instructions, CALL_V, mul_av, r);
+            encode_registers(&instructions, 3, (RegisterIndex[]){n, in, tmp});
+            encode_w1(&instructions, CALL_V, mul_atv, r);
+            encode_registers(&instructions, 3, (RegisterIndex[]){n, tmp, out});
+            encode_1(&instructions, RET_V, r);
+
+        stbds_arrpush(blocks, entry_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {3, 5, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    FunctionIndex spectral = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        uint64_t zero = BITCAST(double, uint64_t, 0.0);
+        uint64_t one = BITCAST(double, uint64_t, 1.0);
+
+        RegisterIndex n = 0;
+        RegisterIndex i = 1;
+        RegisterIndex i_index = 2;
+        RegisterIndex one_index = 3;
+        RegisterIndex u = 4;
+        RegisterIndex v = 5;
+        RegisterIndex index = 6;
+        RegisterIndex one_value = 7;
+        RegisterIndex k = 8;
+        RegisterIndex r = 9;
+        RegisterIndex vbv = 10;
+        RegisterIndex vv = 11;
+        RegisterIndex a = 12;
+        RegisterIndex b = 13;
+        RegisterIndex cond = 14;
+
+        InstructionPointer entry_block =
+            encode_1(&instructions, COPY_IM_64, one_index);
+            encode_im64(&instructions, 1);
+            encode_1(&instructions, COPY_IM_64, u);
+            encode_im64(&instructions, SPECTRAL_U);
+            encode_1(&instructions, COPY_IM_64, v);
+            encode_im64(&instructions, SPECTRAL_V);
+            encode_1(&instructions, COPY_IM_64, one_value);
+            encode_im64(&instructions, one);
+
+            encode_1(&instructions, COPY_IM_64, i);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, COPY_IM_64, i_index);
+            encode_im64(&instructions, 0);
+            encode_1(&instructions, BLOCK, 1);
+
+            encode_1(&instructions, COPY_IM_64, k);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, BLOCK, 2);
+
+            encode_1(&instructions, COPY_IM_64, i);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, COPY_IM_64, i_index);
+            encode_im64(&instructions, 0);
+            encode_1(&instructions, COPY_IM_64, vbv);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, COPY_IM_64, vv);
+            encode_im64(&instructions, zero);
+            encode_1(&instructions, BLOCK, 3);
+
+            // sqrt(vBv / vv)
+            encode_3(&instructions, F_DIV_64, vbv, vv, a);
+            encode_2(&instructions, F_SQRT_64, a, a);
+            encode_1(&instructions, RET_V, a);
+
+        stbds_arrpush(blocks, entry_block);
+
+        InstructionPointer fill_block =
+            encode_3(&instructions, F_EQ_64, i, n, cond);
+            encode_2(&instructions, BR_NZ, 0, cond);
+
+            encode_3(&instructions, I_ADD_64, u, i_index, index);
+            encode_w2(&instructions, STORE_GLOBAL_64, 0, one_value, index);
+
+            encode_3(&instructions, I_ADD_64, i_index, one_index, i_index);
+            encode_2(&instructions, F_ADD_IM_64, i, i);
+            encode_im64(&instructions, one);
+            encode_1(&instructions, RE, 0);
+
+        stbds_arrpush(blocks, fill_block);
+
+        InstructionPointer power_block =
+            encode_2(&instructions, F_EQ_IM_64, k, cond);
+            encode_im64(&instructions, BITCAST(double, uint64_t, 10.0));
+            encode_2(&instructions, BR_NZ, 0, cond);
+
+            encode_w1(&instructions, CALL_V, mul_atav, r);
+            encode_registers(&instructions, 3, (RegisterIndex[]){n, u, v});
+            encode_w1(&instructions, CALL_V, mul_atav, r);
+            encode_registers(&instructions, 3, (RegisterIndex[]){n, v, u});
+
+            encode_2(&instructions, F_ADD_IM_64, k, k);
+            encode_im64(&instructions, one);
+            encode_1(&instructions, RE, 0);
+
+        stbds_arrpush(blocks, power_block);
+
+        InstructionPointer dot_block =
+            encode_3(&instructions, F_EQ_64, i, n, cond);
+            encode_2(&instructions, BR_NZ, 0, cond);
+
+            encode_3(&instructions, I_ADD_64, u, i_index, index);
+            encode_w2(&instructions, LOAD_GLOBAL_64, 0, a, index);
+            encode_3(&instructions, I_ADD_64, v, i_index, index);
+            encode_w2(&instructions, LOAD_GLOBAL_64, 0, b, index);
+
+            encode_3(&instructions, F_MUL_64, a, b, a);
+            encode_3(&instructions, F_ADD_64, vbv, a, vbv);
+            encode_3(&instructions, F_MUL_64, b, b, b);
+            encode_3(&instructions, F_ADD_64, vv, b, vv);
+
+            encode_3(&instructions, I_ADD_64, i_index, one_index, i_index);
+            encode_2(&instructions, F_ADD_IM_64, i, i);
+            encode_im64(&instructions, one);
+            encode_1(&instructions, RE, 0);
+
+        stbds_arrpush(blocks, dot_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {1, 15, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    return spectral;
+}
+
+size_t scratch_spectral_norm (double const* args) {
+    return 3 * SPECTRAL_MAX_N;
+}
+
+double reference_spectral_eval_a (double i, double j) {
+    double t = i + j;
+    double u = t + 1.0;
+    t = t * u;
+    t = t * 0.5;
+    t = t + i;
+    t = t + 1.0;
+    return 1.0 / t;
+}
+
+void reference_spectral_mul (size_t n, double const* in, double* out, bool transpose) {
+    for (size_t i = 0; i < n; i++) {
+        double sum = 0.0;
+        for (size_t j = 0; j < n; j++) {
+            double a = transpose
+                ? reference_spectral_eval_a((double) j, (double) i)
+                : reference_spectral_eval_a((double) i, (double) j);
+            a = a * in[j];
+            sum = sum + a;
+        }
+        out[i] = sum;
+    }
+}
+
+double reference_spectral_norm (double const* args) {
+    size_t n = (size_t) args[0];
+    double* u = malloc(3 * n * sizeof(double));
+    double* v = u + n;
+    double* tmp = v + n;
+
+    for (size_t i = 0; i < n; i++) u[i] = 1.0;
+
+    for (int k = 0; k < 10; k++) {
+        reference_spectral_mul(n, u, tmp, false);
+        reference_spectral_mul(n, tmp, v, true);
+        reference_spectral_mul(n, v, tmp, false);
+        reference_spectral_mul(n, tmp, u, true);
+    }
+
+    double vbv = 0.0;
+    double vv = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double a = u[i] * v[i];
+        vbv = vbv + a;
+        double b = v[i] * v[i];
+        vv = vv + b;
+    }
+
+    free(u);
+    return sqrt(vbv / vv);
+}
+
+#define NBODY_BODIES 5
+#define NBODY_FIELDS 7
+#define NBODY_DT 0.01
+
+typedef enum { BODY_X, BODY_Y, BODY_Z, BODY_VX, BODY_VY, BODY_VZ, BODY_MASS } BodyField;
+
+// sun, jupiter, saturn, uranus and neptune in solar masses, AU and AU per day scaled to years,
+// with the sun's velocity offset so the system's total momentum is zero
+void nbody_initial (double bodies [NBODY_BODIES][NBODY_FIELDS]) {
+    double const pi = 3.141592653589793;
+    double const solar_mass = 4.0 * pi * pi;
+    double const days_per_year = 365.24;
+
+    double const initial [NBODY_BODIES][NBODY_FIELDS] = {
+        { 0, 0, 0, 0, 0, 0, 1 },
+        {
+            4.84143144246472090e+00, -1.16032004402742839e+00, -1.03622044471123109e-01,
+            1.66007664274403694e-03, 7.69901118419740425e-03, -6.90460016972063023e-05,
+            9.54791938424326609e-04,
+        },
+        {
+            8.34336671824457987e+00, 4.12479856412430479e+00, -4.03523417114321381e-01,
+            -2.76742510726862411e-03, 4.99852801234917238e-03, 2.30417297573763929e-05,
+            2.85885980666130812e-04,
+        },
+        {
+            1.28943695621391310e+01, -1.51111514016986312e+01, -2.23307578892655734e-01,
+            2.96460137564761618e-03, 2.37847173959480950e-03, -2.96589568540237556e-05,
+            4.36624404335156298e-05,
+        },
+        {
+            1.53796971148509165e+01, -2.59193146099879641e+01, 1.79258772950371181e-01,
+            2.68067772490389322e-03, 1.62824170038242295e-03, -9.51592254519715870e-05,
+            5.15138902046611451e-05,
+        },
+    };
+
+    for (int b = 0; b < NBODY_BODIES; b++) {
+        for (int f = 0; f < NBODY_FIELDS; f++) bodies[b][f] = initial[b][f];
+        for (int f = BODY_VX; f <= BODY_VZ; f++) bodies[b][f] *= days_per_year;
+        bodies[b][BODY_MASS] *= solar_mass;
+    }
+
+    for (int f = BODY_VX; f <= BODY_VZ; f++) {
+        double momentum = 0.0;
+        for (int b = 0; b < NBODY_BODIES; b++) momentum += bodies[b][f] * bodies[b][BODY_MASS];
+        bodies[0][f] = -momentum / solar_mass;
+    }
+}
+
+// the bodies stay in registers for the whole run; the pair loops are unrolled at encode time
+FunctionIndex encode_nbody (stbds_arr(Function)* functions) {
+    FunctionIndex nbody = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    double bodies [NBODY_BODIES][NBODY_FIELDS];
+    nbody_initial(bodies);
+
+    RegisterIndex steps = 0;
+    RegisterIndex step = 1;
+    #define BODY(b, f) ((RegisterIndex) (2 + (b) * NBODY_FIELDS + (f)))
+    RegisterIndex dt = BODY(NBODY_BODIES, 0);
+    RegisterIndex d [3] = { dt + 1, dt + 2, dt + 3 };
+    RegisterIndex d2 = dt + 4;
+    RegisterIndex t = dt + 5;
+    RegisterIndex mag = dt + 6;
+    RegisterIndex mi_mag = dt + 7;
+    RegisterIndex mj_mag = dt + 8;
+    RegisterIndex energy = dt + 9;
+    RegisterIndex cond = dt + 10;
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, step);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, dt);
+        encode_im64(&instructions, BITCAST(double, uint64_t, NBODY_DT));
+
+        for (int b = 0; b < NBODY_BODIES; b++) {
+            for (int f = 0; f < NBODY_FIELDS; f++) {
+                encode_1(&instructions, COPY_IM_64, BODY(b, f));
+                encode_im64(&instructions, BITCAST(double, uint64_t, bodies[b][f]));
+            }
+        }
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, COPY_IM_64, energy);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+
+        for (int i = 0; i < NBODY_BODIES; i++) {
+            // 0.5 * m * |v|^2
+            encode_3(&instructions, F_MUL_64, BODY(i, BODY_VX), BODY(i, BODY_VX), t);
+            encode_3(&instructions, F_MUL_64, BODY(i, BODY_VY), BODY(i, BODY_VY), d2);
+            encode_3(&instructions, F_ADD_64, t, d2, t);
+            encode_3(&instructions, F_MUL_64, BODY(i, BODY_VZ), BODY(i, BODY_VZ), d2);
+            encode_3(&instructions, F_ADD_64, t, d2, t);
+            encode_3(&instructions, F_MUL_64, t, BODY(i, BODY_MASS), t);
+            encode_1(&instructions, COPY_IM_64, d2);
+            encode_im64(&instructions, BITCAST(double, uint64_t, 0.5));
+            encode_3(&instructions, F_MUL_64, t, d2, t);
+            encode_3(&instructions, F_ADD_64, energy, t, energy);
+
+            for (int j = i + 1; j < NBODY_BODIES; j++) {
+                // m_i * m_j / |x_i - x_j|
+                for (int c = 0; c < 3; c++) {
+                    encode_3(&instructions, F_SUB_64, BODY(i, BODY_X + c), BODY(j, BODY_X + c), d[c]);
+                }
+                encode_3(&instructions, F_MUL_64, d[0], d[0], d2);
+                encode_3(&instructions, F_MUL_64, d[1], d[1], t);
+                encode_3(&instructions, F_ADD_64, d2, t, d2);
+                encode_3(&instructions, F_MUL_64, d[2], d[2], t);
+                encode_3(&instructions, F_ADD_64, d2, t, d2);
+                encode_2(&instructions, F_SQRT_64, d2, d2);
+                encode_3(&instructions, F_MUL_64, BODY(i, BODY_MASS), BODY(j, BODY_MASS), t);
+                encode_3(&instructions, F_DIV_64, t, d2, t);
+                encode_3(&instructions, F_SUB_64, energy, t, energy);
+            }
+        }
+
+        encode_1(&instructions, RET_V, energy);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer step_block =
+        encode_3(&instructions, F_EQ_64, step, steps, cond);
+        encode_2(&instructions, BR_NZ, 0, cond);
+
+        for (int i = 0; i < NBODY_BODIES; i++) {
+            for (int j = i + 1; j < NBODY_BODIES; j++) {
+                for (int c = 0; c < 3; c++) {
+                    encode_3(&instructions, F_SUB_64, BODY(i, BODY_X + c), BODY(j, BODY_X + c), d[c]);
+                }
+
+                // mag = dt / (d2 * sqrt(d2))
+                encode_3(&instructions, F_MUL_64, d[0], d[0], d2);
+                encode_3(&instructions, F_MUL_64, d[1], d[1], t);
+                encode_3(&instructions, F_ADD_64, d2, t, d2);
+                encode_3(&instructions, F_MUL_64, d[2], d[2], t);
+                encode_3(&instructions, F_ADD_64, d2, t, d2);
+                encode_2(&instructions, F_SQRT_64, d2, t);
+                encode_3(&instructions, F_MUL_64, d2, t, t);
+                encode_3(&instructions, F_DIV_64, dt, t, mag);
+
+                encode_3(&instructions, F_MUL_64, BODY(j, BODY_MASS), mag, mj_mag);
+                encode_3(&instructions, F_MUL_64, BODY(i, BODY_MASS), mag, mi_mag);
+
+                for (int c = 0; c < 3; c++) {
+                    encode_3(&instructions, F_MUL_64, d[c], mj_mag, t);
+                    encode_3(&instructions, F_SUB_64, BODY(i, BODY_VX + c), t, BODY(i, BODY_VX + c));
+                    encode_3(&instructions, F_MUL_64, d[c], mi_mag, t);
+                    encode_3(&instructions, F_ADD_64, BODY(j, BODY_VX + c), t, BODY(j, BODY_VX + c));
+                }
+            }
+        }
+
+        for (int b = 0; b < NBODY_BODIES; b++) {
+            for (int c = 0; c < 3; c++) {
+                encode_3(&instructions, F_MUL_64, dt, BODY(b, BODY_VX + c), t);
+                encode_3(&instructions, F_ADD_64, BODY(b, BODY_X + c), t, BODY(b, BODY_X + c));
+            }
+        }
+
+        encode_2(&instructions, F_ADD_IM_64, step, step);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+        encode_1(&instructions, RE, 0);
+
+    stbds_arrpush(blocks, step_block);
+
+    #undef BODY
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, (RegisterIndex) (cond + 1), bytecode};
+    stbds_arrpush(*functions, function);
+
+    return nbody;
+}
+
+double reference_nbody (double const* args) {
+    double bodies [NBODY_BODIES][NBODY_FIELDS];
+    nbody_initial(bodies);
+
+    double const dt = NBODY_DT;
+
+    for (double step = 0.0; step != args[0]; step += 1.0) {
+        for (int i = 0; i < NBODY_BODIES; i++) {
+            for (int j = i + 1; j < NBODY_BODIES; j++) {
+                double d [3];
+                for (int c = 0; c < 3; c++) d[c] = bodies[i][BODY_X + c] - bodies[j][BODY_X + c];
+
+                double d2 = d[0] * d[0];
+                double t = d[1] * d[1];
+                d2 = d2 + t;
+                t = d[2] * d[2];
+                d2 = d2 + t;
+                t = sqrt(d2);
+                t = d2 * t;
+                double mag = dt / t;
+
+                double mj_mag = bodies[j][BODY_MASS] * mag;
+                double mi_mag = bodies[i][BODY_MASS] * mag;
+
+                for (int c = 0; c < 3; c++) {
+                    t = d[c] * mj_mag;
+                    bodies[i][BODY_VX + c] = bodies[i][BODY_VX + c] - t;
+                    t = d[c] * mi_mag;
+                    bodies[j][BODY_VX + c] = bodies[j][BODY_VX + c] + t;
+                }
+            }
+        }
+
+        for (int b = 0; b < NBODY_BODIES; b++) {
+            for (int c = 0; c < 3; c++) {
+                double t = dt * bodies[b][BODY_VX + c];
+                bodies[b][BODY_X + c] = bodies[b][BODY_X + c] + t;
+            }
+        }
+    }
+
+    double energy = 0.0;
+
+    for (int i = 0; i < NBODY_BODIES; i++) {
+        double t = bodies[i][BODY_VX] * bodies[i][BODY_VX];
+        double s = bodies[i][BODY_VY] * bodies[i][BODY_VY];
+        t = t + s;
+        s = bodies[i][BODY_VZ] * bodies[i][BODY_VZ];
+        t = t + s;
+        t = t * bodies[i][BODY_MASS];
+        t = t * 0.5;
+        energy = energy + t;
+
+        for (int j = i + 1; j < NBODY_BODIES; j++) {
+            double d [3];
+            for (int c = 0; c < 3; c++) d[c] = bodies[i][BODY_X + c] - bodies[j][BODY_X + c];
+
+            double d2 = d[0] * d[0];
+            t = d[1] * d[1];
+            d2 = d2 + t;
+            t = d[2] * d[2];
+            d2 = d2 + t;
+            d2 = sqrt(d2);
+            t = bodies[i][BODY_MASS] * bodies[j][BODY_MASS];
+            t = t / d2;
+            energy = energy - t;
+        }
+    }
+
+    return energy;
+}
+
+// each workload leans on a different part of the interpreter: recursion and tail calls (ackermann, fib, tak),
+// the call sequence alone (call_overhead), block dispatch (nested_loops), unpredictable branches (branches), jump
+// tables (dispatch), float arithmetic in registers (mandelbrot, nbody) and global memory traffic (sieve, spectral_norm)
+Workload const workloads [] = {
+    { "ackermann",     encode_ackermann_workload, 2, { 3.0, 8.0 },          reference_ackermann,     NULL },
+    { "fib",           encode_fib,                1, { 27.0 },              reference_fib,           NULL },
+    { "tak",           encode_tak,                3, { 24.0, 16.0, 8.0 },   reference_tak,           NULL },
+    { "nested_loops",  encode_nested_loops,       2, { 1000.0, 5000.0 },    reference_nested_loops,  NULL },
+    { "call_overhead", encode_call_overhead,      1, { 2000000.0 },         reference_call_overhead, NULL },
+    { "branches",      encode_branches,           1, { 1000000.0 },         reference_branches,      NULL },
+    { "dispatch",      encode_dispatch,           1, { 1000000.0 },         reference_dispatch,      NULL },
+    { "mandelbrot",    encode_mandelbrot,         2, { 200.0, 50.0 },       reference_mandelbrot,    NULL },
+    { "nbody",         encode_nbody,              1, { 50000.0 },           reference_nbody,         NULL },
+    { "sieve",         encode_sieve,              1, { 1000000.0 },         reference_sieve,         scratch_sieve },
+    { "spectral_norm", encode_spectral_norm,      1, { 100.0 },             reference_spectral_norm, scratch_spectral_norm },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(Workload))
+
+
+bool bench_run(Workload const* workload, size_t warmup, size_t repetitions, bool use_optimizer, bool use_ir, Counters const* counters, BenchResult* result) {
+    stbds_arr(Function) functions = NULL;
+    FunctionIndex entry = workload->encode(&functions);
+
+    uint8_t* globals [1] = { NULL };
+    if (workload->scratch_words != NULL) {
+        globals[0] = calloc(workload->scratch_words(workload->args), sizeof(uint64_t));
+    }
+
+    Program program = {
+        .functions = functions,
+        .globals = globals,
+        .num_globals = workload->scratch_words != NULL ? 1 : 0,
+        .num_functions = (FunctionIndex) stbds_arrlenu(functions),
+    };
+
+    uint64_t args [BENCH_MAX_ARGS];
+    for (RegisterIndex i = 0; i < workload->num_args; i++) {
+        args[i] = BITCAST(double, uint64_t, workload->args[i]);
+    }
+
+    double expected = workload->reference(workload->args);
+    double* samples = malloc(repetitions * sizeof(double));
+
+    Verification verification;
+    bool ok = verify(&program, &verification);
+    if (!ok) {
+        fprintf(stderr, "%s: f%d i%d: %s\n", workload->name, verification.function, verification.instruction, verification.error);
+    }
+
+    if (ok && use_optimizer) {
+        OptimizeReport report;
+        optimize(functions, program.num_functions, &report);
+        optimize_report_free(&report);
+
+        verification_free(&verification);
+        ok = verify(&program, &verification);
+        if (!ok) {
+            fprintf(stderr, "%s: optimized f%d i%d: %s\n", workload->name, verification.function, verification.instruction, verification.error);
+        }
+    }
+
+    if (ok && use_ir) {
+        for (FunctionIndex i = 0; i < program.num_functions; i++) ir_round_trip(functions, i, NULL);
+
+        verification_free(&verification);
+        ok = verify(&program, &verification);
+        if (!ok) {
+            fprintf(stderr, "%s: lowered from IR f%d i%d: %s\n", workload->name, verification.function, verification.instruction, verification.error);
+        }
+    }
+
+    Fiber fiber = ok ? fiber_create_for(&program, &verification, entry) : fiber_create(&program);
+
+    memset(&result->counters, 0, sizeof(CounterValues));
+
+    // one untimed pass through the profiling eval gives the bytecode instruction count the counters are divided by
+    uint64_t calibration_ret_val = 0;
+    profile_reset();
+    if (ok && invoke_with(eval_profiled, &fiber, entry, &calibration_ret_val, args) == OKAY) {
+        result->bytecode_instructions = 0;
+        for (int op = 0; op <= RET_V; op++) result->bytecode_instructions += opcode_profile.counts[op];
+    }
+
+    for (size_t i = 0; ok && i < warmup + repetitions; i++) {
+        uint64_t ret_val = 0;
+        bool timed = i >= warmup;
+
+        if (timed) counters_start(counters);
+        uint64_t start = bench_now_ns();
+        Trap trap = invoke_verified(&verification, &fiber, entry, &ret_val, args);
+        uint64_t end = bench_now_ns();
+        if (timed) counters_stop(counters, &result->counters);
+
+        double value = BITCAST(uint64_t, double, ret_val);
+
+        if (trap != OKAY) {
+            fprintf(stderr, "%s: trap %s\n", workload->name, trap_name(trap));
+            ok = false;
+            break;
+        }
+
+        if (value != expected) {
+            fprintf(stderr, "%s: result %f, expected %f\n", workload->name, value, expected);
+            ok = false;
+            break;
+        }
+
+        result->result = value;
+        if (i >= warmup) samples[i - warmup] = (double) (end - start);
+    }
+
+    if (ok) {
+        qsort(samples, repetitions, sizeof(double), bench_compare_doubles);
+
+        double sum = 0.0;
+        for (size_t i = 0; i < repetitions; i++) sum += samples[i];
+        double mean = sum / (double) repetitions;
+
+        double variance = 0.0;
+        for (size_t i = 0; i < repetitions; i++) variance += (samples[i] - mean) * (samples[i] - mean);
+        variance = repetitions > 1 ? variance / (double) (repetitions - 1) : 0.0;
+
+        double stddev = sqrt(variance);
+        double margin = repetitions > 1 ? bench_t_critical(repetitions - 1) * stddev / sqrt((double) repetitions) : 0.0;
+
+        size_t p99_rank = (size_t) ceil(0.99 * (double) repetitions);
+
+        result->name = workload->name;
+        result->repetitions = repetitions;
+        result->min_ns = samples[0];
+        result->max_ns = samples[repetitions - 1];
+        result->mean_ns = mean;
+        result->median_ns = repetitions % 2 == 1
+            ? samples[repetitions / 2]
+            : (samples[repetitions / 2 - 1] + samples[repetitions / 2]) / 2.0;
+        result->p99_ns = samples[(p99_rank > 0 ? p99_rank : 1) - 1];
+        result->stddev_ns = stddev;
+        result->ci_low_ns = mean - margin;
+        result->ci_high_ns = mean + margin;
+        result->peak_rss_kb = bench_peak_rss_kb();
+
+        for (int i = 0; i < NUM_COUNTERS; i++) result->counters.values[i] /= (double) repetitions;
+    }
+
+    free(samples);
+    free(globals[0]);
+    verification_free(&verification);
+    fiber_destroy(&fiber);
+
+    for (size_t i = 0; i < stbds_arrlenu(functions); i++) {
+        stbds_arrfree(functions[i].bytecode.blocks);
+        stbds_arrfree(functions[i].bytecode.instructions);
+        stbds_arrfree(functions[i].bytecode.constants);
+    }
+    stbds_arrfree(functions);
+
+    return ok;
+}
+
+void bench_write_json(FILE* out, BenchResult const* results, size_t num_results) {
+    fprintf(out, "{\n  \"compiler\": \"%s\",\n  \"results\": [", __VERSION__);
+
+    for (size_t i = 0; i < num_results; i++) {
+        BenchResult const* r = results + i;
+        fprintf(out,
+            "%s\n    {\"name\": \"%s\", \"repetitions\": %lu, \"result\": %.17g, "
+            "\"min_ns\": %.1f, \"max_ns\": %.1f, \"mean_ns\": %.1f, \"median_ns\": %.1f, \"p99_ns\": %.1f, "
+            "\"stddev_ns\": %.1f, \"ci_low_ns\": %.1f, \"ci_high_ns\": %.1f, \"peak_rss_kb\": %ld, "
+            "\"bytecode_instructions\": %lu, \"counters\": {",
+            i == 0 ? "" : ",",
+            r->name, r->repetitions, r->result,
+            r->min_ns, r->max_ns, r->mean_ns, r->median_ns, r->p99_ns,
+            r->stddev_ns, r->ci_low_ns, r->ci_high_ns, r->peak_rss_kb,
+            r->bytecode_instructions);
+
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            fprintf(out, "%s\"%s\": ", c == 0 ? "" : ", ", counter_names[c]);
+            if (r->counters.available[c]) fprintf(out, "%.0f", r->counters.values[c]);
+            else fprintf(out, "null");
+        }
+
+        fprintf(out, "}}");
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+char* bench_read_file(char const* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* contents = malloc(length + 1);
+    size_t read = fread(contents, 1, length, file);
+    contents[read] = '\0';
+    fclose(file);
+
+    return contents;
+}
+
+// finds `"field": <number>` inside the object following `"name": "<name>"` in a file written by bench_write_json
+bool bench_baseline_field(char const* baseline, char const* name, char const* field, double* value) {
+    char pattern [256];
+    snprintf(pattern, sizeof(pattern), "\"name\": \"%s\"", name);
+
+    char const* object = strstr(baseline, pattern);
+    if (object == NULL) return false;
+
+    char const* end = strchr(object, '}');
+
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", field);
+    char const* found = strstr(object, pattern);
+    if (found == NULL || (end != NULL && found > end)) return false;
+
+    *value = strtod(found + strlen(pattern), NULL);
+    return true;
+}
+
+// a workload regresses when its median is slower than the baseline by more than the threshold
+// and the confidence intervals do not overlap, so noisy runs are reported but not flagged
+size_t bench_compare(char const* baseline, BenchResult const* results, size_t num_results, double threshold) {
+    size_t regressions = 0;
+
+    printf("\n%-16s %14s %14s %9s  %s\n", "workload", "baseline", "current", "delta", "verdict");
+
+    for (size_t i = 0; i < num_results; i++) {
+        BenchResult const* r = results + i;
+        double base_median, base_ci_low, base_ci_high;
+
+        if (!bench_baseline_field(baseline, r->name, "median_ns", &base_median)
+         || !bench_baseline_field(baseline, r->name, "ci_low_ns", &base_ci_low)
+         || !bench_baseline_field(baseline, r->name, "ci_high_ns", &base_ci_high)
+        ) {
+            printf("%-16s %14s %14.0f %9s  %s\n", r->name, "-", r->median_ns, "-", "new");
+            continue;
+        }
+
+        double delta = (r->median_ns - base_median) / base_median;
+        char const* verdict = "ok";
+
+        if (delta > threshold && r->ci_low_ns > base_ci_high) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (delta < -threshold && r->ci_high_ns < base_ci_low) {
+            verdict = "improved";
+        }
+
+        printf("%-16s %14.0f %14.0f %+8.2f%%  %s\n", r->name, base_median, r->median_ns, delta * 100.0, verdict);
+    }
+
+    return regressions;
+}
+
+void bench_print_ratio(CounterValues const* counters, CounterKind numerator, double denominator) {
+    if (counters->available[numerator] && denominator > 0.0) {
+        printf(" %12.4f", counters->values[numerator] / denominator);
+    } else {
+        printf(" %12s", "-");
+    }
+}
+
+// per bytecode instruction figures separate dispatch costs (branch mispredictions) from
+// code and data footprint (cache misses) when a handler or the dispatch loop changes
+void bench_print_counters(BenchResult const* results, size_t num_results) {
+    printf("\n%-16s %12s %12s %12s %12s %12s\n",
+        "workload", "ipc", "instr/bc", "brmiss/bc", "l1imiss/bc", "l1dmiss/bc");
+
+    for (size_t i = 0; i < num_results; i++) {
+        BenchResult const* r = results + i;
+        CounterValues const* c = &r->counters;
+        double bytecode = (double) r->bytecode_instructions;
+
+        printf("%-16s", r->name);
+
+        if (c->available[COUNTER_INSTRUCTIONS] && c->available[COUNTER_CYCLES] && c->values[COUNTER_CYCLES] > 0.0) {
+            printf(" %12.3f", c->values[COUNTER_INSTRUCTIONS] / c->values[COUNTER_CYCLES]);
+        } else {
+            printf(" %12s", "-");
+        }
+
+        bench_print_ratio(c, COUNTER_INSTRUCTIONS, bytecode);
+        bench_print_ratio(c, COUNTER_BRANCH_MISSES, bytecode);
+        bench_print_ratio(c, COUNTER_L1I_MISSES, bytecode);
+        bench_print_ratio(c, COUNTER_L1D_MISSES, bytecode);
+
+        printf("\n");
+    }
+}
+
+// --micro: every opcode is repeated MICRO_UNROLL times inside a RE loop, the same loop with an empty body is
+// subtracted, and what remains is divided by the number of instructions the body executed
+#define MICRO_ITERATIONS 100000
+#define MICRO_UNROLL 16
+#define MICRO_MAX_OPS 3
+
+// helper blocks that control flow cases branch into
+#define MICRO_BR_BLOCK 2
+#define MICRO_BR_NZ_BLOCK 3
+
+typedef struct {
+    char const* name;
+    OpCode ops [MICRO_MAX_OPS];
+    uint8_t num_ops;
+} MicroCase;
+
+typedef struct {
+    char const* name;
+    double ns_per_instruction;
+    double cycles_per_instruction;
+} MicroResult;
+
+// operands are chosen so every comparison is false and every conditional branch falls through,
+// unless a case below takes the branch on purpose through micro_truth
+enum {
+    micro_count,
+    micro_i,
+    micro_cond,
+    micro_a,
+    micro_b,
+    micro_fa,
+    micro_fb,
+    micro_ia,
+    micro_ib,
+    micro_index,
+    micro_dst,
+    micro_cmp,
+    micro_truth,
+    micro_limit,
+    MICRO_REGISTERS,
+};
+
+// opcodes that cannot run on their own are measured together with the instruction that undoes them;
+// HALT and UNREACHABLE leave eval and LAZY_LINK runs once per function, so they are not measured;
+// RE is the loop itself and reported as the baseline, and the LOOP_ instructions, which would restart that loop, close
+// a loop of their own instead, see micro_back_edge
+MicroCase const micro_composite_cases [] = {
+    { "BLOCK+BR",                 { BLOCK, BR },                      2 },
+    { "IF_NZ+BR",                 { IF_NZ, BR },                      2 },
+    { "WHEN_NZ+BR (taken)",       { WHEN_NZ, BR },                    2 },
+    { "SWITCH+BR",                { SWITCH, BR },                     2 },
+    { "BLOCK+BR_NZ (taken)",      { BLOCK, BR_NZ },                   2 },
+    { "CALL_V+RET_V",             { CALL_V, RET_V },                  2 },
+    { "CALL_V+TAIL_CALL_V+RET_V", { CALL_V, TAIL_CALL_V, RET_V },     3 },
+    { "F_EQ_64+BR_NZ",            { F_EQ_64, BR_NZ },                 2 },
+    { "F_LT_IM_B_64+WHEN_NZ",     { F_LT_IM_B_64, WHEN_NZ },          2 },
+    { "F_MUL_64+F_ADD_64",        { F_MUL_64, F_ADD_64 },             2 },
+    { "COPY_IM_64+F_ADD_64",      { COPY_IM_64, F_ADD_64 },           2 },
+    { "I_ADD_64+LOAD_GLOBAL_64",  { I_ADD_64, LOAD_GLOBAL_64 },       2 },
+    { "LOAD_GLOBAL_64+F_ADD_64",  { LOAD_GLOBAL_64, F_ADD_64 },       2 },
+};
+
+#define NUM_MICRO_COMPOSITE_CASES (sizeof(micro_composite_cases) / sizeof(MicroCase))
+
+bool micro_standalone(OpCode op) {
+    switch (op) {
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+        case IF_NZ:
+        case SWITCH:
+        case BLOCK:
+        case BR:
+        case RE:
+        case LOOP_F64:
+        case LOOP_IM_F64:
+        case LOOP_I64:
+        case LOOP_IM_I64:
+        case CALL_V:
+        case TAIL_CALL_V:
+        case RET_V:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// a LOOP_ case replaces the baseline's F_EQ_64+BR_NZ+F_ADD_IM_64+RE with the one instruction and leaves the body empty,
+// so it is reported per iteration and compares with the baseline loop rather than being subtracted from it
+bool micro_back_edge(OpCode op) {
+    return op == LOOP_F64 || op == LOOP_IM_F64 || op == LOOP_I64 || op == LOOP_IM_I64;
+}
+
+void micro_emit_op (Encoder* instructions, OpCode op) {
+    switch (op) {
+        case READ_GLOBAL_32:
+        case READ_GLOBAL_64:
+            encode_w1(instructions, op, 0, micro_dst);
+            break;
+
+        case LOAD_GLOBAL_64:
+            encode_w2(instructions, op, 0, micro_dst, micro_index);
+            break;
+
+        case STORE_GLOBAL_64:
+            encode_w2(instructions, op, 0, micro_a, micro_index);
+            break;
+
+        case COPY_IM_64:
+            encode_1(instructions, op, micro_dst);
+            encode_im64(instructions, BITCAST(double, uint64_t, 0.5));
+            break;
+
+        case COPY_64:
+            encode_2(instructions, op, micro_a, micro_dst);
+            break;
+
+        case WHEN_NZ:
+            encode_2(instructions, op, MICRO_BR_BLOCK, micro_cmp);
+            break;
+
+        case BR_NZ:
+        case RE_NZ:
+            encode_2(instructions, op, 0, micro_cmp);
+            break;
+
+        case F_ADD_32:
+        case F_SUB_32:
+            encode_3(instructions, op, micro_fa, micro_fb, micro_dst);
+            break;
+
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+            encode_2_im(instructions, op, BITCAST(float, uint32_t, 0.5f), micro_fa, micro_dst);
+            break;
+
+        case F_ADD_64:
+        case F_SUB_64:
+        case F_MUL_64:
+        case F_DIV_64:
+            encode_3(instructions, op, micro_a, micro_b, micro_dst);
+            break;
+
+        case F_ADD_IM_64:
+        case F_SUB_IM_A_64:
+        case F_SUB_IM_B_64:
+            encode_2(instructions, op, micro_a, micro_dst);
+            encode_im64(instructions, BITCAST(double, uint64_t, 0.5));
+            break;
+
+        case F_SQRT_64:
+            encode_2(instructions, op, micro_a, micro_dst);
+            break;
+
+        case I_ADD_64:
+        case I_SUB_64:
+            encode_3(instructions, op, micro_ia, micro_ib, micro_dst);
+            break;
+
+        case F_EQ_32:
+        case F_LT_32:
+            encode_3(instructions, op, micro_fa, micro_fb, micro_cmp);
+            break;
+
+        case F_EQ_IM_32:
+        case F_LT_IM_A_32:
+            encode_2_im(instructions, op, BITCAST(float, uint32_t, 10.0f), micro_fa, micro_cmp);
+            break;
+
+        case F_LT_IM_B_32:
+            encode_2_im(instructions, op, BITCAST(float, uint32_t, 0.0f), micro_fa, micro_cmp);
+            break;
+
+        case F_EQ_64:
+        case F_LT_64:
+            encode_3(instructions, op, micro_a, micro_b, micro_cmp);
+            break;
+
+        case F_EQ_IM_64:
+        case F_LT_IM_A_64:
+            encode_2(instructions, op, micro_a, micro_cmp);
+            encode_im64(instructions, BITCAST(double, uint64_t, 10.0));
+            break;
+
+        case F_LT_IM_B_64:
+            encode_2(instructions, op, micro_a, micro_cmp);
+            encode_im64(instructions, BITCAST(double, uint64_t, 0.0));
+            break;
+
+        case S_EQ_64:
+        case S_LT_64:
+            encode_3(instructions, op, micro_ia, micro_ib, micro_cmp);
+            break;
+
+        case S_EQ_IM_64:
+            encode_2(instructions, op, micro_ia, micro_cmp);
+            encode_im64(instructions, 0);
+            break;
+
+        case SELECT_64:
+            encode_3(instructions, op, micro_cmp, micro_a, micro_dst);
+            break;
+
+        case SELECT_F_LT_64:
+            encode_3(instructions, op, micro_a, micro_b, micro_dst);
+            break;
+
+        case SELECT_S_LT_64:
+            encode_3(instructions, op, micro_ia, micro_ib, micro_dst);
+            break;
+
+        default:
+            fprintf(stderr, "micro: no standalone form for %s\n", opcode_name(op));
+            abort();
+    }
+}
+
+void micro_emit_case (Encoder* instructions, MicroCase const* micro, FunctionIndex ret, FunctionIndex tail) {
+    switch (micro->ops[0]) {
+        case BLOCK:
+            encode_1(instructions, BLOCK, micro->ops[1] == BR ? MICRO_BR_BLOCK : MICRO_BR_NZ_BLOCK);
+            break;
+
+        case IF_NZ:
+            encode_3(instructions, IF_NZ, MICRO_BR_BLOCK, MICRO_BR_BLOCK, micro_truth);
+            break;
+
+        case WHEN_NZ:
+            encode_2(instructions, WHEN_NZ, MICRO_BR_BLOCK, micro->num_ops > 1 ? micro_truth : micro_cmp);
+            break;
+
+        case SWITCH:
+            encode_2(instructions, SWITCH, micro_index, 4);
+            encode_blocks(instructions, 5, (BlockIndex[]){MICRO_BR_BLOCK, MICRO_BR_BLOCK, MICRO_BR_BLOCK, MICRO_BR_BLOCK, MICRO_BR_BLOCK});
+            break;
+
+        case CALL_V:
+            encode_w1(instructions, CALL_V, micro->num_ops == 3 ? tail : ret, micro_dst);
+            encode_registers(instructions, 1, (RegisterIndex[]){micro_a});
+            break;
+
+        default:
+            for (uint8_t k = 0; k < micro->num_ops; k++) micro_emit_op(instructions, micro->ops[k]);
+    }
+}
+
+// a NULL case gives the empty loop that is subtracted as the baseline
+FunctionIndex encode_micro (stbds_arr(Function)* functions, MicroCase const* micro) {
+    FunctionIndex ret = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        InstructionPointer entry_block = encode_1(&instructions, RET_V, 0);
+        stbds_arrpush(blocks, entry_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {1, 1, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    FunctionIndex tail = (FunctionIndex) stbds_arrlenu(*functions);
+    {
+        stbds_arr(InstructionPointer) blocks = NULL;
+        Encoder instructions = {};
+
+        InstructionPointer entry_block = encode_w0(&instructions, TAIL_CALL_V, ret);
+        encode_registers(&instructions, 1, (RegisterIndex[]){0});
+        stbds_arrpush(blocks, entry_block);
+
+        Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+        Function function = {1, 1, bytecode};
+        stbds_arrpush(*functions, function);
+    }
+
+    FunctionIndex loop = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, micro_i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 0.0));
+        encode_1(&instructions, COPY_IM_64, micro_a);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 2.5));
+        encode_1(&instructions, COPY_IM_64, micro_b);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.5));
+        encode_1(&instructions, COPY_IM_64, micro_fa);
+        encode_im64(&instructions, BITCAST(float, uint32_t, 2.5f));
+        encode_1(&instructions, COPY_IM_64, micro_fb);
+        encode_im64(&instructions, BITCAST(float, uint32_t, 1.5f));
+        encode_1(&instructions, COPY_IM_64, micro_ia);
+        encode_im64(&instructions, 5);
+        encode_1(&instructions, COPY_IM_64, micro_ib);
+        encode_im64(&instructions, 3);
+        encode_1(&instructions, COPY_IM_64, micro_index);
+        encode_im64(&instructions, 0);
+        encode_1(&instructions, COPY_IM_64, micro_cmp);
+        encode_im64(&instructions, 0);
+        encode_1(&instructions, COPY_IM_64, micro_truth);
+        encode_im64(&instructions, 1);
+        encode_1(&instructions, COPY_IM_64, micro_limit);
+        encode_im64(&instructions, MICRO_ITERATIONS);
+
+        encode_1(&instructions, BLOCK, 1);
+
+        encode_1(&instructions, RET_V, micro_i);
+
+    stbds_arrpush(blocks, entry_block);
+
+    InstructionPointer loop_block;
+
+    // the LOOP_ instructions count from zero like micro_i does, after the body has run, so they stop after the same
+    // MICRO_ITERATIONS trips as the baseline that tests first
+    if (micro != NULL && micro_back_edge(micro->ops[0])) {
+        switch (micro->ops[0]) {
+            case LOOP_F64:
+                loop_block = encode_3(&instructions, LOOP_F64, micro_i, micro_count, 0);
+                break;
+
+            case LOOP_IM_F64:
+                loop_block = encode_2(&instructions, LOOP_IM_F64, micro_i, 0);
+                encode_im64(&instructions, BITCAST(double, uint64_t, (double) MICRO_ITERATIONS));
+                break;
+
+            case LOOP_I64:
+                loop_block = encode_3(&instructions, LOOP_I64, micro_i, micro_limit, 0);
+                break;
+
+            default:
+                loop_block = encode_2(&instructions, LOOP_IM_I64, micro_i, 0);
+                encode_im64(&instructions, MICRO_ITERATIONS);
+        }
+
+        encode_1(&instructions, BR, 0);
+    } else {
+        loop_block =
+        encode_3(&instructions, F_EQ_64, micro_i, micro_count, micro_cond);
+        encode_2(&instructions, BR_NZ, 0, micro_cond);
+
+        if (micro != NULL) {
+            for (int k = 0; k < MICRO_UNROLL; k++) micro_emit_case(&instructions, micro, ret, tail);
+        }
+
+        encode_2(&instructions, F_ADD_IM_64, micro_i, micro_i);
+        encode_im64(&instructions, BITCAST(double, uint64_t, 1.0));
+        encode_1(&instructions, RE, 0);
+    }
+
+    stbds_arrpush(blocks, loop_block);
+
+    InstructionPointer br_block =
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, br_block);
+
+    InstructionPointer br_nz_block =
+        encode_2(&instructions, BR_NZ, 0, micro_truth);
+        encode_0(&instructions, UNREACHABLE);
+
+    stbds_arrpush(blocks, br_nz_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {1, MICRO_REGISTERS, bytecode};
+    stbds_arrpush(*functions, function);
+
+    return loop;
+}
+
+// minimum over the repetitions, in nanoseconds and timestamp counter ticks, for MICRO_ITERATIONS trips around the loop
+bool micro_measure (MicroCase const* micro, size_t warmup, size_t repetitions, double* ns, double* cycles) {
+    stbds_arr(Function) functions = NULL;
+    FunctionIndex entry = encode_micro(&functions, micro);
+
+    uint64_t scratch [1] = { BITCAST(double, uint64_t, 1.0) };
+    uint8_t* globals [1] = { (uint8_t*) scratch };
+
+    Program program = {
+        .functions = functions,
+        .globals = globals,
+        .num_globals = 1,
+        .num_functions = (FunctionIndex) stbds_arrlenu(functions),
+    };
+
+    Fiber fiber = fiber_create(&program);
+
+    uint64_t args [1] = { BITCAST(double, uint64_t, (double) MICRO_ITERATIONS) };
+    bool ok = true;
+
+    *ns = INFINITY;
+    *cycles = INFINITY;
+
+    for (size_t i = 0; i < warmup + repetitions; i++) {
+        uint64_t ret_val = 0;
+
+        uint64_t start_ns = bench_now_ns();
+        uint64_t start_cycles = profile_timestamp();
+        Trap trap = invoke(&fiber, entry, &ret_val, args);
+        uint64_t end_cycles = profile_timestamp();
+        uint64_t end_ns = bench_now_ns();
+
+        if (trap != OKAY) {
+            fprintf(stderr, "%s: trap %s\n", micro != NULL ? micro->name : "baseline", trap_name(trap));
+            ok = false;
+            break;
+        }
+
+        if (i < warmup) continue;
+        if ((double) (end_ns - start_ns) < *ns) *ns = (double) (end_ns - start_ns);
+        if ((double) (end_cycles - start_cycles) < *cycles) *cycles = (double) (end_cycles - start_cycles);
+    }
+
+    fiber_destroy(&fiber);
+
+    for (size_t i = 0; i < stbds_arrlenu(functions); i++) {
+        stbds_arrfree(functions[i].bytecode.blocks);
+        stbds_arrfree(functions[i].bytecode.instructions);
+        stbds_arrfree(functions[i].bytecode.constants);
+    }
+    stbds_arrfree(functions);
+
+    return ok;
+}
+
+void micro_write_json (FILE* out, double baseline_ns, double baseline_cycles, MicroResult const* results, size_t num_results) {
+    fprintf(out, "{\n  \"compiler\": \"%s\",\n  \"iterations\": %d,\n  \"unroll\": %d,\n", __VERSION__, MICRO_ITERATIONS, MICRO_UNROLL);
+    fprintf(out, "  \"baseline\": {\"ns_per_iteration\": %.4f, \"cycles_per_iteration\": %.4f},\n  \"results\": [",
+        baseline_ns / MICRO_ITERATIONS, baseline_cycles / MICRO_ITERATIONS);
+
+    for (size_t i = 0; i < num_results; i++) {
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"ns_per_instruction\": %.4f, \"cycles_per_instruction\": %.4f}",
+            i == 0 ? "" : ",", results[i].name, results[i].ns_per_instruction, results[i].cycles_per_instruction);
+    }
+
+    fprintf(out, "\n  ]\n}\n");
+}
+
+int micro_main (size_t warmup, size_t repetitions, char const* filter, char const* json_path) {
+    MicroCase cases [RET_V + 1 + NUM_MICRO_COMPOSITE_CASES];
+    size_t num_cases = 0;
+
+    for (int op = 0; op <= RET_V; op++) {
+        if (!micro_standalone((OpCode) op) && !micro_back_edge((OpCode) op)) continue;
+        cases[num_cases++] = (MicroCase) { opcode_name((OpCode) op), { (OpCode) op }, 1 };
+    }
+    for (size_t i = 0; i < NUM_MICRO_COMPOSITE_CASES; i++) cases[num_cases++] = micro_composite_cases[i];
+
+    double baseline_ns, baseline_cycles;
+    if (!micro_measure(NULL, warmup, repetitions, &baseline_ns, &baseline_cycles)) return 2;
+
+    printf("compiler %s, %d iterations of a body unrolled %d times, best of %lu runs\n", __VERSION__, MICRO_ITERATIONS, MICRO_UNROLL, repetitions);
+    printf("%-28s %12s %12s\n", "case", "ns/instr", "cycles/instr");
+    printf("%-28s %12.3f %12.3f   (per iteration: F_EQ_64+BR_NZ+F_ADD_IM_64+RE)\n",
+        "baseline loop", baseline_ns / MICRO_ITERATIONS, baseline_cycles / MICRO_ITERATIONS);
+
+    MicroResult results [RET_V + 1 + NUM_MICRO_COMPOSITE_CASES];
+    size_t num_results = 0;
+    bool failed = false;
+
+    for (size_t c = 0; c < num_cases; c++) {
+        MicroCase const* micro = cases + c;
+        if (filter != NULL && strstr(micro->name, filter) == NULL) continue;
+
+        double ns, cycles;
+        if (!micro_measure(micro, warmup, repetitions, &ns, &cycles)) {
+            failed = true;
+            continue;
+        }
+
+        MicroResult* r = results + num_results++;
+        r->name = micro->name;
+
+        if (micro_back_edge(micro->ops[0])) {
+            r->ns_per_instruction = ns / MICRO_ITERATIONS;
+            r->cycles_per_instruction = cycles / MICRO_ITERATIONS;
+
+            printf("%-28s %12.3f %12.3f   (per iteration, against the baseline loop)\n", r->name, r->ns_per_instruction, r->cycles_per_instruction);
+            continue;
+        }
+
+        double executed = (double) MICRO_ITERATIONS * MICRO_UNROLL * micro->num_ops;
+        r->ns_per_instruction = (ns - baseline_ns) / executed;
+        r->cycles_per_instruction = (cycles - baseline_cycles) / executed;
+
+        printf("%-28s %12.3f %12.3f\n", r->name, r->ns_per_instruction, r->cycles_per_instruction);
+    }
+
+    printf("HALT, UNREACHABLE and LAZY_LINK are not measured\n");
+
+    if (json_path != NULL) {
+        FILE* out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (out == NULL) {
+            printf("Cannot open %s\n", json_path);
+            return 5;
+        }
+
+        micro_write_json(out, baseline_ns, baseline_cycles, results, num_results);
+        if (out != stdout) fclose(out);
+    }
+
+    return failed ? 2 : 0;
+}
+
+void bench_usage(char const* program) {
+    printf(
+        "usage: %s [options]\n"
+        "  --warmup N        untimed runs per workload (default %d)\n"
+        "  --reps N          timed runs per workload (default %d)\n"
+        "  --filter NAME     only run workloads whose name contains NAME\n"
+        "  --json PATH       write results as JSON, '-' for stdout\n"
+        "  --baseline PATH   compare against a JSON file written by --json\n"
+        "  --threshold PCT   regression threshold in percent (default %.0f)\n"
+        "  --no-counters     do not open hardware performance counters\n"
+        "  --optimize        run the bytecode optimizer over each workload before timing it\n"
+        "  --ir              lift each workload to IR and lower it back before timing it\n"
+        "  --micro           per opcode dispatch microbenchmarks instead of the workloads\n"
+        "  --list            list workloads and exit\n",
+        program, BENCH_DEFAULT_WARMUP, BENCH_DEFAULT_REPETITIONS, BENCH_DEFAULT_THRESHOLD * 100.0);
+}
+
+int main (int argc, char** argv) {
+    size_t warmup = BENCH_DEFAULT_WARMUP;
+    size_t repetitions = BENCH_DEFAULT_REPETITIONS;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    char const* filter = NULL;
+    char const* json_path = NULL;
+    char const* baseline_path = NULL;
+    bool use_counters = true;
+    bool micro = false;
+    bool use_optimizer = false;
+    bool use_ir = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+
+        if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            warmup = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--reps") == 0 && has_value) {
+            repetitions = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--filter") == 0 && has_value) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--json") == 0 && has_value) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && has_value) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && has_value) {
+            threshold = strtod(argv[++i], NULL) / 100.0;
+        } else if (strcmp(argv[i], "--no-counters") == 0) {
+            use_counters = false;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            use_optimizer = true;
+        } else if (strcmp(argv[i], "--ir") == 0) {
+            use_ir = true;
+        } else if (strcmp(argv[i], "--micro") == 0) {
+            micro = true;
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (size_t w = 0; w < NUM_WORKLOADS; w++) printf("%s\n", workloads[w].name);
+            return 0;
+        } else {
+            bench_usage(argv[0]);
+            return 4;
+        }
+    }
+
+    if (repetitions == 0) repetitions = 1;
+
+    if (micro) return micro_main(warmup, repetitions, filter, json_path);
+
+    Counters counters;
+    if (use_counters) {
+        counters = counters_open();
+        if (!counters_any(&counters)) {
+            printf("hardware performance counters unavailable (check perf_event_paranoid), continuing without them\n");
+        }
+    } else {
+        for (int i = 0; i < NUM_COUNTERS; i++) counters.fds[i] = -1;
+    }
+
+    BenchResult results [NUM_WORKLOADS];
+    size_t num_results = 0;
+    bool failed = false;
+
+    printf("%-16s %6s %12s %12s %12s %12s %22s %10s\n",
+        "workload", "reps", "median ms", "p99 ms", "mean ms", "stddev ms", "95% ci ms", "rss kb");
+
+    for (size_t w = 0; w < NUM_WORKLOADS; w++) {
+        Workload const* workload = workloads + w;
+        if (filter != NULL && strstr(workload->name, filter) == NULL) continue;
+
+        BenchResult* r = results + num_results;
+        if (!bench_run(workload, warmup, repetitions, use_optimizer, use_ir, &counters, r)) {
+            failed = true;
+            continue;
+        }
+
+        num_results++;
+
+        printf("%-16s %6lu %12.3f %12.3f %12.3f %12.3f %10.3f..%-10.3f %10ld\n",
+            r->name, r->repetitions,
+            r->median_ns / 1e6, r->p99_ns / 1e6, r->mean_ns / 1e6, r->stddev_ns / 1e6,
+            r->ci_low_ns / 1e6, r->ci_high_ns / 1e6, r->peak_rss_kb);
+    }
+
+    if (counters_any(&counters)) bench_print_counters(results, num_results);
+    counters_close(&counters);
+
+    if (json_path != NULL) {
+        FILE* out = strcmp(json_path, "-") == 0 ? stdout : fopen(json_path, "w");
+        if (out == NULL) {
+            printf("Cannot open %s\n", json_path);
+            return 5;
+        }
+
+        bench_write_json(out, results, num_results);
+        if (out != stdout) fclose(out);
+    }
+
+    if (baseline_path != NULL) {
+        char* baseline = bench_read_file(baseline_path);
+        if (baseline == NULL) {
+            printf("Cannot read %s\n", baseline_path);
+            return 5;
+        }
+
+        size_t regressions = bench_compare(baseline, results, num_results, threshold);
+        free(baseline);
+
+        if (regressions > 0) {
+            printf("%lu regression(s) against %s\n", regressions, baseline_path);
+            return 1;
+        }
+    }
+
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,21 @@
+function branches(count)
+    local x = 0.3
+    local acc = 0.0
+    local i = 0.0
+    while i ~= count do
+        x = 3.99 * (x * (1.0 - x))
+        if x < 0.5 then
+            acc = acc + x
+        else
+            acc = acc - 0.25
+        end
+        i = i + 1.0
+    end
+    return acc
+end
+
+local start = os.clock()
+local result = branches(1000000.0)
+local stop = os.clock()
+
+print(string.format("%.17g", result), "(in ", stop - start, "s)")
@@ -0,0 +1,19 @@
+function increment(x)
+    return x + 1.0
+end
+
+function call_overhead(count)
+    local acc = 0.0
+    local i = 0.0
+    while i ~= count do
+        acc = increment(acc)
+        i = i + 1.0
+    end
+    return acc
+end
+
+local start = os.clock()
+local result = call_overhead(2000000.0)
+local stop = os.clock()
+
+print(result, "(in ", stop - start, "s)")
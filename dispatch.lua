@@ -0,0 +1,33 @@
+function dispatch(count)
+    local x = 0.3
+    local acc = 0.0
+    local state = 0
+    local i = 0.0
+    while i ~= count do
+        x = 3.99 * (x * (1.0 - x))
+        if state == 0 then
+            acc = acc + x
+            state = 2
+        elseif state == 1 then
+            acc = acc - 0.25
+            state = 3
+        elseif state == 2 then
+            acc = acc + x * x
+            state = 1
+        elseif state == 3 then
+            acc = acc - x
+            state = 4
+        else
+            acc = acc + 1.0
+            state = 0
+        end
+        i = i + 1.0
+    end
+    return acc
+end
+
+local start = os.clock()
+local result = dispatch(1000000.0)
+local stop = os.clock()
+
+print(string.format("%.17g", result), "(in ", stop - start, "s)")
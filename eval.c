@@ -0,0 +1,1117 @@
+// eval.c is included once per interpreter variant; the includer defines
+// EVAL_NAME (the function to generate) and the EVAL_* feature switches.
+// EVAL_CHECKED 0 drops the stack overflow checks and is only sound for
+// programs that passed verify() on fibers invoke_verified() has sized up.
+// EVAL_SAMPLED 1 fences the fiber state at every dispatch for the SIGPROF
+// sampler, which is only ever running under an evaluator built with it.
+
+Trap EVAL_NAME(Fiber *restrict fiber) {
+    debug("eval");
+
+    CallFrame* current_call_frame;
+    Function const* current_function;
+    BlockFrame* current_block_frame;
+    Instruction const* current_instructions;
+
+    uint64_t register_scratch_space [MAX_REGISTERS];
+
+    #define SET_CONTEXT() {                              \
+        debug("SET_CONTEXT");                      \
+        current_call_frame = fiber->call_frame;          \
+        current_function = current_call_frame->function; \
+        current_block_frame = fiber->block_stack;        \
+        current_instructions =                           \
+            current_function->bytecode.instructions;     \
+    }                                                    \
+
+    // entering or leaving a block keeps the call frame, so only the block frame needs reloading
+    #define SET_BLOCK_CONTEXT() {                        \
+        current_block_frame = fiber->block_stack;        \
+    }                                                    \
+
+    SET_CONTEXT();
+
+    #define REGISTERS() FRAME_REGISTERS(current_call_frame)
+
+    Instruction last_instruction;
+
+    #define DECODE_NEXT()                                                               \
+        last_instruction = current_instructions[current_block_frame->instruction_pointer++] \
+    
+    #define DECODE_A()  I_DECODE_A(last_instruction)
+    #define DECODE_B()  I_DECODE_B(last_instruction)
+    #define DECODE_C()  I_DECODE_C(last_instruction)
+    #define DECODE_W0() I_DECODE_W0(last_instruction)
+    #define DECODE_W1() I_DECODE_W1(last_instruction)
+    #define DECODE_W2() I_DECODE_W2(last_instruction)
+    #define DECODE_W2_W0() I_DECODE_W2_W0(last_instruction)
+    #define DECODE_IM32(T) I_IMMEDIATE_32(T, last_instruction, current_function->bytecode.constants, 0)
+    #define DECODE_IM64(T) I_IMMEDIATE_64(T, last_instruction, current_function->bytecode.constants, current_instructions[current_block_frame->instruction_pointer++])
+
+    static void* DISPATCH_TABLE [] = {
+        &&DO_HALT,
+        &&DO_UNREACHABLE,
+        &&DO_LAZY_LINK,
+        &&DO_READ_GLOBAL_32,
+        &&DO_READ_GLOBAL_64,
+        &&DO_LOAD_GLOBAL_64,
+        &&DO_STORE_GLOBAL_64,
+        &&DO_COPY_IM_64,
+        &&DO_COPY_64,
+        &&DO_IF_NZ,
+        &&DO_WHEN_NZ,
+        &&DO_SWITCH,
+        &&DO_BLOCK,
+        &&DO_BR,
+        &&DO_BR_NZ,
+        &&DO_RE,
+        &&DO_RE_NZ,
+        &&DO_LOOP_F64,
+        &&DO_LOOP_IM_F64,
+        &&DO_LOOP_I64,
+        &&DO_LOOP_IM_I64,
+        &&DO_F_ADD_32,
+        &&DO_F_ADD_IM_32,
+        &&DO_F_SUB_32,
+        &&DO_F_SUB_IM_A_32,
+        &&DO_F_SUB_IM_B_32,
+        &&DO_F_ADD_64,
+        &&DO_F_ADD_IM_64,
+        &&DO_F_SUB_64,
+        &&DO_F_SUB_IM_A_64,
+        &&DO_F_SUB_IM_B_64,
+        &&DO_F_MUL_64,
+        &&DO_F_DIV_64,
+        &&DO_F_SQRT_64,
+        &&DO_I_ADD_64,
+        &&DO_I_SUB_64,
+        &&DO_F_EQ_32,
+        &&DO_F_EQ_IM_32,
+        &&DO_F_LT_32,
+        &&DO_F_LT_IM_A_32,
+        &&DO_F_LT_IM_B_32,
+        &&DO_F_EQ_64,
+        &&DO_F_EQ_IM_64,
+        &&DO_F_LT_64,
+        &&DO_F_LT_IM_A_64,
+        &&DO_F_LT_IM_B_64,
+        &&DO_S_EQ_64,
+        &&DO_S_EQ_IM_64,
+        &&DO_S_LT_64,
+        &&DO_SELECT_64,
+        &&DO_SELECT_F_LT_64,
+        &&DO_SELECT_S_LT_64,
+        &&DO_CALL_V,
+        &&DO_TAIL_CALL_V,
+        &&DO_RET_V,
+    };
+
+    #if EVAL_PROFILE
+        profile_reserve_functions(fiber->program->num_functions);
+
+        OpCode profile_opcode = PROFILE_IDLE;
+        uint64_t profile_start = profile_timestamp();
+
+        #define PROFILE_DISPATCH(next) {                                                      \
+            uint64_t profile_now = profile_timestamp();                                       \
+            opcode_profile.cycles[profile_opcode] += profile_now - profile_start;             \
+            opcode_profile.counts[next]++;                                                    \
+            size_t function_index = (size_t) (current_function - fiber->program->functions); \
+            if (function_index < fiber->program->num_functions) {                             \
+                opcode_profile.function_instructions[function_index]++;                       \
+            }                                                                                 \
+            profile_opcode = next;                                                            \
+            profile_start = profile_now;                                                      \
+        }                                                                                     \
+
+        #define PROFILE_EXIT() \
+            opcode_profile.cycles[profile_opcode] += profile_timestamp() - profile_start
+
+    #else
+        #define PROFILE_DISPATCH(next)
+        #define PROFILE_EXIT()
+    #endif
+
+    #if EVAL_CALL_PROFILE
+        #define RECORD_CALL_EVENT(event_kind, event_function) {                                \
+            size_t function_index = (size_t) ((event_function) - fiber->program->functions);  \
+            if (function_index < fiber->program->num_functions) {                             \
+                if (fiber->num_call_events == fiber->call_event_capacity) {                   \
+                    call_graph_drain(fiber, false);                                           \
+                }                                                                             \
+                CallEvent* event = fiber->call_events + fiber->num_call_events++;             \
+                event->timestamp = profile_timestamp();                                       \
+                event->function = (FunctionIndex) function_index;                             \
+                event->kind = event_kind;                                                     \
+            }                                                                                 \
+        }                                                                                     \
+
+        #define CALL_PROFILE_EXIT(trap) call_graph_drain(fiber, (trap) != OKAY)
+
+        RECORD_CALL_EVENT(CALL_EVENT_ENTER, current_function);
+    #else
+        #define RECORD_CALL_EVENT(event_kind, event_function)
+        #define CALL_PROFILE_EXIT(trap)
+    #endif
+
+    #define EXIT(trap) {             \
+        PROFILE_EXIT();              \
+        CALL_PROFILE_EXIT(trap);     \
+        return trap;                 \
+    }                                \
+
+    #if EVAL_SAMPLED
+        #define SAMPLE_FENCE() atomic_signal_fence(memory_order_seq_cst)
+    #else
+        #define SAMPLE_FENCE()
+    #endif
+
+    #define DISPATCH() {                                 \
+        DECODE_NEXT();                                   \
+        OpCode next = I_DECODE_OPCODE(last_instruction); \
+        debug("DISPATCH %d", next);                      \
+        PROFILE_DISPATCH(next);                          \
+        SAMPLE_FENCE();                                  \
+        goto *DISPATCH_TABLE[next];                      \
+    }                                                    \
+    
+    #define RETURN_VALUE(value) {                                       \
+        uint64_t return_value = (value);                               \
+                                                                       \
+        if (fiber->memo_call_frame == current_call_frame) {            \
+            memo_pop_frame(fiber, return_value);                       \
+        }                                                              \
+                                                                       \
+        RECORD_CALL_EVENT(CALL_EVENT_EXIT, current_function);          \
+                                                                       \
+        CallFrame* caller_frame = (CallFrame*)                         \
+            (fiber->stack_base + current_call_frame->caller);          \
+                                                                       \
+        FRAME_REGISTERS(caller_frame)[current_call_frame->out_index] = \
+            return_value;                                              \
+                                                                       \
+        fiber->call_frame = caller_frame;                              \
+        fiber->block_stack = (BlockFrame*) current_call_frame - 1;     \
+                                                                       \
+        SET_CONTEXT();                                                 \
+        DISPATCH();                                                    \
+    }                                                                  \
+
+    DISPATCH();
+
+    DO_HALT: {
+        debug("HALT");
+        EXIT(OKAY);
+    };
+
+    DO_UNREACHABLE: {
+        debug("UNREACHABLE");
+        EXIT(TRAP_UNREACHABLE);
+    };
+
+    // only ever the first instruction of a stub function, so the current block frame is the call's root block
+    DO_LAZY_LINK: {
+        debug("LAZY_LINK");
+
+        FunctionIndex index = (FunctionIndex) (current_function - fiber->program->functions);
+
+        if (fiber->program->link == NULL || !fiber->program->link(fiber->program->link_context, index)) {
+            EXIT(TRAP_LINK_FAILED);
+        }
+
+        InstructionPointer start = *current_function->bytecode.blocks;
+        current_block_frame->start_pointer = start;
+        current_block_frame->instruction_pointer = start;
+        current_instructions = current_function->bytecode.instructions;
+
+        DISPATCH();
+    };
+
+    DO_READ_GLOBAL_32: {
+        debug("READ_GLOBAL_32");
+
+        GlobalIndex index = DECODE_W0();
+        RegisterIndex destination = DECODE_W1();
+
+        *(REGISTERS() + destination) =
+            *((uint32_t*) fiber->program->globals[index]);
+        
+        DISPATCH();
+    };
+
+    DO_READ_GLOBAL_64: {
+        debug("READ_GLOBAL_64");
+
+        GlobalIndex index = DECODE_W0();
+        RegisterIndex destination = DECODE_W1();
+
+        *(REGISTERS() + destination) =
+            *((uint64_t*) fiber->program->globals[index]);
+        
+        DISPATCH();
+    };
+
+    DO_LOAD_GLOBAL_64: {
+        debug("LOAD_GLOBAL_64");
+
+        GlobalIndex index = DECODE_W2_W0();
+        RegisterIndex destination = DECODE_W1();
+        RegisterIndex offset = DECODE_W2();
+
+        *(REGISTERS() + destination) =
+            ((uint64_t*) fiber->program->globals[index])[*(REGISTERS() + offset)];
+
+        DISPATCH();
+    };
+
+    DO_STORE_GLOBAL_64: {
+        debug("STORE_GLOBAL_64");
+
+        GlobalIndex index = DECODE_W2_W0();
+        RegisterIndex source = DECODE_W1();
+        RegisterIndex offset = DECODE_W2();
+
+        ((uint64_t*) fiber->program->globals[index])[*(REGISTERS() + offset)] =
+            *(REGISTERS() + source);
+
+        DISPATCH();
+    };
+
+    DO_COPY_IM_64: {
+        debug("COPY_IM_64");
+
+        uint64_t imm = DECODE_IM64(uint64_t);
+        RegisterIndex destination = DECODE_A();
+
+        *(REGISTERS() + destination) = imm;
+
+        DISPATCH();
+    };
+
+    DO_COPY_64: {
+        debug("COPY_64");
+
+        RegisterIndex source = DECODE_A();
+        RegisterIndex destination = DECODE_B();
+
+        *(REGISTERS() + destination) = *(REGISTERS() + source);
+
+        DISPATCH();
+    };
+
+    DO_IF_NZ: {
+        debug("IF_NZ");
+
+        BlockIndex then_index = DECODE_A();
+        BlockIndex else_index = DECODE_B();
+        RegisterIndex condition = DECODE_C();
+
+        BlockIndex new_block_index;
+        if (*((uint8_t*) (REGISTERS() + condition)) != 0) {
+            new_block_index = then_index;
+        } else {
+            new_block_index = else_index;
+        }
+
+        InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
+
+        #if EVAL_CHECKED
+            if (fiber->block_stack + 1 >= (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+        #endif
+
+        BlockFrame new_block_frame = {new_block, new_block};
+        *(++fiber->block_stack) = new_block_frame;
+
+        SET_BLOCK_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_WHEN_NZ: {
+        debug("WHEN_NZ");
+
+        BlockIndex new_block_index = DECODE_A();
+        RegisterIndex condition = DECODE_B();
+
+        if (*((uint8_t*) (REGISTERS() + condition)) != 0) {
+            InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
+
+            #if EVAL_CHECKED
+                if (fiber->block_stack + 1 >= (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+            #endif
+
+            BlockFrame new_block_frame = {new_block, new_block};
+            *(++fiber->block_stack) = new_block_frame;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    DO_SWITCH: {
+        debug("SWITCH");
+
+        RegisterIndex index = DECODE_A();
+        uint8_t num_cases = DECODE_B();
+
+        // one unsigned compare sends negative indices to the default along with the ones past the end
+        BlockIndex const* table = (BlockIndex const*) (current_instructions + current_block_frame->instruction_pointer);
+        current_block_frame->instruction_pointer += CALC_SWITCH_SIZE(num_cases);
+
+        uint64_t value = *(REGISTERS() + index);
+        BlockIndex new_block_index = table[value < num_cases ? value + 1 : 0];
+
+        InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
+
+        #if EVAL_CHECKED
+            if (fiber->block_stack + 1 >= (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+        #endif
+
+        BlockFrame new_block_frame = {new_block, new_block};
+        *(++fiber->block_stack) = new_block_frame;
+
+        SET_BLOCK_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_BLOCK: {
+        debug("BLOCK");
+
+        BlockIndex new_block_index = DECODE_A();
+        InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
+
+        #if EVAL_CHECKED
+            if (fiber->block_stack + 1 >= (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+        #endif
+
+        BlockFrame new_block_frame = {new_block, new_block};
+        *(++fiber->block_stack) = new_block_frame;
+
+        SET_BLOCK_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_BR: {
+        debug("BR");
+
+        BlockIndex relative_block_index = DECODE_A();
+
+        fiber->block_stack -= relative_block_index + 1;
+
+        SET_BLOCK_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_BR_NZ: {
+        debug("BR_NZ");
+
+        BlockIndex relative_block_index = DECODE_A();
+        RegisterIndex condition = DECODE_B();
+
+        if (*((uint8_t*) (REGISTERS() + condition)) != 0) {
+            fiber->block_stack -= relative_block_index + 1;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    DO_RE: {
+        debug("RE");
+
+        BlockIndex relative_block_index = DECODE_A();
+
+        fiber->block_stack -= relative_block_index;
+        fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+        SET_BLOCK_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_RE_NZ: {
+        debug("RE_NZ");
+
+        BlockIndex relative_block_index = DECODE_A();
+        RegisterIndex condition = DECODE_B();
+
+        if (*((uint8_t*) (REGISTERS() + condition)) != 0) {
+            fiber->block_stack -= relative_block_index;
+            fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    // the back edge of a counted loop: counter += 1.0, and the block restarts until it reaches limit
+    DO_LOOP_F64: {
+        debug("LOOP_F64");
+
+        RegisterIndex counter = DECODE_A();
+        RegisterIndex limit = DECODE_B();
+        BlockIndex relative_block_index = DECODE_C();
+
+        double next = 1.0 + *((double*) (REGISTERS() + counter));
+        *((double*) (REGISTERS() + counter)) = next;
+
+        if (next != *((double*) (REGISTERS() + limit))) {
+            fiber->block_stack -= relative_block_index;
+            fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    // LOOP_IM_F64 and LOOP_IM_I64 take the limit as an immediate, and the I64 forms count in integers
+    DO_LOOP_IM_F64: {
+        debug("LOOP_IM_F64");
+
+        RegisterIndex counter = DECODE_A();
+        BlockIndex relative_block_index = DECODE_B();
+        double limit = DECODE_IM64(double);
+
+        double next = 1.0 + *((double*) (REGISTERS() + counter));
+        *((double*) (REGISTERS() + counter)) = next;
+
+        if (next != limit) {
+            fiber->block_stack -= relative_block_index;
+            fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    DO_LOOP_I64: {
+        debug("LOOP_I64");
+
+        RegisterIndex counter = DECODE_A();
+        RegisterIndex limit = DECODE_B();
+        BlockIndex relative_block_index = DECODE_C();
+
+        uint64_t next = 1 + *(REGISTERS() + counter);
+        *(REGISTERS() + counter) = next;
+
+        if (next != *(REGISTERS() + limit)) {
+            fiber->block_stack -= relative_block_index;
+            fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    DO_LOOP_IM_I64: {
+        debug("LOOP_IM_I64");
+
+        RegisterIndex counter = DECODE_A();
+        BlockIndex relative_block_index = DECODE_B();
+        uint64_t limit = DECODE_IM64(uint64_t);
+
+        uint64_t next = 1 + *(REGISTERS() + counter);
+        *(REGISTERS() + counter) = next;
+
+        if (next != limit) {
+            fiber->block_stack -= relative_block_index;
+            fiber->block_stack->instruction_pointer = fiber->block_stack->start_pointer;
+
+            SET_BLOCK_CONTEXT();
+        }
+
+        DISPATCH();
+    };
+
+    DO_F_ADD_32: {
+        debug("F_ADD_32");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((float*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) +
+            *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_ADD_IM_32: {
+        debug("F_ADD_IM_32");
+
+        float x = DECODE_IM32(float);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((float*) (REGISTERS() + z)) =
+            x + *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_SUB_32: {
+        debug("F_SUB_32");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((float*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) -
+            *((float*) (REGISTERS() + y));
+        
+        DISPATCH();
+    };
+
+    DO_F_SUB_IM_A_32: {
+        debug("F_SUB_IM_A_32");
+
+        float x = DECODE_IM32(float);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((float*) (REGISTERS() + z)) =
+            x - *((float*) (REGISTERS() + y));
+        
+        DISPATCH();
+    };
+
+    DO_F_SUB_IM_B_32: {
+        debug("F_SUB_IM_B_32");
+
+        RegisterIndex x = DECODE_A();
+        float y = DECODE_IM32(float);
+        RegisterIndex z = DECODE_B();
+
+        *((float*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) - y;
+        
+        DISPATCH();
+    };
+
+    DO_F_ADD_64: {
+        debug("F_ADD_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+        
+        *((double*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) +
+            *((double*) (REGISTERS() + y));
+            
+        DISPATCH();
+    };
+
+    DO_F_ADD_IM_64: {
+        debug("F_ADD_IM_64");
+
+        double x = DECODE_IM64(double);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((double*) (REGISTERS() + z)) =
+            x + *((double*) (REGISTERS() + y));
+        
+        DISPATCH();
+    };
+
+    DO_F_SUB_64: {
+        debug("F_SUB_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((double*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) -
+            *((double*) (REGISTERS() + y));
+        
+        DISPATCH();
+    };
+
+    DO_F_SUB_IM_A_64: {
+        debug("F_SUB_IM_A_64");
+
+        double x = DECODE_IM64(double);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((double*) (REGISTERS() + z)) =
+            x - *((double*) (REGISTERS() + y));
+        
+        DISPATCH();
+    };
+
+    DO_F_SUB_IM_B_64: {
+        debug("F_SUB_IM_B_64");
+
+        RegisterIndex x = DECODE_A();
+        double y = DECODE_IM64(double);
+        RegisterIndex z = DECODE_B();
+
+        *((double*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) - y;
+
+        DISPATCH();
+    };
+
+    DO_F_MUL_64: {
+        debug("F_MUL_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((double*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) *
+            *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_DIV_64: {
+        debug("F_DIV_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((double*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) /
+            *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_SQRT_64: {
+        debug("F_SQRT_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+
+        *((double*) (REGISTERS() + y)) =
+            sqrt(*((double*) (REGISTERS() + x)));
+
+        DISPATCH();
+    };
+
+    DO_I_ADD_64: {
+        debug("I_ADD_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *(REGISTERS() + z) =
+            *(REGISTERS() + x) +
+            *(REGISTERS() + y);
+
+        DISPATCH();
+    };
+
+    DO_I_SUB_64: {
+        debug("I_SUB_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *(REGISTERS() + z) =
+            *(REGISTERS() + x) -
+            *(REGISTERS() + y);
+        
+        DISPATCH();
+    };
+
+    DO_F_EQ_32: {
+        debug("F_EQ_32");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) ==
+            *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_EQ_IM_32: {
+        debug("F_EQ_IM_32");
+
+        float x = DECODE_IM32(float);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            x == *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_32: {
+        debug("F_LT_32");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) <
+            *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_IM_A_32: {
+        debug("F_LT_IM_A_32");
+
+        float x = DECODE_IM32(float);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            x < *((float*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_IM_B_32: {
+        debug("F_LT_IM_B_32");
+
+        RegisterIndex x = DECODE_A();
+        float y = DECODE_IM32(float);
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((float*) (REGISTERS() + x)) < y;
+
+        DISPATCH();
+    };
+
+    DO_F_EQ_64: {
+        debug("F_EQ_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) ==
+            *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_EQ_IM_64: {
+        debug("F_EQ_IM_64");
+
+        double x = DECODE_IM64(double);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            x == *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_64: {
+        debug("F_LT_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) <
+            *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_IM_A_64: {
+        debug("F_LT_IM_A_64");
+
+        double x = DECODE_IM64(double);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            x < *((double*) (REGISTERS() + y));
+
+        DISPATCH();
+    };
+
+    DO_F_LT_IM_B_64: {
+        debug("F_LT_IM_B_64");
+
+        RegisterIndex x = DECODE_A();
+        double y = DECODE_IM64(double);
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *((double*) (REGISTERS() + x)) < y;
+
+        DISPATCH();
+    };
+
+    DO_S_EQ_64: {
+        debug("S_EQ_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *(REGISTERS() + x) ==
+            *(REGISTERS() + y);
+
+        DISPATCH();
+    };
+
+    DO_S_EQ_IM_64: {
+        debug("S_EQ_IM_64");
+
+        uint64_t x = DECODE_IM64(uint64_t);
+        RegisterIndex y = DECODE_A();
+        RegisterIndex z = DECODE_B();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            x == *(REGISTERS() + y);
+
+        DISPATCH();
+    };
+
+    DO_S_LT_64: {
+        debug("S_LT_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        *((uint8_t*) (REGISTERS() + z)) =
+            *(REGISTERS() + x) <
+            *(REGISTERS() + y);
+
+        DISPATCH();
+    };
+
+    // both values are read before either is chosen, so the choice compiles to a conditional move instead of a branch
+    // the predictor can get wrong. the destination keeps its value when the condition is zero
+    DO_SELECT_64: {
+        debug("SELECT_64");
+
+        RegisterIndex condition = DECODE_A();
+        RegisterIndex x = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        uint64_t taken = *(REGISTERS() + x);
+        uint64_t kept = *(REGISTERS() + z);
+
+        *(REGISTERS() + z) =
+            *((uint8_t*) (REGISTERS() + condition)) != 0 ? taken : kept;
+
+        DISPATCH();
+    };
+
+    DO_SELECT_F_LT_64: {
+        debug("SELECT_F_LT_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        uint64_t a = *(REGISTERS() + x);
+        uint64_t b = *(REGISTERS() + y);
+
+        *(REGISTERS() + z) =
+            *((double*) (REGISTERS() + x)) <
+            *((double*) (REGISTERS() + y)) ? a : b;
+
+        DISPATCH();
+    };
+
+    DO_SELECT_S_LT_64: {
+        debug("SELECT_S_LT_64");
+
+        RegisterIndex x = DECODE_A();
+        RegisterIndex y = DECODE_B();
+        RegisterIndex z = DECODE_C();
+
+        uint64_t a = *(REGISTERS() + x);
+        uint64_t b = *(REGISTERS() + y);
+
+        *(REGISTERS() + z) = a < b ? a : b;
+
+        DISPATCH();
+    };
+
+    DO_CALL_V: {
+        debug("CALL_V");
+
+        FunctionIndex functionIndex = DECODE_W0();
+        RegisterIndex out = DECODE_W1();
+
+        Function const* new_function = fiber->program->functions + functionIndex;
+
+        debug("\t%d %d %d", functionIndex, out, new_function->num_args);
+
+        RegisterIndex const* args = (RegisterIndex const*) (current_instructions + current_block_frame->instruction_pointer);
+        current_block_frame->instruction_pointer += CALC_ARG_SIZE(new_function->num_args);
+
+        uint64_t memo_hash_value = 0;
+
+        if (new_function->memo != NULL) {
+            for (RegisterIndex i = 0; i < new_function->num_args; i++) {
+                register_scratch_space[i] =
+                    *(REGISTERS() + args[i]);
+            }
+
+            memo_hash_value = memo_hash(register_scratch_space, new_function->num_args);
+
+            if (memo_lookup(new_function->memo, memo_hash_value, register_scratch_space, new_function->num_args, REGISTERS() + out)) {
+                DISPATCH();
+            }
+        }
+
+        CallFrame* new_call_frame = (CallFrame*) (fiber->block_stack + 1);
+        uint64_t* new_stack_base = FRAME_REGISTERS(new_call_frame);
+        BlockFrame* new_block_frame = (BlockFrame*) (new_stack_base + FRAME_SLOTS(new_function));
+
+        #if EVAL_CHECKED
+            if (new_block_frame + 1 > (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+        #endif
+
+        for (RegisterIndex i = 0; i < new_function->num_args; i++) {
+            *(new_stack_base + i) =
+                *(REGISTERS() + args[i]);
+        }
+
+        for (uint32_t i = 0; i < new_function->bytecode.num_register_constants; i++) {
+            *(new_stack_base + new_function->num_registers + i) =
+                new_function->bytecode.constants[i];
+        }
+
+        InstructionPointer start = *new_function->bytecode.blocks;
+
+        *new_call_frame = (CallFrame) {new_function, (StackPtr) ((uint64_t*) current_call_frame - fiber->stack_base), out};
+        *new_block_frame = (BlockFrame) {start, start};
+
+        fiber->call_frame = new_call_frame;
+        fiber->block_stack = new_block_frame;
+
+        RECORD_CALL_EVENT(CALL_EVENT_ENTER, new_function);
+
+        if (new_function->memo != NULL) {
+            memo_push_frame(fiber, new_call_frame, new_function->memo, memo_hash_value, new_stack_base, new_function->num_args);
+        }
+
+        SET_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_TAIL_CALL_V: {
+        debug("TAIL_CALL_V");
+
+        FunctionIndex functionIndex = DECODE_W0();
+
+        Function const* new_function = fiber->program->functions + functionIndex;
+
+        debug("\t%d %d %d", functionIndex, current_call_frame->out_index, new_function->num_args);
+
+        BlockFrame* new_block_frame = (BlockFrame*) (REGISTERS() + FRAME_SLOTS(new_function));
+
+        #if EVAL_CHECKED
+            if (new_block_frame + 1 > (BlockFrame*) fiber->stack_max) { EXIT(TRAP_STACK_OVERFLOW); }
+        #endif
+
+        RegisterIndex const* args = (RegisterIndex const*) (current_instructions + current_block_frame->instruction_pointer);
+        current_block_frame->instruction_pointer += CALC_ARG_SIZE(new_function->num_args);
+
+        for (RegisterIndex i = 0; i < new_function->num_args; i++) {
+            register_scratch_space[i] =
+                *(REGISTERS() + args[i]);
+        }
+
+        if (new_function->memo != NULL) {
+            uint64_t memo_hash_value = memo_hash(register_scratch_space, new_function->num_args);
+            uint64_t memo_result;
+
+            if (memo_lookup(new_function->memo, memo_hash_value, register_scratch_space, new_function->num_args, &memo_result)) {
+                RETURN_VALUE(memo_result);
+            }
+
+            // a frame that is already memoized keeps its original key, the tail callee's result is the same value
+            if (fiber->memo_call_frame != current_call_frame) {
+                memo_push_frame(fiber, current_call_frame, new_function->memo, memo_hash_value, register_scratch_space, new_function->num_args);
+            }
+        }
+
+        uint64_t* new_stack_base = REGISTERS();
+
+        for (RegisterIndex i = 0; i < new_function->num_registers; i++) {
+            *(new_stack_base + i) = register_scratch_space[i];
+        }
+
+        for (uint32_t i = 0; i < new_function->bytecode.num_register_constants; i++) {
+            *(new_stack_base + new_function->num_registers + i) =
+                new_function->bytecode.constants[i];
+        }
+
+        InstructionPointer start = *new_function->bytecode.blocks;
+
+        *new_block_frame = (BlockFrame) {start, start};
+        fiber->block_stack = new_block_frame;
+
+        current_call_frame->function = new_function;
+
+        RECORD_CALL_EVENT(CALL_EVENT_TAIL, new_function);
+
+        SET_CONTEXT();
+        DISPATCH();
+    };
+
+    DO_RET_V: {
+        debug("RET_V");
+
+        RegisterIndex y = DECODE_A();
+
+        RETURN_VALUE(*(REGISTERS() + y));
+    };
+}
+
+#undef SET_CONTEXT
+#undef SET_BLOCK_CONTEXT
+#undef REGISTERS
+#undef DECODE_NEXT
+#undef DECODE_A
+#undef DECODE_B
+#undef DECODE_C
+#undef DECODE_W0
+#undef DECODE_W1
+#undef DECODE_W2
+#undef DECODE_W2_W0
+#undef DECODE_IM32
+#undef DECODE_IM64
+#undef PROFILE_DISPATCH
+#undef PROFILE_EXIT
+#undef RECORD_CALL_EVENT
+#undef CALL_PROFILE_EXIT
+#undef EXIT
+#undef SAMPLE_FENCE
+#undef DISPATCH
+#undef RETURN_VALUE
+
+#undef EVAL_NAME
+#undef EVAL_PROFILE
+#undef EVAL_CALL_PROFILE
+#undef EVAL_CHECKED
+#undef EVAL_SAMPLED
@@ -0,0 +1,1672 @@
+// ir.c is a mid-level form between frontends and bytecode in which every value is defined once (SSA). Control flow
+// keeps the shape bytecode has: blocks nest, and BR and RE name their target by depth. But no value is left in a
+// register for later. The instruction entering a block passes arguments to the block's parameters, RE passes new
+// ones, and BR passes the results of the instruction that entered the block it leaves. Building IR needs no register
+// numbering, and a pass that reasons about values works the same on IR a frontend built and on IR lifted from
+// bytecode:
+//
+//     IrFunction ir;
+//     ir_function_init(&ir, 1);                               // f(n): s = 0; for i < n: s += i; return s
+//     IrValue zero = ir_constant(&ir, BITCAST(double, uint64_t, 0.0));
+//     BlockIndex loop = ir_block(&ir, 2);                     // parameters i and s
+//     IrValue entry = ir_enter(&ir, 0, loop, 2, (IrValue[]) { zero, zero }, 1);
+//     ir_op(&ir, 0, RET_V, ir_result(&ir, entry, 0), IR_NONE);
+//     IrValue i = ir_param(&ir, loop, 0), s = ir_param(&ir, loop, 1);
+//     ir_br(&ir, loop, 0, ir_op(&ir, loop, F_EQ_64, i, ir_arg(&ir, 0)), 1, &s);
+//     IrValue next = ir_op_im(&ir, loop, F_ADD_IM_64, i, BITCAST(double, uint64_t, 1.0));
+//     ir_re(&ir, loop, 0, IR_NONE, 2, (IrValue[]) { next, ir_op(&ir, loop, F_ADD_64, s, i) });
+//
+// ir_lift turns verified bytecode into IR. ir_simplify drops parameters and results that only pass one value along,
+// and everything nothing reads. ir_lower colors values onto registers and turns block arguments into COPY_64s, giving
+// a DecodedFunction for encode_decoded_function.
+//
+// IR differs from bytecode in two places. An instruction writing part of a register (comparisons, 32-bit floats)
+// defines a new value whose other bytes are unspecified, instead of keeping the old ones, so ir_lift refuses a
+// function that reads them. And there is no WHEN_NZ or LOOP_ instruction: the lifter builds them from IF_NZ, and
+// lowering gives WHEN_NZ back when one arm only leaves, and a LOOP_ instruction when a step by one, an equality test
+// and an IF_NZ between leaving and restarting line up.
+// SELECT_64 stays, but what it keeps is an operand like the other two; lowering copies that into the destination
+// first when the two do not share a register.
+
+typedef uint32_t IrValue;
+
+#define IR_NONE UINT32_MAX
+
+typedef ENUM_T(uint8_t) {
+    IR_INSTRUCTION,
+    IR_ARG,         // a parameter of the root block the caller sets
+    IR_PARAM,
+    IR_RESULT,
+    IR_CONSTANT,    // a constant register once lowered
+    IR_UNDEF,       // what a register holds before anything writes it
+} IrKind;
+
+typedef struct {
+    IrKind kind;
+    // IR_INSTRUCTION: the instruction but its registers, BLOCK, IF_NZ and SWITCH naming IR blocks; IR_CONSTANT: immediate
+    DecodedInstruction instr;
+    // the block an instruction is in, or a parameter belongs to
+    BlockIndex block;
+    // IR_ARG, IR_PARAM and IR_RESULT: position, IR_RESULT: the instruction it is a result of
+    uint16_t index;
+    IrValue entry;
+    // IR_INSTRUCTION: operands in IrFunction.operands, the num_sources values decoded_sources lists followed by the
+    // arguments of the block it enters, restarts or leaves
+    uint32_t operands;
+    uint16_t num_sources;
+    uint16_t num_operands;
+    // BLOCK, IF_NZ and SWITCH: their results in IrFunction.operands
+    uint32_t results;
+    uint16_t num_results;
+} IrNode;
+
+typedef struct {
+    stbds_arr(IrValue) params;
+    stbds_arr(IrValue) code;
+} IrBlock;
+
+typedef struct {
+    RegisterIndex num_args;
+    stbds_arr(IrNode) nodes;
+    stbds_arr(IrValue) operands;
+    stbds_arr(IrBlock) blocks;
+    // the tables of SWITCH instructions, naming IR blocks
+    stbds_arr(BlockIndex) tables;
+} IrFunction;
+
+IrValue ir_node(IrFunction* ir, IrNode node) {
+    stbds_arrpush(ir->nodes, node);
+    return (IrValue) (stbds_arrlenu(ir->nodes) - 1);
+}
+
+void ir_function_init(IrFunction* ir, RegisterIndex num_args) {
+    memset(ir, 0, sizeof(IrFunction));
+    ir->num_args = num_args;
+
+    stbds_arrpush(ir->blocks, ((IrBlock) {}));
+    for (RegisterIndex i = 0; i < num_args; i++) {
+        stbds_arrpush(ir->blocks[0].params, ir_node(ir, (IrNode) { .kind = IR_ARG, .index = i }));
+    }
+}
+
+void ir_function_free(IrFunction* ir) {
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        stbds_arrfree(ir->blocks[b].params);
+        stbds_arrfree(ir->blocks[b].code);
+    }
+
+    stbds_arrfree(ir->blocks);
+    stbds_arrfree(ir->nodes);
+    stbds_arrfree(ir->operands);
+    stbds_arrfree(ir->tables);
+    memset(ir, 0, sizeof(IrFunction));
+}
+
+IrValue ir_arg(IrFunction const* ir, RegisterIndex i) {
+    return ir->blocks[0].params[i];
+}
+
+IrValue ir_param(IrFunction const* ir, BlockIndex block, uint32_t i) {
+    return ir->blocks[block].params[i];
+}
+
+IrValue ir_result(IrFunction const* ir, IrValue entry, uint32_t i) {
+    return ir->operands[ir->nodes[entry].results + i];
+}
+
+IrValue ir_add_param(IrFunction* ir, BlockIndex block) {
+    IrValue param = ir_node(ir, (IrNode) { .kind = IR_PARAM, .block = block, .index = (uint16_t) stbds_arrlenu(ir->blocks[block].params) });
+    stbds_arrpush(ir->blocks[block].params, param);
+    return param;
+}
+
+// a new block, entered by nothing yet
+BlockIndex ir_block(IrFunction* ir, uint32_t num_params) {
+    size_t block = stbds_arrlenu(ir->blocks);
+    if (block == MAX_BLOCKS) {
+        fprintf(stderr, "ir: more than %d blocks in one function\n", MAX_BLOCKS);
+        abort();
+    }
+
+    stbds_arrpush(ir->blocks, ((IrBlock) {}));
+    for (uint32_t i = 0; i < num_params; i++) ir_add_param(ir, (BlockIndex) block);
+    return (BlockIndex) block;
+}
+
+IrValue ir_constant(IrFunction* ir, uint64_t value) {
+    for (size_t v = 0; v < stbds_arrlenu(ir->nodes); v++) {
+        if (ir->nodes[v].kind == IR_CONSTANT && ir->nodes[v].instr.immediate == value) return (IrValue) v;
+    }
+
+    return ir_node(ir, (IrNode) { .kind = IR_CONSTANT, .instr = { .immediate = value } });
+}
+
+IrValue ir_undef(IrFunction* ir) {
+    for (size_t v = 0; v < stbds_arrlenu(ir->nodes); v++) {
+        if (ir->nodes[v].kind == IR_UNDEF) return (IrValue) v;
+    }
+
+    return ir_node(ir, (IrNode) { .kind = IR_UNDEF });
+}
+
+// appends instr to block, reading sources and passing args to the block it enters, restarts or leaves; the value of
+// an instruction that writes a register is the instruction itself
+IrValue ir_emit(IrFunction* ir, BlockIndex block, DecodedInstruction instr, uint32_t num_sources, IrValue const* sources, uint32_t num_args, IrValue const* args) {
+    if (instr.opcode == WHEN_NZ || opcode_is_loop(instr.opcode)) {
+        fprintf(stderr, "ir: %s has no IR form, use IF_NZ\n", opcode_name(instr.opcode));
+        abort();
+    }
+
+    uint32_t operands = (uint32_t) stbds_arrlenu(ir->operands);
+    for (uint32_t i = 0; i < num_sources; i++) stbds_arrpush(ir->operands, sources[i]);
+    for (uint32_t i = 0; i < num_args; i++) stbds_arrpush(ir->operands, args[i]);
+
+    IrValue value = ir_node(ir, (IrNode) {
+        .kind = IR_INSTRUCTION,
+        .instr = instr,
+        .block = block,
+        .operands = operands,
+        .num_sources = (uint16_t) num_sources,
+        .num_operands = (uint16_t) (num_sources + num_args),
+    });
+
+    stbds_arrpush(ir->blocks[block].code, value);
+    return value;
+}
+
+// an instruction of up to two sources, in the order decoded_sources lists them: COPY_64, F_SQRT_64 and RET_V read
+// x, the others x and y
+IrValue ir_op(IrFunction* ir, BlockIndex block, OpCode opcode, IrValue x, IrValue y) {
+    IrValue sources [2] = { x, y };
+    return ir_emit(ir, block, (DecodedInstruction) { .opcode = opcode }, y == IR_NONE ? 1 : 2, sources, 0, NULL);
+}
+
+IrValue ir_op_im(IrFunction* ir, BlockIndex block, OpCode opcode, IrValue x, uint64_t immediate) {
+    return ir_emit(ir, block, (DecodedInstruction) { .opcode = opcode, .immediate = immediate }, 1, &x, 0, NULL);
+}
+
+// SELECT_64: taken when condition is not zero, kept when it is
+IrValue ir_select(IrFunction* ir, BlockIndex block, IrValue condition, IrValue taken, IrValue kept) {
+    IrValue sources [3] = { condition, taken, kept };
+    return ir_emit(ir, block, (DecodedInstruction) { .opcode = SELECT_64 }, 3, sources, 0, NULL);
+}
+
+IrValue ir_call(IrFunction* ir, BlockIndex block, OpCode opcode, FunctionIndex callee, uint32_t num_args, IrValue const* args) {
+    return ir_emit(ir, block, (DecodedInstruction) { .opcode = opcode, .w = callee }, num_args, args, 0, NULL);
+}
+
+IrNode* ir_add_results(IrFunction* ir, IrValue entry, uint32_t num_results) {
+    uint32_t results = (uint32_t) stbds_arrlenu(ir->operands);
+    for (uint32_t i = 0; i < num_results; i++) {
+        IrValue result = ir_node(ir, (IrNode) { .kind = IR_RESULT, .block = ir->nodes[entry].block, .index = (uint16_t) i, .entry = entry });
+        stbds_arrpush(ir->operands, result);
+    }
+
+    ir->nodes[entry].results = results;
+    ir->nodes[entry].num_results = (uint16_t) num_results;
+    return ir->nodes + entry;
+}
+
+// BLOCK target, passing args to its parameters; ir_result names what BRs leaving it pass
+IrValue ir_enter(IrFunction* ir, BlockIndex block, BlockIndex target, uint32_t num_args, IrValue const* args, uint32_t num_results) {
+    IrValue entry = ir_emit(ir, block, (DecodedInstruction) { .opcode = BLOCK, .a = target }, 0, NULL, num_args, args);
+    ir_add_results(ir, entry, num_results);
+    return entry;
+}
+
+// IF_NZ into then when condition is not zero and into otherwise when it is, passing the same args to both
+IrValue ir_if(IrFunction* ir, BlockIndex block, IrValue condition, BlockIndex then, BlockIndex otherwise, uint32_t num_args, IrValue const* args, uint32_t num_results) {
+    IrValue entry = ir_emit(ir, block, (DecodedInstruction) { .opcode = IF_NZ, .a = then, .b = otherwise }, 1, &condition, num_args, args);
+    ir_add_results(ir, entry, num_results);
+    return entry;
+}
+
+// SWITCH into table[index + 1] when index is below num_cases and into table[0] when it is not, passing the same
+// args to all of them
+IrValue ir_switch(IrFunction* ir, BlockIndex block, IrValue index, uint8_t num_cases, BlockIndex const* table, uint32_t num_args, IrValue const* args, uint32_t num_results) {
+    DecodedInstruction instr = { .opcode = SWITCH, .b = num_cases, .args = (uint32_t) stbds_arrlenu(ir->tables) };
+    for (uint32_t i = 0; i <= num_cases; i++) stbds_arrpush(ir->tables, table[i]);
+
+    IrValue entry = ir_emit(ir, block, instr, 1, &index, num_args, args);
+    ir_add_results(ir, entry, num_results);
+    return entry;
+}
+
+// BR, or BR_NZ on condition unless that is IR_NONE, passing args to the results of the instruction that entered
+// the block depth levels up
+void ir_br(IrFunction* ir, BlockIndex block, uint8_t depth, IrValue condition, uint32_t num_args, IrValue const* args) {
+    DecodedInstruction instr = { .opcode = condition == IR_NONE ? BR : BR_NZ, .a = depth };
+    ir_emit(ir, block, instr, condition != IR_NONE, &condition, num_args, args);
+}
+
+// RE, or RE_NZ on condition unless that is IR_NONE, passing args to the parameters of the block depth levels up
+void ir_re(IrFunction* ir, BlockIndex block, uint8_t depth, IrValue condition, uint32_t num_args, IrValue const* args) {
+    DecodedInstruction instr = { .opcode = condition == IR_NONE ? RE : RE_NZ, .a = depth };
+    ir_emit(ir, block, instr, condition != IR_NONE, &condition, num_args, args);
+}
+
+// the blocks an instruction enters, in the order decoded_targets gives them
+uint32_t ir_targets(IrFunction const* ir, DecodedInstruction const* instr, BlockIndex* targets) {
+    DecodedFunction tables = { .tables = ir->tables };
+    return decoded_targets(&tables, instr, targets);
+}
+
+bool ir_defines_value(IrNode const* node) {
+    RegisterIndex destination;
+    bool whole;
+    return node->kind != IR_INSTRUCTION || decoded_destination(&node->instr, &destination, &whole);
+}
+
+// how control moves between IR blocks: what entered each block, the instructions restarting it, and the BRs
+// arriving at the results of the instruction entering it. IR blocks are entered from exactly one place
+typedef struct {
+    IrValue entry [MAX_BLOCKS];
+    BlockIndex parent [MAX_BLOCKS];
+    stbds_arr(IrValue) restarts [MAX_BLOCKS];
+    stbds_arr(IrValue) exits [MAX_BLOCKS];
+} IrLinks;
+
+bool ir_links_visit(IrFunction const* ir, IrLinks* links, BlockIndex block, BlockIndex* stack, uint8_t depth) {
+    stack[depth] = block;
+
+    for (size_t i = 0; i < stbds_arrlenu(ir->blocks[block].code); i++) {
+        IrValue value = ir->blocks[block].code[i];
+        DecodedInstruction const* instr = &ir->nodes[value].instr;
+
+        switch (instr->opcode) {
+            case BLOCK:
+            case IF_NZ:
+            case SWITCH: {
+                BlockIndex targets [MAX_TARGETS];
+                uint32_t num_targets = ir_targets(ir, instr, targets);
+
+                for (uint32_t t = 0; t < num_targets; t++) {
+                    BlockIndex target = targets[t];
+                    if (target == 0 || target >= stbds_arrlenu(ir->blocks) || links->entry[target] != IR_NONE) return false;
+
+                    links->entry[target] = value;
+                    links->parent[target] = block;
+                    if (!ir_links_visit(ir, links, target, stack, (uint8_t) (depth + 1))) return false;
+                }
+            } break;
+
+            case BR:
+            case BR_NZ:
+                if (instr->a >= depth) return false;
+                stbds_arrpush(links->exits[stack[depth - instr->a]], value);
+                break;
+
+            case RE:
+            case RE_NZ:
+                if (instr->a > depth) return false;
+                stbds_arrpush(links->restarts[stack[depth - instr->a]], value);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
+// false when a block is entered twice or a depth leaves the root
+bool ir_links_build(IrFunction const* ir, IrLinks* links) {
+    memset(links, 0, sizeof(IrLinks));
+    for (int b = 0; b < MAX_BLOCKS; b++) links->entry[b] = IR_NONE;
+
+    BlockIndex stack [MAX_BLOCKS];
+    return ir_links_visit(ir, links, 0, stack, 0);
+}
+
+void ir_links_free(IrLinks* links) {
+    for (int b = 0; b < MAX_BLOCKS; b++) {
+        stbds_arrfree(links->restarts[b]);
+        stbds_arrfree(links->exits[b]);
+    }
+}
+
+// the instructions passing a value to each position of a parameter or result: the entry and the restarts of a
+// block, or the exits through every block the instruction entered
+void ir_incoming(IrFunction const* ir, IrLinks const* links, IrValue value, stbds_arr(IrValue)* transfers) {
+    IrNode const* node = ir->nodes + value;
+    stbds_arrsetlen(*transfers, 0);
+
+    if (node->kind == IR_PARAM || node->kind == IR_ARG) {
+        if (links->entry[node->block] != IR_NONE) stbds_arrpush(*transfers, links->entry[node->block]);
+        for (size_t r = 0; r < stbds_arrlenu(links->restarts[node->block]); r++) stbds_arrpush(*transfers, links->restarts[node->block][r]);
+    } else if (node->kind == IR_RESULT) {
+        BlockIndex targets [MAX_TARGETS];
+        uint32_t num_targets = ir_targets(ir, &ir->nodes[node->entry].instr, targets);
+        for (uint32_t t = 0; t < num_targets; t++) {
+            for (size_t x = 0; x < stbds_arrlenu(links->exits[targets[t]]); x++) stbds_arrpush(*transfers, links->exits[targets[t]][x]);
+        }
+    }
+}
+
+IrValue ir_passed(IrFunction const* ir, IrValue transfer, uint32_t position) {
+    IrNode const* node = ir->nodes + transfer;
+    return ir->operands[node->operands + node->num_sources + position];
+}
+
+// the lifter keeps one value per register as it walks the blocks from the root, lifting a block once for every
+// instruction entering it. Every block gets a parameter per register and every entry a result per register, and
+// ir_simplify takes out the ones that only pass a value along
+typedef struct {
+    Function const* functions;
+    DecodedFunction decoded;
+    IrFunction* ir;
+} IrLift;
+
+IrValue ir_lift_read(IrLift* lift, IrValue const* state, RegisterIndex r) {
+    if (r < lift->decoded.num_registers) return state[r];
+    return ir_constant(lift->ir, lift->decoded.constants[r - lift->decoded.num_registers]);
+}
+
+// a new block with a parameter per register, or 0 when the function is out of blocks
+BlockIndex ir_lift_new_block(IrLift* lift) {
+    if (stbds_arrlenu(lift->ir->blocks) == MAX_BLOCKS) return 0;
+    return ir_block(lift->ir, lift->decoded.num_registers);
+}
+
+bool ir_lift_block(IrLift* lift, BlockIndex decoded_block, BlockIndex block) {
+    IrFunction* ir = lift->ir;
+    RegisterIndex n = lift->decoded.num_registers;
+    stbds_arr(DecodedInstruction) code = lift->decoded.blocks[decoded_block];
+
+    IrValue state [MAX_REGISTERS + 1];
+    for (RegisterIndex r = 0; r < n; r++) state[r] = ir->blocks[block].params[r];
+
+
+    for (size_t i = 0; i < stbds_arrlenu(code); i++) {
+        DecodedInstruction instr = code[i];
+        RegisterIndex* registers [MAX_REGISTERS + 1];
+        uint32_t num_sources = decoded_sources(lift->functions, &lift->decoded, &instr, registers);
+
+        IrValue sources [MAX_REGISTERS + 1];
+        for (uint32_t s = 0; s < num_sources; s++) sources[s] = ir_lift_read(lift, state, *registers[s]);
+
+        switch (instr.opcode) {
+            case BLOCK: {
+                BlockIndex target = ir_lift_new_block(lift);
+                if (target == 0) return false;
+
+                IrValue entry = ir_enter(ir, block, target, n, state, n);
+                if (!ir_lift_block(lift, instr.a, target)) return false;
+                for (RegisterIndex r = 0; r < n; r++) state[r] = ir_result(ir, entry, r);
+            } break;
+
+            case IF_NZ:
+            case WHEN_NZ: {
+                BlockIndex then = ir_lift_new_block(lift);
+                BlockIndex otherwise = ir_lift_new_block(lift);
+                if (then == 0 || otherwise == 0) return false;
+
+                IrValue entry = ir_if(ir, block, sources[0], then, otherwise, n, state, n);
+                if (!ir_lift_block(lift, instr.a, then)) return false;
+
+                // WHEN_NZ carries on with the registers as they were when the condition is zero
+                if (instr.opcode == IF_NZ) {
+                    if (!ir_lift_block(lift, instr.b, otherwise)) return false;
+                } else {
+                    ir_br(ir, otherwise, 0, IR_NONE, n, ir->blocks[otherwise].params);
+                }
+
+                for (RegisterIndex r = 0; r < n; r++) state[r] = ir_result(ir, entry, r);
+            } break;
+
+            case SWITCH: {
+                BlockIndex table [MAX_TARGETS];
+                for (uint32_t t = 0; t <= instr.b; t++) {
+                    table[t] = ir_lift_new_block(lift);
+                    if (table[t] == 0) return false;
+                }
+
+                IrValue entry = ir_switch(ir, block, sources[0], instr.b, table, n, state, n);
+                for (uint32_t t = 0; t <= instr.b; t++) {
+                    if (!ir_lift_block(lift, lift->decoded.tables[instr.args + t], table[t])) return false;
+                }
+
+                for (RegisterIndex r = 0; r < n; r++) state[r] = ir_result(ir, entry, r);
+            } break;
+
+            case LOOP_F64:
+            case LOOP_IM_F64:
+            case LOOP_I64:
+            case LOOP_IM_I64: {
+                // the counter steps and is compared, then an IF_NZ either leaves through an arm that only ends or
+                // restarts
+                bool integer = instr.opcode == LOOP_I64 || instr.opcode == LOOP_IM_I64;
+                IrValue next = integer
+                    ? ir_op(ir, block, I_ADD_64, state[instr.a], ir_constant(ir, 1))
+                    : ir_op_im(ir, block, F_ADD_IM_64, state[instr.a], BITCAST(double, uint64_t, 1.0));
+                state[instr.a] = next;
+
+                IrValue done;
+                if (instr.opcode == LOOP_IM_F64 || instr.opcode == LOOP_IM_I64) {
+                    done = ir_op_im(ir, block, integer ? S_EQ_IM_64 : F_EQ_IM_64, next, instr.immediate);
+                } else {
+                    done = ir_op(ir, block, integer ? S_EQ_64 : F_EQ_64, next, ir_lift_read(lift, state, instr.b));
+                }
+
+                BlockIndex then = ir_lift_new_block(lift);
+                BlockIndex otherwise = ir_lift_new_block(lift);
+                if (then == 0 || otherwise == 0) return false;
+
+                IrValue entry = ir_if(ir, block, done, then, otherwise, n, state, n);
+                ir_br(ir, then, 0, IR_NONE, n, ir->blocks[then].params);
+                ir_re(ir, otherwise, (uint8_t) (instr.c + 1), IR_NONE, n, ir->blocks[otherwise].params);
+
+                for (RegisterIndex r = 0; r < n; r++) state[r] = ir_result(ir, entry, r);
+            } break;
+
+            case BR:
+            case BR_NZ:
+                ir_br(ir, block, instr.a, instr.opcode == BR ? IR_NONE : sources[0], n, state);
+                break;
+
+            case RE:
+            case RE_NZ:
+                ir_re(ir, block, instr.a, instr.opcode == RE ? IR_NONE : sources[0], n, state);
+                break;
+
+            default: {
+                bool whole;
+                RegisterIndex* destination = decoded_destination_operand(&instr, &whole);
+                IrValue value = ir_emit(ir, block, (DecodedInstruction) { .opcode = instr.opcode, .w = instr.w, .immediate = instr.immediate }, num_sources, sources, 0, NULL);
+                if (destination != NULL) state[*destination] = value;
+            } break;
+        }
+
+        if (opcode_ends_block(instr.opcode)) break;
+    }
+
+    return true;
+}
+
+// the low bytes of its register an instruction writes: 8 unless it keeps the rest of the old value, 4 for 32-bit
+// floats and 1 for comparison results
+uint8_t ir_written_bytes(DecodedInstruction const* instr) {
+    RegisterIndex destination;
+    bool whole;
+    if (!decoded_destination(instr, &destination, &whole) || whole) return 8;
+
+    switch (instr->opcode) {
+        case F_ADD_32:
+        case F_SUB_32:
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+// the low bytes of its source s an instruction reads: conditions test one, 32-bit floats read four
+uint8_t ir_read_bytes(DecodedInstruction const* instr, uint32_t s) {
+    switch (instr->opcode) {
+        case IF_NZ:
+        case WHEN_NZ:
+        case BR_NZ:
+        case RE_NZ:
+            return 1;
+        case SELECT_64:
+            return s == 0 ? 1 : 8;
+        case F_ADD_32:
+        case F_SUB_32:
+        case F_EQ_32:
+        case F_LT_32:
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+        case F_EQ_IM_32:
+        case F_LT_IM_A_32:
+        case F_LT_IM_B_32:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+// true when some instruction reads bytes of a value that a partial write left unspecified, through any number of
+// parameters and results. bytecode would read what the register held before, which IR does not keep
+bool ir_reads_unspecified(IrFunction const* ir) {
+    IrLinks links;
+    if (!ir_links_build(ir, &links)) {
+        ir_links_free(&links);
+        return true;
+    }
+
+    size_t num_nodes = stbds_arrlenu(ir->nodes);
+    stbds_arr(uint8_t) bytes = NULL;
+    stbds_arrsetlen(bytes, num_nodes);
+    for (size_t v = 0; v < num_nodes; v++) {
+        IrNode const* node = ir->nodes + v;
+        bytes[v] = node->kind == IR_INSTRUCTION ? ir_written_bytes(&node->instr) : 8;
+    }
+
+    // parameters and results hold no more than the narrowest value arriving at them
+    stbds_arr(IrValue) transfers = NULL;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (size_t v = 0; v < num_nodes; v++) {
+            IrNode const* node = ir->nodes + v;
+            if (node->kind != IR_PARAM && node->kind != IR_RESULT) continue;
+
+            ir_incoming(ir, &links, (IrValue) v, &transfers);
+            for (size_t t = 0; t < stbds_arrlenu(transfers); t++) {
+                IrValue passed = ir_passed(ir, transfers[t], node->index);
+                if (bytes[passed] < bytes[v]) {
+                    bytes[v] = bytes[passed];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool unspecified = false;
+    for (size_t v = 0; v < num_nodes && !unspecified; v++) {
+        IrNode const* node = ir->nodes + v;
+        if (node->kind != IR_INSTRUCTION) continue;
+        for (uint32_t s = 0; s < node->num_sources; s++) {
+            if (ir_read_bytes(&node->instr, s) > bytes[ir->operands[node->operands + s]]) unspecified = true;
+        }
+    }
+
+    stbds_arrfree(transfers);
+    stbds_arrfree(bytes);
+    ir_links_free(&links);
+    return unspecified;
+}
+
+// lifts one function of a verified program; false when copying the blocks entered from several places runs out
+// of block indices, or when the function reads the bytes a partial write keeps, see ir_reads_unspecified
+bool ir_lift(Function const* functions, FunctionIndex index, IrFunction* ir) {
+    IrLift lift = { .functions = functions, .ir = ir };
+    decode_function(functions, index, &lift.decoded);
+
+    ir_function_init(ir, lift.decoded.num_args);
+    for (RegisterIndex r = lift.decoded.num_args; r < lift.decoded.num_registers; r++) ir_add_param(ir, 0);
+
+    bool lifted = ir_lift_block(&lift, 0, 0) && !ir_reads_unspecified(ir);
+
+    decoded_function_free(&lift.decoded);
+    if (!lifted) ir_function_free(ir);
+    return lifted;
+}
+
+IrValue ir_forwarded(stbds_arr(IrValue) forward, IrValue value) {
+    while (forward[value] != IR_NONE) value = forward[value];
+    return value;
+}
+
+// a parameter or result all of whose transfers pass the same value, or itself, is that value: forwards it and
+// returns true. the root's registers past the arguments start undefined, and the arms of an IF_NZ or a SWITCH take
+// one set of arguments, so a parameter of one only goes together with the same one of the others
+bool ir_forward_trivial(IrFunction* ir, IrLinks const* links, stbds_arr(IrValue) forward, IrValue value, stbds_arr(IrValue)* transfers) {
+    IrNode const* node = ir->nodes + value;
+    if ((node->kind != IR_PARAM && node->kind != IR_RESULT) || forward[value] != IR_NONE) return false;
+
+    IrValue siblings [MAX_TARGETS] = { value };
+    uint32_t num_siblings = 1;
+    if (node->kind == IR_PARAM && node->block != 0 && links->entry[node->block] != IR_NONE) {
+        BlockIndex targets [MAX_TARGETS];
+        num_siblings = ir_targets(ir, &ir->nodes[links->entry[node->block]].instr, targets);
+        for (uint32_t t = 0; t < num_siblings; t++) siblings[t] = ir->blocks[targets[t]].params[node->index];
+    }
+
+    IrValue same = IR_NONE;
+    if (node->kind == IR_PARAM && node->block == 0) same = ir_undef(ir);
+
+    for (uint32_t side = 0; side < num_siblings; side++) {
+        ir_incoming(ir, links, siblings[side], transfers);
+
+        for (size_t t = 0; t < stbds_arrlenu(*transfers); t++) {
+            IrValue passed = ir_forwarded(forward, ir_passed(ir, (*transfers)[t], ir->nodes[siblings[side]].index));
+            bool own = passed == same;
+            for (uint32_t o = 0; o < num_siblings && !own; o++) own = passed == siblings[o];
+            if (own) continue;
+            if (same != IR_NONE) return false;
+            same = passed;
+        }
+    }
+
+    // a result nothing arrives at belongs to code after a block that never ends normally
+    if (same == IR_NONE) same = ir_undef(ir);
+    for (uint32_t side = 0; side < num_siblings; side++) forward[siblings[side]] = same;
+    return true;
+}
+
+// forwards parameters and results that pass one value along, then removes whatever no effect, branch or return
+// depends on, parameters and results included; returns the number of values removed
+uint32_t ir_simplify(IrFunction* ir) {
+    IrLinks links;
+    if (!ir_links_build(ir, &links)) {
+        ir_links_free(&links);
+        return 0;
+    }
+
+    stbds_arr(IrValue) forward = NULL;
+    stbds_arr(IrValue) transfers = NULL;
+    stbds_arrsetlen(forward, stbds_arrlenu(ir->nodes));
+    for (size_t v = 0; v < stbds_arrlenu(forward); v++) forward[v] = IR_NONE;
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        size_t num_nodes = stbds_arrlenu(ir->nodes);
+        for (size_t v = 0; v < num_nodes; v++) {
+            if (ir_forward_trivial(ir, &links, forward, (IrValue) v, &transfers)) changed = true;
+            while (stbds_arrlenu(forward) < stbds_arrlenu(ir->nodes)) stbds_arrpush(forward, IR_NONE);
+        }
+    }
+
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrNode const* node = ir->nodes + ir->blocks[b].code[i];
+            for (uint32_t o = 0; o < node->num_operands; o++) ir->operands[node->operands + o] = ir_forwarded(forward, ir->operands[node->operands + o]);
+        }
+    }
+
+    // live values, from the instructions that have to stay back through what they read
+    size_t num_nodes = stbds_arrlenu(ir->nodes);
+    stbds_arr(bool) live = NULL;
+    stbds_arr(IrValue) work = NULL;
+    stbds_arrsetlen(live, num_nodes);
+    memset(live, 0, num_nodes * sizeof(bool));
+
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrValue value = ir->blocks[b].code[i];
+            IrNode const* node = ir->nodes + value;
+            if (ir_defines_value(node) && !opcode_has_effects(node->instr.opcode)) continue;
+
+            live[value] = true;
+            stbds_arrpush(work, value);
+        }
+    }
+
+    while (stbds_arrlenu(work) > 0) {
+        IrValue value = work[stbds_arrlenu(work) - 1];
+        stbds_arrsetlen(work, stbds_arrlenu(work) - 1);
+        IrNode const* node = ir->nodes + value;
+
+        stbds_arrsetlen(transfers, 0);
+        if (node->kind == IR_INSTRUCTION) {
+            for (uint32_t s = 0; s < node->num_sources; s++) stbds_arrpush(transfers, ir->operands[node->operands + s]);
+        } else {
+            stbds_arr(IrValue) incoming = NULL;
+            ir_incoming(ir, &links, value, &incoming);
+            for (size_t t = 0; t < stbds_arrlenu(incoming); t++) stbds_arrpush(transfers, ir_passed(ir, incoming[t], node->index));
+            stbds_arrfree(incoming);
+        }
+
+        for (size_t t = 0; t < stbds_arrlenu(transfers); t++) {
+            if (live[transfers[t]]) continue;
+            live[transfers[t]] = true;
+            stbds_arrpush(work, transfers[t]);
+        }
+    }
+
+    // which positions every parameter list and result list keeps; the arms of an IF_NZ or a SWITCH take the same
+    // arguments, so a position stays while any arm needs it
+    stbds_arr(bool) keep = NULL;
+    stbds_arrsetlen(keep, num_nodes);
+    for (size_t v = 0; v < num_nodes; v++) keep[v] = ir->nodes[v].kind == IR_ARG || (live[v] && forward[v] == IR_NONE);
+
+    for (size_t b = 1; b < stbds_arrlenu(ir->blocks); b++) {
+        IrValue entry = links.entry[b];
+        if (entry == IR_NONE) continue;
+
+        BlockIndex arms [MAX_TARGETS];
+        uint32_t num_arms = ir_targets(ir, &ir->nodes[entry].instr, arms);
+        if (num_arms < 2 || arms[0] != b) continue;
+
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].params); i++) {
+            bool any = false;
+            for (uint32_t t = 0; t < num_arms; t++) any |= i < stbds_arrlenu(ir->blocks[arms[t]].params) && keep[ir->blocks[arms[t]].params[i]];
+            for (uint32_t t = 0; t < num_arms; t++) {
+                if (i < stbds_arrlenu(ir->blocks[arms[t]].params)) keep[ir->blocks[arms[t]].params[i]] = any;
+            }
+        }
+    }
+
+    // what a transfer passes to, so the arguments it drops line up with the parameters or results dropped
+    uint32_t removed = 0;
+    stbds_arr(IrValue) operands = NULL;
+
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        stbds_arr(IrValue) code = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrValue value = ir->blocks[b].code[i];
+            IrNode* node = ir->nodes + value;
+
+            if (!live[value]) {
+                removed++;
+                continue;
+            }
+            stbds_arrpush(code, value);
+
+            stbds_arr(IrValue) targets = NULL;
+            switch (node->instr.opcode) {
+                case BLOCK:
+                case IF_NZ:
+                case SWITCH: {
+                    BlockIndex arms [MAX_TARGETS];
+                    ir_targets(ir, &node->instr, arms);
+                    targets = ir->blocks[arms[0]].params;
+                } break;
+                case BR:
+                case BR_NZ: {
+                    BlockIndex left = (BlockIndex) b;
+                    for (uint8_t d = 0; d < node->instr.a; d++) left = links.parent[left];
+                    IrNode const* entry = ir->nodes + links.entry[left];
+                    for (uint16_t r = 0; r < entry->num_results; r++) stbds_arrpush(targets, ir->operands[entry->results + r]);
+                } break;
+                case RE:
+                case RE_NZ: {
+                    BlockIndex restarted = (BlockIndex) b;
+                    for (uint8_t d = 0; d < node->instr.a; d++) restarted = links.parent[restarted];
+                    targets = ir->blocks[restarted].params;
+                } break;
+                default:
+                    break;
+            }
+
+            uint32_t start = (uint32_t) stbds_arrlenu(operands);
+            for (uint32_t o = 0; o < node->num_operands; o++) {
+                if (o >= node->num_sources && !keep[targets[o - node->num_sources]]) continue;
+                stbds_arrpush(operands, ir->operands[node->operands + o]);
+            }
+
+            if (node->instr.opcode == BR || node->instr.opcode == BR_NZ) stbds_arrfree(targets);
+            node->operands = start;
+            node->num_operands = (uint16_t) (stbds_arrlenu(operands) - start);
+        }
+
+        stbds_arrfree(ir->blocks[b].code);
+        ir->blocks[b].code = code;
+    }
+
+    // result lists go last, their old positions are still needed while the arguments above are filtered
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrNode* node = ir->nodes + ir->blocks[b].code[i];
+            if (node->num_results == 0) continue;
+
+            uint32_t start = (uint32_t) stbds_arrlenu(operands);
+            for (uint16_t r = 0; r < node->num_results; r++) {
+                IrValue result = ir->operands[node->results + r];
+                if (!keep[result]) {
+                    removed++;
+                    continue;
+                }
+                ir->nodes[result].index = (uint16_t) (stbds_arrlenu(operands) - start);
+                stbds_arrpush(operands, result);
+            }
+
+            node->results = start;
+            node->num_results = (uint16_t) (stbds_arrlenu(operands) - start);
+        }
+
+        stbds_arr(IrValue) params = NULL;
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].params); i++) {
+            IrValue param = ir->blocks[b].params[i];
+            if (!keep[param]) {
+                removed++;
+                continue;
+            }
+            ir->nodes[param].index = (uint16_t) stbds_arrlenu(params);
+            stbds_arrpush(params, param);
+        }
+
+        stbds_arrfree(ir->blocks[b].params);
+        ir->blocks[b].params = params;
+    }
+
+    stbds_arrfree(ir->operands);
+    ir->operands = operands;
+
+    stbds_arrfree(forward);
+    stbds_arrfree(transfers);
+    stbds_arrfree(live);
+    stbds_arrfree(work);
+    stbds_arrfree(keep);
+    ir_links_free(&links);
+
+    return removed;
+}
+
+// lowering runs over one node per instruction like the optimizer, and numbers every value that needs a register.
+// parameters are defined where their block starts and results right after the instruction entering their block,
+// on the way in from whatever transfer got there
+typedef struct {
+    IrFunction const* ir;
+    IrLinks links;
+    uint32_t num_positions;
+    uint32_t block_start [MAX_BLOCKS + 1];
+    stbds_arr(IrValue) position_value;
+    stbds_arr(BlockIndex) position_block;
+    // words per value set
+    uint32_t words;
+    stbds_arr(uint64_t) live_in;
+    stbds_arr(uint64_t) live_out;
+    stbds_arr(uint64_t) interferes;
+    // union-find over values that share a register, members of each class and its color
+    stbds_arr(IrValue) class;
+    stbds_arr(uint64_t) members;
+    stbds_arr(int32_t) color;
+} IrLower;
+
+#define IR_SET(lower, sets, i) ((sets) + (size_t) (i) * (lower)->words)
+#define IR_SET_HAS(set, v) (((set)[(v) / 64] >> ((v) % 64)) & 1)
+#define IR_SET_ADD(set, v) ((set)[(v) / 64] |= (uint64_t) 1 << ((v) % 64))
+#define IR_SET_REMOVE(set, v) ((set)[(v) / 64] &= ~((uint64_t) 1 << ((v) % 64)))
+
+bool ir_needs_register(IrFunction const* ir, IrValue value) {
+    IrKind kind = ir->nodes[value].kind;
+    return kind != IR_CONSTANT && kind != IR_UNDEF && ir_defines_value(ir->nodes + value);
+}
+
+// the parameters or results a transfer passes its arguments to, NULL for the others
+IrValue const* ir_transfer_targets(IrLower const* lower, BlockIndex block, IrNode const* node) {
+    IrFunction const* ir = lower->ir;
+    BlockIndex target = block;
+
+    switch (node->instr.opcode) {
+        case BLOCK:
+        case IF_NZ:
+        case SWITCH: {
+            BlockIndex arms [MAX_TARGETS];
+            ir_targets(ir, &node->instr, arms);
+            return ir->blocks[arms[0]].params;
+        }
+
+        case BR:
+        case BR_NZ:
+            for (uint8_t d = 0; d < node->instr.a; d++) target = lower->links.parent[target];
+            return ir->operands + ir->nodes[lower->links.entry[target]].results;
+
+        case RE:
+        case RE_NZ:
+            for (uint8_t d = 0; d < node->instr.a; d++) target = lower->links.parent[target];
+            return ir->blocks[target].params;
+
+        default:
+            return NULL;
+    }
+}
+
+void ir_lower_successors(IrLower const* lower, uint32_t position, stbds_arr(uint32_t)* out) {
+    IrFunction const* ir = lower->ir;
+    IrNode const* node = ir->nodes + lower->position_value[position];
+    BlockIndex block = lower->position_block[position];
+    BlockIndex target = block;
+
+    stbds_arrsetlen(*out, 0);
+
+    switch (node->instr.opcode) {
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+        case TAIL_CALL_V:
+        case RET_V:
+            break;
+
+        case BLOCK:
+        case IF_NZ:
+        case SWITCH: {
+            BlockIndex arms [MAX_TARGETS];
+            uint32_t num_arms = ir_targets(ir, &node->instr, arms);
+            for (uint32_t t = 0; t < num_arms; t++) stbds_arrpush(*out, lower->block_start[arms[t]]);
+        } break;
+
+        case BR:
+        case BR_NZ: {
+            for (uint8_t d = 0; d < node->instr.a; d++) target = lower->links.parent[target];
+            IrValue entry = lower->links.entry[target];
+            BlockIndex outer = lower->links.parent[target];
+
+            for (uint32_t p = lower->block_start[outer]; p < lower->block_start[outer + 1]; p++) {
+                if (lower->position_value[p] == entry) stbds_arrpush(*out, p + 1);
+            }
+            if (node->instr.opcode == BR_NZ) stbds_arrpush(*out, position + 1);
+        } break;
+
+        case RE:
+        case RE_NZ:
+            for (uint8_t d = 0; d < node->instr.a; d++) target = lower->links.parent[target];
+            stbds_arrpush(*out, lower->block_start[target]);
+            if (node->instr.opcode == RE_NZ) stbds_arrpush(*out, position + 1);
+            break;
+
+        default:
+            stbds_arrpush(*out, position + 1);
+            break;
+    }
+}
+
+// the values a position defines on the way in: its block's parameters at a block start, the results of the
+// instruction before it when that entered a block
+void ir_lower_defined_on_entry(IrLower const* lower, uint32_t position, stbds_arr(IrValue)* out) {
+    IrFunction const* ir = lower->ir;
+    BlockIndex block = lower->position_block[position];
+
+    stbds_arrsetlen(*out, 0);
+
+    if (position == lower->block_start[block]) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[block].params); i++) stbds_arrpush(*out, ir->blocks[block].params[i]);
+    } else {
+        IrNode const* before = ir->nodes + lower->position_value[position - 1];
+        for (uint16_t r = 0; r < before->num_results; r++) stbds_arrpush(*out, ir->operands[before->results + r]);
+    }
+}
+
+void ir_lower_liveness(IrLower* lower) {
+    IrFunction const* ir = lower->ir;
+    uint32_t words = lower->words;
+    stbds_arr(uint32_t) successors = NULL;
+    stbds_arr(IrValue) defined = NULL;
+    stbds_arr(uint64_t) set = NULL;
+    stbds_arrsetlen(set, words);
+
+    for (bool changed = true; changed;) {
+        changed = false;
+
+        for (uint32_t p = lower->num_positions; p-- > 0;) {
+            uint64_t* out = IR_SET(lower, lower->live_out, p);
+            memset(set, 0, words * sizeof(uint64_t));
+
+            ir_lower_successors(lower, p, &successors);
+            for (size_t s = 0; s < stbds_arrlenu(successors); s++) {
+                uint64_t const* in = IR_SET(lower, lower->live_in, successors[s]);
+                for (uint32_t w = 0; w < words; w++) set[w] |= in[w];
+
+                ir_lower_defined_on_entry(lower, successors[s], &defined);
+                for (size_t d = 0; d < stbds_arrlenu(defined); d++) IR_SET_REMOVE(set, defined[d]);
+            }
+            memcpy(out, set, words * sizeof(uint64_t));
+
+            IrValue value = lower->position_value[p];
+            IrNode const* node = ir->nodes + value;
+            if (ir_needs_register(ir, value)) IR_SET_REMOVE(set, value);
+            for (uint32_t o = 0; o < node->num_operands; o++) {
+                IrValue operand = ir->operands[node->operands + o];
+                if (ir_needs_register(ir, operand)) IR_SET_ADD(set, operand);
+            }
+
+            uint64_t* in = IR_SET(lower, lower->live_in, p);
+            if (memcmp(in, set, words * sizeof(uint64_t)) != 0) {
+                memcpy(in, set, words * sizeof(uint64_t));
+                changed = true;
+            }
+        }
+    }
+
+    stbds_arrfree(successors);
+    stbds_arrfree(defined);
+    stbds_arrfree(set);
+}
+
+void ir_lower_interfere(IrLower* lower, IrValue x, IrValue y) {
+    if (x == y) return;
+    IR_SET_ADD(IR_SET(lower, lower->interferes, x), y);
+    IR_SET_ADD(IR_SET(lower, lower->interferes, y), x);
+}
+
+// a value interferes with everything live where it is defined. the copies of an IF_NZ or a SWITCH run before it
+// reads its condition or index, so that stays apart from the parameters too, and the copy of what a SELECT_64 keeps
+// runs before it reads its condition and what it takes
+void ir_lower_interference(IrLower* lower) {
+    IrFunction const* ir = lower->ir;
+    size_t num_values = stbds_arrlenu(ir->nodes);
+    stbds_arr(IrValue) defined = NULL;
+
+    for (uint32_t p = 0; p < lower->num_positions; p++) {
+        uint64_t const* in = IR_SET(lower, lower->live_in, p);
+        uint64_t const* out = IR_SET(lower, lower->live_out, p);
+
+        ir_lower_defined_on_entry(lower, p, &defined);
+        for (size_t d = 0; d < stbds_arrlenu(defined); d++) {
+            for (size_t v = 0; v < num_values; v++) {
+                if (IR_SET_HAS(in, v)) ir_lower_interfere(lower, defined[d], (IrValue) v);
+            }
+            for (size_t e = 0; e < stbds_arrlenu(defined); e++) ir_lower_interfere(lower, defined[d], defined[e]);
+        }
+
+        IrValue value = lower->position_value[p];
+        IrNode const* node = ir->nodes + value;
+
+        if (ir_needs_register(ir, value)) {
+            IrValue copied = node->instr.opcode == COPY_64 ? ir->operands[node->operands] : IR_NONE;
+            for (size_t v = 0; v < num_values; v++) {
+                if (IR_SET_HAS(out, v) && v != copied) ir_lower_interfere(lower, value, (IrValue) v);
+            }
+
+            if (node->instr.opcode == SELECT_64) {
+                for (uint32_t s = 0; s < 2; s++) {
+                    IrValue source = ir->operands[node->operands + s];
+                    if (ir_needs_register(ir, source)) ir_lower_interfere(lower, value, source);
+                }
+            }
+        }
+
+        if (node->instr.opcode == IF_NZ || node->instr.opcode == SWITCH) {
+            IrValue condition = ir->operands[node->operands];
+            if (!ir_needs_register(ir, condition)) continue;
+
+            BlockIndex arms [MAX_TARGETS];
+            uint32_t num_arms = ir_targets(ir, &node->instr, arms);
+            for (uint32_t t = 0; t < num_arms; t++) {
+                IrBlock const* target = ir->blocks + arms[t];
+                for (size_t i = 0; i < stbds_arrlenu(target->params); i++) ir_lower_interfere(lower, condition, target->params[i]);
+            }
+        }
+    }
+
+    stbds_arrfree(defined);
+}
+
+IrValue ir_lower_class(IrLower* lower, IrValue value) {
+    while (lower->class[value] != value) value = lower->class[value] = lower->class[lower->class[value]];
+    return value;
+}
+
+// puts x and y in one register unless their classes interfere or are both arguments already
+bool ir_lower_coalesce(IrLower* lower, IrValue x, IrValue y) {
+    IrFunction const* ir = lower->ir;
+    if (!ir_needs_register(ir, x) || !ir_needs_register(ir, y)) return false;
+
+    IrValue cx = ir_lower_class(lower, x);
+    IrValue cy = ir_lower_class(lower, y);
+    if (cx == cy) return true;
+    if (lower->color[cx] >= 0 && lower->color[cy] >= 0) return false;
+
+    uint64_t* ix = IR_SET(lower, lower->interferes, cx);
+    uint64_t* iy = IR_SET(lower, lower->interferes, cy);
+    uint64_t* mx = IR_SET(lower, lower->members, cx);
+    uint64_t* my = IR_SET(lower, lower->members, cy);
+
+    for (uint32_t w = 0; w < lower->words; w++) {
+        if ((ix[w] & my[w]) != 0) return false;
+    }
+
+    // the class keeping its color, if either has one, absorbs the other
+    if (lower->color[cy] >= 0) {
+        IrValue swap = cx; cx = cy; cy = swap;
+        uint64_t* t = ix; ix = iy; iy = t;
+        t = mx; mx = my; my = t;
+    }
+
+    for (uint32_t w = 0; w < lower->words; w++) {
+        ix[w] |= iy[w];
+        mx[w] |= my[w];
+    }
+    lower->class[cy] = cx;
+    return true;
+}
+
+// a parallel copy: where each destination register's new value comes from; a source of IR_NONE is the scratch
+// register a cycle goes through
+typedef struct {
+    IrValue source;
+    RegisterIndex destination;
+} IrMove;
+
+int32_t ir_lower_register(IrLower* lower, IrValue value) {
+    if (!ir_needs_register(lower->ir, value)) return -1;
+    return lower->color[ir_lower_class(lower, value)];
+}
+
+// the copies a transfer needs to put its arguments into the registers of what it passes them to
+void ir_lower_moves(IrLower* lower, BlockIndex block, IrValue transfer, stbds_arr(IrMove)* moves) {
+    IrFunction const* ir = lower->ir;
+    IrNode const* node = ir->nodes + transfer;
+    IrValue const* targets = ir_transfer_targets(lower, block, node);
+
+    stbds_arrsetlen(*moves, 0);
+    if (targets == NULL) return;
+
+    for (uint32_t o = node->num_sources; o < node->num_operands; o++) {
+        IrValue source = ir->operands[node->operands + o];
+        RegisterIndex destination = (RegisterIndex) ir_lower_register(lower, targets[o - node->num_sources]);
+        if (ir->nodes[source].kind == IR_UNDEF || ir_lower_register(lower, source) == destination) continue;
+        stbds_arrpush(*moves, ((IrMove) { source, destination }));
+    }
+}
+
+// orders moves so no copy overwrites a register a later one reads, breaking cycles through scratch, and sets
+// *used_scratch when it needed scratch. with out NULL it only answers that. false when a constant source finds no
+// register left to live in
+bool ir_lower_sequence(IrLower* lower, DecodedFunction* out, stbds_arr(DecodedInstruction)* code, stbds_arr(IrMove) moves, RegisterIndex scratch, bool* used_scratch) {
+    stbds_arr(IrMove) pending = NULL;
+    for (size_t m = 0; m < stbds_arrlenu(moves); m++) stbds_arrpush(pending, moves[m]);
+
+    while (stbds_arrlenu(pending) > 0) {
+        size_t ready = stbds_arrlenu(pending);
+        for (size_t m = 0; m < stbds_arrlenu(pending) && ready == stbds_arrlenu(pending); m++) {
+            bool read = false;
+            for (size_t o = 0; o < stbds_arrlenu(pending); o++) {
+                if (o != m && pending[o].source != IR_NONE && ir_lower_register(lower, pending[o].source) == pending[m].destination) read = true;
+            }
+            if (!read) ready = m;
+        }
+
+        if (ready == stbds_arrlenu(pending)) {
+            // every destination is still read: save one, and read it from scratch from now on
+            int32_t saved = ir_lower_register(lower, pending[0].source);
+            if (out != NULL) stbds_arrpush(*code, ((DecodedInstruction) { .opcode = COPY_64, .a = (RegisterIndex) saved, .b = scratch }));
+            for (size_t o = 0; o < stbds_arrlenu(pending); o++) {
+                if (pending[o].source != IR_NONE && ir_lower_register(lower, pending[o].source) == saved) pending[o].source = IR_NONE;
+            }
+            if (used_scratch != NULL) *used_scratch = true;
+            continue;
+        }
+
+        if (out != NULL) {
+            IrValue source = pending[ready].source;
+            RegisterIndex from = scratch;
+            if (source != IR_NONE) {
+                int32_t r = ir_lower_register(lower, source);
+                if (r >= 0) {
+                    from = (RegisterIndex) r;
+                } else if (!optimize_constant_register(out, lower->ir->nodes[source].instr.immediate, &from)) {
+                    stbds_arrfree(pending);
+                    return false;
+                }
+            }
+            stbds_arrpush(*code, ((DecodedInstruction) { .opcode = COPY_64, .a = from, .b = pending[ready].destination }));
+        }
+
+        stbds_arrdel(pending, ready);
+    }
+
+    stbds_arrfree(pending);
+    return true;
+}
+
+void ir_lower_free(IrLower* lower) {
+    ir_links_free(&lower->links);
+    stbds_arrfree(lower->position_value);
+    stbds_arrfree(lower->position_block);
+    stbds_arrfree(lower->live_in);
+    stbds_arrfree(lower->live_out);
+    stbds_arrfree(lower->interferes);
+    stbds_arrfree(lower->class);
+    stbds_arrfree(lower->members);
+    stbds_arrfree(lower->color);
+}
+
+// true for an IF_NZ arm that only leaves with nothing to copy, which lowering turns the IF_NZ into WHEN_NZ for
+bool ir_lower_empty_arm(IrLower* lower, BlockIndex block, stbds_arr(IrMove)* moves) {
+    IrFunction const* ir = lower->ir;
+    if (stbds_arrlenu(ir->blocks[block].code) != 1) return false;
+
+    IrValue only = ir->blocks[block].code[0];
+    if (ir->nodes[only].instr.opcode != BR || ir->nodes[only].instr.a != 0) return false;
+
+    ir_lower_moves(lower, block, only, moves);
+    return stbds_arrlenu(*moves) == 0;
+}
+
+// what lowering emits for an instruction fused with others: itself, nothing, or the instruction it became
+#define IR_NOT_FUSED HALT
+#define IR_FUSED_AWAY UNREACHABLE
+
+// the LOOP_ instruction doing what the step at code[i], the comparison after it and the IF_NZ after that do, when the
+// IF_NZ leaves through its then arm and restarts through its else arm with nothing to copy, the step writes over the
+// counter and nothing else reads the comparison
+bool ir_lower_counted(IrLower* lower, BlockIndex block, size_t i, stbds_arr(uint32_t) uses, stbds_arr(IrMove)* moves, DecodedInstruction* loop) {
+    IrFunction const* ir = lower->ir;
+    stbds_arr(IrValue) code = ir->blocks[block].code;
+    if (i + 2 >= stbds_arrlenu(code)) return false;
+
+    IrNode const* step = ir->nodes + code[i];
+    IrNode const* compare = ir->nodes + code[i + 1];
+    IrNode const* branch = ir->nodes + code[i + 2];
+    if (branch->instr.opcode != IF_NZ || ir->operands[branch->operands] != code[i + 1] || uses[code[i + 1]] != 1) return false;
+
+    IrValue counter = ir->operands[step->operands];
+    bool integer;
+
+    if (step->instr.opcode == F_ADD_IM_64 && step->instr.immediate == BITCAST(double, uint64_t, 1.0)) {
+        integer = false;
+    } else if (step->instr.opcode == I_ADD_64) {
+        IrValue one = ir->operands[step->operands + 1];
+        if (ir->nodes[one].kind != IR_CONSTANT || ir->nodes[one].instr.immediate != 1) {
+            one = counter;
+            counter = ir->operands[step->operands + 1];
+        }
+        if (ir->nodes[one].kind != IR_CONSTANT || ir->nodes[one].instr.immediate != 1) return false;
+        integer = true;
+    } else {
+        return false;
+    }
+
+    int32_t r = ir_lower_register(lower, counter);
+    if (r < 0 || ir_lower_register(lower, code[i]) != r) return false;
+
+    // loop is only written once everything lines up, the caller takes anything else in it for a fused instruction
+    DecodedInstruction counted = { .opcode = integer ? LOOP_I64 : LOOP_F64, .a = (RegisterIndex) r };
+    OpCode compare_opcode = compare->instr.opcode;
+
+    if (compare_opcode == (integer ? S_EQ_IM_64 : F_EQ_IM_64)) {
+        if (ir->operands[compare->operands] != code[i]) return false;
+        counted.opcode = integer ? LOOP_IM_I64 : LOOP_IM_F64;
+        counted.immediate = compare->instr.immediate;
+    } else if (compare_opcode == (integer ? S_EQ_64 : F_EQ_64)) {
+        IrValue x = ir->operands[compare->operands];
+        IrValue y = ir->operands[compare->operands + 1];
+        if ((x == code[i]) == (y == code[i])) return false;
+
+        IrValue limit = x == code[i] ? y : x;
+        if (ir->nodes[limit].kind == IR_CONSTANT) {
+            counted.opcode = integer ? LOOP_IM_I64 : LOOP_IM_F64;
+            counted.immediate = ir->nodes[limit].instr.immediate;
+        } else {
+            int32_t l = ir_lower_register(lower, limit);
+            if (l < 0) return false;
+            counted.b = (RegisterIndex) l;
+        }
+    } else {
+        return false;
+    }
+
+    ir_lower_moves(lower, block, code[i + 2], moves);
+    if (stbds_arrlenu(*moves) > 0 || !ir_lower_empty_arm(lower, branch->instr.a, moves)) return false;
+
+    IrBlock const* otherwise = ir->blocks + branch->instr.b;
+    if (stbds_arrlenu(otherwise->code) != 1) return false;
+
+    IrNode const* restart = ir->nodes + otherwise->code[0];
+    if (restart->instr.opcode != RE || restart->instr.a == 0) return false;
+
+    ir_lower_moves(lower, branch->instr.b, otherwise->code[0], moves);
+    if (stbds_arrlenu(*moves) > 0) return false;
+
+    counted.c = (uint8_t) (restart->instr.a - 1);
+    *loop = counted;
+    return true;
+}
+
+// colors the values of ir onto registers and writes the bytecode form into out; false when it does not fit in
+// register or block indices, or ir enters a block twice
+bool ir_lower(Function const* functions, IrFunction const* ir, DecodedFunction* out) {
+    IrLower lower = { .ir = ir };
+    memset(out, 0, sizeof(DecodedFunction));
+
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(ir->blocks);
+    size_t num_values = stbds_arrlenu(ir->nodes);
+    bool lowered = false;
+
+    if (!ir_links_build(ir, &lower.links)) goto done;
+
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        lower.block_start[b] = lower.num_positions;
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            stbds_arrpush(lower.position_value, ir->blocks[b].code[i]);
+            stbds_arrpush(lower.position_block, b);
+        }
+        lower.num_positions += (uint32_t) stbds_arrlenu(ir->blocks[b].code);
+
+        // every block has to end in an instruction that leaves it
+        if (stbds_arrlenu(ir->blocks[b].code) == 0) goto done;
+        if (!opcode_ends_block(ir->nodes[stbds_arrlast(ir->blocks[b].code)].instr.opcode)) goto done;
+    }
+    lower.block_start[num_blocks] = lower.num_positions;
+
+    lower.words = (uint32_t) ((num_values + 63) / 64);
+    stbds_arrsetlen(lower.live_in, (size_t) lower.num_positions * lower.words);
+    stbds_arrsetlen(lower.live_out, (size_t) lower.num_positions * lower.words);
+    stbds_arrsetlen(lower.interferes, num_values * lower.words);
+    stbds_arrsetlen(lower.members, num_values * lower.words);
+    memset(lower.live_in, 0, (size_t) lower.num_positions * lower.words * sizeof(uint64_t));
+    memset(lower.live_out, 0, (size_t) lower.num_positions * lower.words * sizeof(uint64_t));
+    memset(lower.interferes, 0, num_values * lower.words * sizeof(uint64_t));
+    memset(lower.members, 0, num_values * lower.words * sizeof(uint64_t));
+
+    ir_lower_liveness(&lower);
+    ir_lower_interference(&lower);
+
+    stbds_arrsetlen(lower.class, num_values);
+    stbds_arrsetlen(lower.color, num_values);
+    for (size_t v = 0; v < num_values; v++) {
+        lower.class[v] = (IrValue) v;
+        lower.color[v] = ir->nodes[v].kind == IR_ARG ? ir->nodes[v].index : -1;
+        IR_SET_ADD(IR_SET(&lower, lower.members, v), v);
+    }
+
+    // the arms of an IF_NZ or a SWITCH receive one set of copies, so their parameters have to share registers
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrNode const* node = ir->nodes + ir->blocks[b].code[i];
+            BlockIndex arms [MAX_TARGETS];
+            uint32_t num_arms = ir_targets(ir, &node->instr, arms);
+            if (num_arms < 2) continue;
+
+            IrBlock const* first = ir->blocks + arms[0];
+            for (uint32_t t = 1; t < num_arms; t++) {
+                IrBlock const* other = ir->blocks + arms[t];
+                if (stbds_arrlenu(first->params) != stbds_arrlenu(other->params)) goto done;
+                for (size_t p = 0; p < stbds_arrlenu(first->params); p++) {
+                    if (!ir_lower_coalesce(&lower, first->params[p], other->params[p])) goto done;
+                }
+            }
+        }
+    }
+
+    // then every argument with what it is passed to, and copies and selects with what they start from, wherever
+    // nothing overlaps
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrNode const* node = ir->nodes + ir->blocks[b].code[i];
+            IrValue const* targets = ir_transfer_targets(&lower, b, node);
+
+            if (node->instr.opcode == COPY_64) ir_lower_coalesce(&lower, ir->blocks[b].code[i], ir->operands[node->operands]);
+            if (node->instr.opcode == SELECT_64) ir_lower_coalesce(&lower, ir->blocks[b].code[i], ir->operands[node->operands + 2]);
+            if (targets == NULL) continue;
+
+            for (uint32_t o = node->num_sources; o < node->num_operands; o++) {
+                ir_lower_coalesce(&lower, targets[o - node->num_sources], ir->operands[node->operands + o]);
+            }
+        }
+    }
+
+    int32_t num_colors = ir->num_args;
+    for (size_t v = 0; v < num_values; v++) {
+        IrValue c = ir_lower_class(&lower, (IrValue) v);
+        if (!ir_needs_register(ir, (IrValue) v) || c != v || lower.color[c] >= 0) continue;
+
+        bool taken [MAX_REGISTERS + 1] = {};
+        uint64_t const* interferes = IR_SET(&lower, lower.interferes, c);
+        for (size_t u = 0; u < num_values; u++) {
+            if (!IR_SET_HAS(interferes, u)) continue;
+            int32_t color = lower.color[ir_lower_class(&lower, (IrValue) u)];
+            if (color >= 0) taken[color] = true;
+        }
+
+        int32_t color = 0;
+        while (color < MAX_REGISTERS && taken[color]) color++;
+        if (color == MAX_REGISTERS) goto done;
+
+        lower.color[c] = color;
+        if (color + 1 > num_colors) num_colors = color + 1;
+    }
+
+    // a scratch register for parallel copies that go round in a cycle, past the colored ones
+    stbds_arr(IrMove) moves = NULL;
+    bool scratch = false;
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            ir_lower_moves(&lower, b, ir->blocks[b].code[i], &moves);
+            ir_lower_sequence(&lower, NULL, NULL, moves, 0, &scratch);
+        }
+    }
+
+    // undefined values read register 0, so a function reading one has at least that
+    int32_t num_registers = num_colors + scratch;
+    if (num_registers == 0) num_registers = 1;
+    if (num_registers > MAX_REGISTERS) {
+        stbds_arrfree(moves);
+        goto done;
+    }
+
+    out->num_args = ir->num_args;
+    out->num_registers = (RegisterIndex) num_registers;
+
+    // a counted loop's step, comparison and IF_NZ become one LOOP_ instruction, IF_NZ with an arm that only leaves
+    // becomes WHEN_NZ, and the arms go
+    stbds_arr(uint32_t) uses = NULL;
+    stbds_arr(DecodedInstruction) fused = NULL;
+    stbds_arrsetlen(uses, num_values);
+    stbds_arrsetlen(fused, num_values);
+    memset(uses, 0, num_values * sizeof(uint32_t));
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrNode const* node = ir->nodes + ir->blocks[b].code[i];
+            for (uint32_t o = 0; o < node->num_operands; o++) uses[ir->operands[node->operands + o]]++;
+        }
+    }
+
+    BlockIndex renumber [MAX_BLOCKS];
+    bool dropped [MAX_BLOCKS] = {};
+    uint32_t num_kept = 0;
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrValue value = ir->blocks[b].code[i];
+            IrNode const* node = ir->nodes + value;
+            fused[value].opcode = IR_NOT_FUSED;
+
+            if (ir_lower_counted(&lower, b, i, uses, &moves, fused + value)) {
+                IrNode const* branch = ir->nodes + ir->blocks[b].code[i + 2];
+                dropped[branch->instr.a] = dropped[branch->instr.b] = true;
+                fused[ir->blocks[b].code[i + 1]].opcode = IR_FUSED_AWAY;
+                fused[ir->blocks[b].code[i + 2]].opcode = IR_FUSED_AWAY;
+                i += 2;
+                continue;
+            }
+
+            if (node->instr.opcode == IF_NZ && ir_lower_empty_arm(&lower, node->instr.b, &moves)) dropped[node->instr.b] = true;
+        }
+    }
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        if (!dropped[b]) renumber[b] = (BlockIndex) num_kept++;
+    }
+    // empty until lowered, since handing out a constant register counts the immediates of the blocks lowered so far
+    stbds_arrsetlen(out->blocks, num_kept);
+    memset(out->blocks, 0, num_kept * sizeof(stbds_arr(DecodedInstruction)));
+
+    // conditional transfers with copies to make go through a block of their own, appended as they come up
+    uint32_t num_out_blocks = num_kept;
+    stbds_arr(stbds_arr(DecodedInstruction)) detours = NULL;
+
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        if (dropped[b]) continue;
+        stbds_arr(DecodedInstruction) code = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(ir->blocks[b].code); i++) {
+            IrValue value = ir->blocks[b].code[i];
+            IrNode const* node = ir->nodes + value;
+            DecodedInstruction instr = node->instr;
+
+            if (fused[value].opcode == IR_FUSED_AWAY) continue;
+            if (fused[value].opcode != IR_NOT_FUSED) {
+                stbds_arrpush(code, fused[value]);
+                continue;
+            }
+
+            if (instr.opcode == CALL_V || instr.opcode == TAIL_CALL_V) {
+                instr.args = (uint32_t) stbds_arrlenu(out->args);
+                for (uint32_t s = 0; s < node->num_sources; s++) stbds_arrpush(out->args, 0);
+            }
+
+            RegisterIndex* registers [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, out, &instr, registers);
+            for (uint32_t s = 0; s < num_sources && s < node->num_sources; s++) {
+                IrValue source = ir->operands[node->operands + s];
+                int32_t r = ir_lower_register(&lower, source);
+
+                if (r >= 0) {
+                    *registers[s] = (RegisterIndex) r;
+                } else if (ir->nodes[source].kind == IR_CONSTANT) {
+                    if (!optimize_constant_register(out, ir->nodes[source].instr.immediate, registers[s])) goto overflow;
+                } else {
+                    *registers[s] = 0;
+                }
+            }
+
+            // what a SELECT_64 keeps goes into its destination first, unless coalescing put it there
+            RegisterIndex kept = instr.c;
+
+            bool whole;
+            RegisterIndex* destination = decoded_destination_operand(&instr, &whole);
+            if (destination != NULL) *destination = (RegisterIndex) ir_lower_register(&lower, value);
+
+            if (instr.opcode == SELECT_64 && kept != instr.c && ir->nodes[ir->operands[node->operands + 2]].kind != IR_UNDEF) {
+                stbds_arrpush(code, ((DecodedInstruction) { .opcode = COPY_64, .a = kept, .b = instr.c }));
+            }
+
+            ir_lower_moves(&lower, b, value, &moves);
+            bool conditional = instr.opcode == BR_NZ || instr.opcode == RE_NZ;
+
+            if (conditional && stbds_arrlenu(moves) > 0) {
+                if (num_out_blocks == MAX_BLOCKS) goto overflow;
+
+                stbds_arr(DecodedInstruction) detour = NULL;
+                if (!ir_lower_sequence(&lower, out, &detour, moves, (RegisterIndex) num_colors, NULL)) {
+                    stbds_arrfree(detour);
+                    goto overflow;
+                }
+                stbds_arrpush(detour, ((DecodedInstruction) { .opcode = instr.opcode == BR_NZ ? BR : RE, .a = (uint8_t) (instr.a + 1) }));
+                stbds_arrpush(detours, detour);
+
+                stbds_arrpush(code, ((DecodedInstruction) { .opcode = WHEN_NZ, .a = (BlockIndex) num_out_blocks++, .b = instr.b }));
+                continue;
+            }
+
+            if (!ir_lower_sequence(&lower, out, &code, moves, (RegisterIndex) num_colors, NULL)) goto overflow;
+
+            if (instr.opcode == BLOCK) instr.a = renumber[instr.a];
+            if (instr.opcode == SWITCH) {
+                uint32_t table = (uint32_t) stbds_arrlenu(out->tables);
+                for (uint32_t t = 0; t <= instr.b; t++) stbds_arrpush(out->tables, renumber[ir->tables[instr.args + t]]);
+                instr.args = table;
+            }
+            if (instr.opcode == IF_NZ) {
+                if (dropped[instr.b]) {
+                    instr = (DecodedInstruction) { .opcode = WHEN_NZ, .a = renumber[instr.a], .b = instr.c };
+                } else {
+                    instr.a = renumber[instr.a];
+                    instr.b = renumber[instr.b];
+                }
+            }
+
+            stbds_arrpush(code, instr);
+        }
+
+        out->blocks[renumber[b]] = code;
+    }
+
+    for (size_t d = 0; d < stbds_arrlenu(detours); d++) stbds_arrpush(out->blocks, detours[d]);
+    stbds_arrfree(detours);
+    detours = NULL;
+
+    lowered = (uint32_t) out->num_registers + decoded_pool_size(out, NULL) <= MAX_REGISTERS;
+
+overflow:
+    for (size_t d = 0; d < stbds_arrlenu(detours); d++) stbds_arrfree(detours[d]);
+    stbds_arrfree(detours);
+    stbds_arrfree(moves);
+    stbds_arrfree(uses);
+    stbds_arrfree(fused);
+
+done:
+    ir_lower_free(&lower);
+    if (!lowered) decoded_function_free(out);
+    return lowered;
+}
+
+void ir_print_value(FILE* out, IrFunction const* ir, IrValue value) {
+    IrNode const* node = ir->nodes + value;
+
+    switch (node->kind) {
+        case IR_CONSTANT: fprintf(out, "%g", BITCAST(uint64_t, double, node->instr.immediate)); break;
+        case IR_UNDEF: fprintf(out, "undef"); break;
+        default: fprintf(out, "v%u", value); break;
+    }
+}
+
+void ir_print_list(FILE* out, IrFunction const* ir, IrValue const* values, uint32_t num_values) {
+    fprintf(out, "(");
+    for (uint32_t i = 0; i < num_values; i++) {
+        if (i > 0) fprintf(out, ", ");
+        ir_print_value(out, ir, values[i]);
+    }
+    fprintf(out, ")");
+}
+
+void ir_print(FILE* out, IrFunction const* ir) {
+    for (size_t b = 0; b < stbds_arrlenu(ir->blocks); b++) {
+        IrBlock const* block = ir->blocks + b;
+        fprintf(out, "b%zu ", b);
+        ir_print_list(out, ir, block->params, (uint32_t) stbds_arrlenu(block->params));
+        fprintf(out, ":\n");
+
+        for (size_t i = 0; i < stbds_arrlenu(block->code); i++) {
+            IrValue value = block->code[i];
+            IrNode const* node = ir->nodes + value;
+            DecodedInstruction const* instr = &node->instr;
+
+            fprintf(out, "\t");
+            if (ir_defines_value(node)) fprintf(out, "v%u = ", value);
+            fprintf(out, "%s", opcode_name(instr->opcode));
+
+            switch (instr->opcode) {
+                case BLOCK: fprintf(out, " b%d", instr->a); break;
+                case IF_NZ: fprintf(out, " b%d b%d", instr->a, instr->b); break;
+                case SWITCH:
+                    for (uint32_t t = 1; t <= instr->b; t++) fprintf(out, " b%d", ir->tables[instr->args + t]);
+                    fprintf(out, " else b%d", ir->tables[instr->args]);
+                    break;
+                case BR: case BR_NZ: case RE: case RE_NZ: fprintf(out, " %d", instr->a); break;
+                case READ_GLOBAL_32: case READ_GLOBAL_64: case LOAD_GLOBAL_64: case STORE_GLOBAL_64: fprintf(out, " g%d", instr->w); break;
+                case CALL_V: case TAIL_CALL_V: fprintf(out, " f%d", instr->w); break;
+                default: break;
+            }
+
+            if (instr->opcode == S_EQ_IM_64) {
+                fprintf(out, " %" PRId64, (int64_t) instr->immediate);
+            } else if (opcode_has_immediate(instr->opcode)) {
+                fprintf(out, " %g", opcode_has_immediate_32(instr->opcode)
+                    ? BITCAST(uint32_t, float, (uint32_t) instr->immediate)
+                    : BITCAST(uint64_t, double, instr->immediate));
+            }
+
+            for (uint32_t s = 0; s < node->num_sources; s++) {
+                fprintf(out, " ");
+                ir_print_value(out, ir, ir->operands[node->operands + s]);
+            }
+
+            if (node->num_operands > node->num_sources || instr->opcode == BLOCK || instr->opcode == IF_NZ || instr->opcode == SWITCH) {
+                fprintf(out, " ");
+                ir_print_list(out, ir, ir->operands + node->operands + node->num_sources, node->num_operands - node->num_sources);
+            }
+
+            if (node->num_results > 0) {
+                fprintf(out, " -> ");
+                ir_print_list(out, ir, ir->operands + node->results, node->num_results);
+            }
+
+            fprintf(out, "\n");
+        }
+    }
+}
+
+// lifts, simplifies and lowers one function of a verified program, replacing its bytecode; false, leaving it as it
+// was, when either end does not fit
+bool ir_round_trip(Function* functions, FunctionIndex index, FILE* listing) {
+    IrFunction ir;
+    if (!ir_lift(functions, index, &ir)) return false;
+
+    ir_simplify(&ir);
+    if (listing != NULL) {
+        fprintf(listing, "f%d:\n", index);
+        ir_print(listing, &ir);
+    }
+
+    DecodedFunction lowered;
+    bool fits = ir_lower(functions, &ir, &lowered);
+    ir_function_free(&ir);
+    if (!fits) return false;
+
+    Bytecode* bytecode = &functions[index].bytecode;
+    stbds_arrfree(bytecode->blocks);
+    stbds_arrfree(bytecode->instructions);
+    stbds_arrfree(bytecode->constants);
+    *bytecode = encode_decoded_function(functions, &lowered);
+    functions[index].num_registers = lowered.num_registers;
+
+    decoded_function_free(&lowered);
+    return true;
+}
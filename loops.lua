@@ -0,0 +1,19 @@
+function nested_loops(outer, inner)
+    local acc = 0.0
+    local i = 0.0
+    while i ~= outer do
+        local j = 0.0
+        while j ~= inner do
+            acc = acc + 1.0
+            j = j + 1.0
+        end
+        i = i + 1.0
+    end
+    return acc
+end
+
+local start = os.clock()
+local result = nested_loops(1000.0, 5000.0)
+local stop = os.clock()
+
+print(result, "(in ", stop - start, "s)")
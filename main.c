@@ -6,16 +6,43 @@
 #include <inttypes.h>
 #include <time.h>
 #include <stdalign.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+#endif
 
 #include "stb_ds.h"
 #include "stb_ds.c"
 
 #define DEBUG_TRACE 0
 
+// 1 builds everything around 32-bit instruction words: immediates move out of the instruction stream into a constant
+// pool per function, which roughly halves code size. bytecode and modules are not portable between the two widths
+#ifndef PACKED_INSTRUCTIONS
+    #define PACKED_INSTRUCTIONS 0
+#endif
+
+#define MAX_CONSTANTS (UINT8_MAX + 1)
+
 #define MAX_REGISTERS UINT8_MAX
 #define MAX_BLOCKS UINT8_MAX
-#define MAX_CALL_FRAMES 4096
 #define STACK_SIZE (1024 * 1024)
+#define MEMO_MAX_ARGS 4
+#define MEMO_DEFAULT_CAPACITY (1 << 16)
+#define PROFILE_IDLE ((OpCode) 0xFF)
+#define SAMPLE_MAX_DEPTH 128
+#define SAMPLE_DEFAULT_CAPACITY (1 << 16)
+#define SAMPLE_DEFAULT_FREQUENCY 997
+#define CALL_EVENT_CAPACITY (1 << 14)
+#define CALL_GRAPH_ROOT UINT16_MAX
 
 #define BITCAST(A, B, v) ((union { A a; B b;}){.a = v}).b
 
@@ -23,20 +50,49 @@
 #define I_ENCODE_1(op, a)         (I_ENCODE_0(op) | (((Instruction) (a)) << 24))
 #define I_ENCODE_2(op, a, b)      (I_ENCODE_1(op, a) | (((Instruction) (b)) << 16))
 #define I_ENCODE_3(op, a, b, c)   (I_ENCODE_2(op, a, b) | (((Instruction) (c)) <<  8))
-#define I_ENCODE_W0(op, w)        (I_ENCODE_0(op) | (((Instruction) (w)) << 24))
-#define I_ENCODE_W1(op, w, a)     (I_ENCODE_W0(op, w) | (((Instruction) (a)) <<  8))
-#define I_ENCODE_IM32(T, op, imm) ((BITCAST(T, Instruction, imm) << 32) | (op))
 
 #define I_DECODE_OPCODE(op)       ((OpCode) ((op) & 0xFF))
 #define I_DECODE_A(op)            ((uint8_t)   (((op) >> 24) & 0xFF))
 #define I_DECODE_B(op)            ((uint8_t)   (((op) >> 16) & 0xFF))
 #define I_DECODE_C(op)            ((uint8_t)   (((op) >>  8) & 0xFF))
-#define I_DECODE_W0(op)           ((uint16_t)  (((op) >> 24) & 0xFFFF))
 #define I_DECODE_W1(op)           ((uint8_t)   (((op) >>  8) & 0xFF))
-#define I_DECODE_IM32(T, op)      BITCAST(Instruction, T, ((op) >> 32) & 0xFFFFFFFF)
+#define I_DECODE_W2(op)           ((uint8_t)   (((op) >> 16) & 0xFF))
+
+// I_IMMEDIATE_* read an instruction's immediate; next is the expression that consumes the trailing word of a 64-bit
+// immediate and is only evaluated by the wide encoding
+#if PACKED_INSTRUCTIONS
+    // W0 fills the upper half of the word, so the W2 form keeps only 8 bits of it, in A
+    #define I_ENCODE_W0(op, w)        (I_ENCODE_0(op) | (((Instruction) (w)) << 16))
+    #define I_ENCODE_W1(op, w, a)     (I_ENCODE_W0(op, w) | (((Instruction) (a)) <<  8))
+    #define I_ENCODE_W2(op, w, a, b)  (I_ENCODE_3(op, w, b, a))
+    #define I_ENCODE_K(op, k)         ((op) | (((Instruction) (k)) << 8))
+
+    #define I_DECODE_W0(op)           ((uint16_t)  (((op) >> 16) & 0xFFFF))
+    #define I_DECODE_W2_W0(op)        I_DECODE_A(op)
+    #define I_DECODE_K(op)            I_DECODE_C(op)
+
+    #define I_IMMEDIATE_32(T, op, constants, next) BITCAST(uint32_t, T, (uint32_t) (constants)[I_DECODE_K(op)])
+    #define I_IMMEDIATE_64(T, op, constants, next) BITCAST(uint64_t, T, (constants)[I_DECODE_K(op)])
+    #define IM64_LENGTH 1
+#else
+    #define I_ENCODE_W0(op, w)        (I_ENCODE_0(op) | (((Instruction) (w)) << 24))
+    #define I_ENCODE_W1(op, w, a)     (I_ENCODE_W0(op, w) | (((Instruction) (a)) <<  8))
+    #define I_ENCODE_W2(op, w, a, b)  (I_ENCODE_W1(op, w, a) | (((Instruction) (b)) << 16))
+    #define I_ENCODE_IM32(T, op, imm) ((BITCAST(T, Instruction, imm) << 32) | (op))
+
+    #define I_DECODE_W0(op)           ((uint16_t)  (((op) >> 24) & 0xFFFF))
+    #define I_DECODE_W2_W0(op)        I_DECODE_W0(op)
+    #define I_DECODE_IM32(T, op)      BITCAST(Instruction, T, ((op) >> 32) & 0xFFFFFFFF)
+
+    #define I_IMMEDIATE_32(T, op, constants, next) I_DECODE_IM32(T, op)
+    #define I_IMMEDIATE_64(T, op, constants, next) BITCAST(Instruction, T, (next))
+    #define IM64_LENGTH 2
+#endif
 
 #define ALIGNMENT_DELTA(base_address, alignment) (((alignment) - ((base_address) % (alignment))) % (alignment))
 #define CALC_ARG_SIZE(num_args) (((num_args) + ALIGNMENT_DELTA((num_args), alignof(Instruction))) / alignof(Instruction))
+// a SWITCH over num_cases cases is followed by its default block and one block per case
+#define CALC_SWITCH_SIZE(num_cases) CALC_ARG_SIZE((num_cases) + 1)
 
 #ifndef __INTELLISENSE__ // intellisense can't handle the backing type attribute
     #define ENUM_T(T) enum : T
@@ -50,7 +106,11 @@
     #define debug(fmt, ...)
 #endif
 
-typedef uint64_t Instruction;
+#if PACKED_INSTRUCTIONS
+    typedef uint32_t Instruction;
+#else
+    typedef uint64_t Instruction;
+#endif
 typedef uint16_t FunctionIndex;
 typedef uint16_t GlobalIndex;
 typedef uint8_t RegisterIndex;
@@ -65,16 +125,25 @@ typedef uint32_t StackPtr;
 typedef ENUM_T(uint8_t) {
     HALT,
     UNREACHABLE,
+    LAZY_LINK,
     READ_GLOBAL_32,
     READ_GLOBAL_64,
+    LOAD_GLOBAL_64,
+    STORE_GLOBAL_64,
     COPY_IM_64,
+    COPY_64,
     IF_NZ,
     WHEN_NZ,
+    SWITCH,
     BLOCK,
     BR,
     BR_NZ,
     RE,
     RE_NZ,
+    LOOP_F64,
+    LOOP_IM_F64,
+    LOOP_I64,
+    LOOP_IM_I64,
     F_ADD_32,
     F_ADD_IM_32,
     F_SUB_32,
@@ -85,6 +154,9 @@ typedef ENUM_T(uint8_t) {
     F_SUB_64,
     F_SUB_IM_A_64,
     F_SUB_IM_B_64,
+    F_MUL_64,
+    F_DIV_64,
+    F_SQRT_64,
     I_ADD_64,
     I_SUB_64,
     F_EQ_32,
@@ -100,793 +172,526 @@ typedef ENUM_T(uint8_t) {
     S_EQ_64,
     S_EQ_IM_64,
     S_LT_64,
+    SELECT_64,
+    SELECT_F_LT_64,
+    SELECT_S_LT_64,
     CALL_V,
     TAIL_CALL_V,
     RET_V,
 } OpCode;
 
+typedef ENUM_T(uint8_t) {
+    CALL_EVENT_ENTER,
+    CALL_EVENT_TAIL,
+    CALL_EVENT_EXIT,
+} CallEventKind;
+
 typedef ENUM_T(uint8_t) {
     OKAY,
     TRAP_UNREACHABLE,
-    TRAP_CALL_OVERFLOW,
     TRAP_STACK_OVERFLOW,
+    TRAP_LINK_FAILED,
 } Trap;
 
 typedef struct {
     InstructionPointer const* blocks;
     Instruction const* instructions;
+    BlockIndex num_blocks;
+    InstructionPointer num_instructions;
+    // deduplicated constant pool, whose first num_register_constants entries are read as the registers after the
+    // function's own: constant k is register num_registers + k. a packed build also keeps the immediates of _IM_
+    // instructions here, behind those, where no call has to copy them
+    uint64_t const* constants;
+    uint32_t num_constants;
+    uint32_t num_register_constants;
 } Bytecode;
 
+typedef struct {
+    uint64_t args [MEMO_MAX_ARGS];
+    uint64_t result;
+} MemoEntry;
+
+typedef struct {
+    stbds_hm(uint64_t, MemoEntry) entries;
+    size_t capacity;
+    size_t evict_cursor;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} MemoTable;
+
 typedef struct {
     RegisterIndex num_args;
     RegisterIndex num_registers;
     Bytecode bytecode;
+    MemoTable* memo;
 } Function;
 
 typedef struct {
     Function const* functions;
     uint8_t* const* globals;
+    GlobalIndex num_globals;
+    FunctionIndex num_functions;
+    // installs the body of a function whose bytecode is still a LAZY_LINK stub; NULL when every function is resident
+    bool (*link) (void* context, FunctionIndex index);
+    void* link_context;
 } Program;
 
+// calls and blocks share one stack of words. a call's record is followed by its register window and then its root
+// block frame, and the blocks the function enters continue from there, so a call writes one contiguous run and the
+// next call's record starts right after the innermost block. instruction offsets are relative to the function's
+// instructions, the caller offset is in words from the fiber's stack base
 typedef struct {
-    Instruction const* start_pointer;
-    Instruction const* instruction_pointer;
-    RegisterIndex out_index;
+    InstructionPointer start_pointer;
+    InstructionPointer instruction_pointer;
 } BlockFrame;
 
 typedef struct {
     Function const* function;
-    BlockFrame* root_block;
-    uint64_t* stack_base;
+    StackPtr caller;
+    RegisterIndex out_index;
 } CallFrame;
 
-typedef struct {
-    Program const* program;
-    CallFrame* call_stack;
-    CallFrame* call_stack_max;
-    uint64_t* data_stack;
-    uint64_t* data_stack_max;
-    BlockFrame* block_stack;
-} Fiber;
-
-Trap eval(Fiber *restrict fiber) {
-    debug("eval");
-
-    CallFrame* current_call_frame;
-    Function const* current_function;
-    BlockFrame* current_block_frame;
-
-    uint64_t register_scratch_space [MAX_REGISTERS];
-
-    #define SET_CONTEXT() {                              \
-        debug("SET_CONTEXT");                      \
-        current_call_frame = fiber->call_stack;          \
-        current_function = current_call_frame->function; \
-        current_block_frame = fiber->block_stack;        \
-    }                                                    \
-
-    SET_CONTEXT();
-
-    Instruction last_instruction;
-
-    #define DECODE_NEXT()                                                \
-        last_instruction = *(current_block_frame->instruction_pointer++) \
-    
-    #define DECODE_A()  I_DECODE_A(last_instruction)
-    #define DECODE_B()  I_DECODE_B(last_instruction)
-    #define DECODE_C()  I_DECODE_C(last_instruction)
-    #define DECODE_W0() I_DECODE_W0(last_instruction)
-    #define DECODE_W1() I_DECODE_W1(last_instruction)
-    #define DECODE_IM64(T) BITCAST(Instruction, T, *(current_block_frame->instruction_pointer++))
-
-    static void* DISPATCH_TABLE [] = {
-        &&DO_HALT,
-        &&DO_UNREACHABLE,
-        &&DO_READ_GLOBAL_32,
-        &&DO_READ_GLOBAL_64,
-        &&DO_COPY_IM_64,
-        &&DO_IF_NZ,
-        &&DO_WHEN_NZ,
-        &&DO_BLOCK,
-        &&DO_BR,
-        &&DO_BR_NZ,
-        &&DO_RE,
-        &&DO_RE_NZ,
-        &&DO_F_ADD_32,
-        &&DO_F_ADD_IM_32,
-        &&DO_F_SUB_32,
-        &&DO_F_SUB_IM_A_32,
-        &&DO_F_SUB_IM_B_32,
-        &&DO_F_ADD_64,
-        &&DO_F_ADD_IM_64,
-        &&DO_F_SUB_64,
-        &&DO_F_SUB_IM_A_64,
-        &&DO_F_SUB_IM_B_64,
-        &&DO_I_ADD_64,
-        &&DO_I_SUB_64,
-        &&DO_F_EQ_32,
-        &&DO_F_EQ_IM_32,
-        &&DO_F_LT_32,
-        &&DO_F_LT_IM_A_32,
-        &&DO_F_LT_IM_B_32,
-        &&DO_F_EQ_64,
-        &&DO_F_EQ_IM_64,
-        &&DO_F_LT_64,
-        &&DO_F_LT_IM_A_64,
-        &&DO_F_LT_IM_B_64,
-        &&DO_S_EQ_64,
-        &&DO_S_EQ_IM_64,
-        &&DO_S_LT_64,
-        &&DO_CALL_V,
-        &&DO_TAIL_CALL_V,
-        &&DO_RET_V,
-    };
-
-    #define DISPATCH() {                                 \
-        DECODE_NEXT();                                   \
-        OpCode next = I_DECODE_OPCODE(last_instruction); \
-        debug("DISPATCH %d", next);                      \
-        goto *DISPATCH_TABLE[next];                      \
-    }                                                    \
-    
-    DISPATCH();
-
-    DO_HALT: {
-        debug("HALT");
-        return OKAY;
-    };
-
-    DO_UNREACHABLE: {
-        debug("UNREACHABLE");
-        return TRAP_UNREACHABLE;
-    };
-
-    DO_READ_GLOBAL_32: {
-        debug("READ_GLOBAL_32");
-
-        GlobalIndex index = DECODE_W0();
-        RegisterIndex destination = DECODE_W1();
-
-        *(current_call_frame->stack_base + destination) =
-            *((uint32_t*) fiber->program->globals[index]);
-        
-        DISPATCH();
-    };
-
-    DO_READ_GLOBAL_64: {
-        debug("READ_GLOBAL_64");
-
-        GlobalIndex index = DECODE_W0();
-        RegisterIndex destination = DECODE_W1();
-
-        *(current_call_frame->stack_base + destination) =
-            *((uint64_t*) fiber->program->globals[index]);
-        
-        DISPATCH();
-    };
-
-    DO_COPY_IM_64: {
-        debug("COPY_IM_64");
-
-        uint64_t imm = DECODE_IM64(uint64_t);
-        RegisterIndex destination = DECODE_A();
-
-        *(current_call_frame->stack_base + destination) = imm;
-
-        DISPATCH();
-    };
-
-    DO_IF_NZ: {
-        debug("IF_NZ");
-
-        BlockIndex then_index = DECODE_A();
-        BlockIndex else_index = DECODE_B();
-        RegisterIndex condition = DECODE_C();
-
-        BlockIndex new_block_index;
-        if (*((uint8_t*) (current_call_frame->stack_base + condition)) != 0) {
-            new_block_index = then_index;
-        } else {
-            new_block_index = else_index;
-        }
-
-        InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
-        Instruction const* start = current_function->bytecode.instructions + new_block;
-
-        BlockFrame new_block_frame = {start, start, 0};
-        *(++fiber->block_stack) = new_block_frame;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
-
-    DO_WHEN_NZ: {
-        debug("WHEN_NZ");
-
-        BlockIndex new_block_index = DECODE_A();
-        RegisterIndex condition = DECODE_B();
-
-        if (*((uint8_t*) (current_call_frame->stack_base + condition)) != 0) {
-            InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
-
-            Instruction const* start = current_function->bytecode.instructions + new_block;
-
-            BlockFrame new_block_frame = {start, start, 0};
-            *(++fiber->block_stack) = new_block_frame;
-
-            SET_CONTEXT();
-        }
-
-        DISPATCH();
-    };
-
-    DO_BLOCK: {
-        debug("BLOCK");
-
-        BlockIndex new_block_index = DECODE_A();
-        InstructionPointer new_block = current_function->bytecode.blocks[new_block_index];
-        Instruction const* start = current_function->bytecode.instructions + new_block;
-
-        BlockFrame new_block_frame = {start, start, 0};
-        *(++fiber->block_stack) = new_block_frame;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
-
-    DO_BR: {
-        debug("BR");
-
-        BlockIndex relative_block_index = DECODE_A();
-
-        fiber->block_stack -= relative_block_index + 1;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
-
-    DO_BR_NZ: {
-        debug("BR_NZ");
-
-        BlockIndex relative_block_index = DECODE_A();
-        RegisterIndex condition = DECODE_B();
-
-        if (*((uint8_t*) (current_call_frame->stack_base + condition)) != 0) {
-            fiber->block_stack -= relative_block_index + 1;
-
-            SET_CONTEXT();
-        }
-
-        DISPATCH();
-    };
-
-    DO_RE: {
-        debug("RE");
-
-        BlockIndex relative_block_index = DECODE_A();
-
-        BlockFrame* frame = fiber->block_stack - relative_block_index;
-        frame->instruction_pointer = frame->start_pointer;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
-
-    DO_RE_NZ: {
-        debug("RE_NZ");
-
-        BlockIndex relative_block_index = DECODE_A();
-        RegisterIndex condition = DECODE_B();
-
-        if (*((uint8_t*) (current_call_frame->stack_base + condition)) != 0) {
-            BlockFrame* frame = fiber->block_stack - relative_block_index;
-            frame->instruction_pointer = frame->start_pointer;
-
-            SET_CONTEXT();
-        }
-
-        DISPATCH();
-    };
-
-    DO_F_ADD_32: {
-        debug("F_ADD_32");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *((float*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) +
-            *((float*) (current_call_frame->stack_base + y));
-
-        DISPATCH();
-    };
-
-    DO_F_ADD_IM_32: {
-        debug("F_ADD_IM_32");
-
-        float x = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
-
-        *((float*) (current_call_frame->stack_base + z)) =
-            x + *((float*) (current_call_frame->stack_base + y));
-
-        DISPATCH();
-    };
-
-    DO_F_SUB_32: {
-        debug("F_SUB_32");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *((float*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) -
-            *((float*) (current_call_frame->stack_base + y));
-        
-        DISPATCH();
-    };
-
-    DO_F_SUB_IM_A_32: {
-        debug("F_SUB_IM_A_32");
-
-        float x = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
-
-        *((float*) (current_call_frame->stack_base + z)) =
-            x - *((float*) (current_call_frame->stack_base + y));
-        
-        DISPATCH();
-    };
-
-    DO_F_SUB_IM_B_32: {
-        debug("F_SUB_IM_B_32");
-
-        RegisterIndex x = DECODE_A();
-        float y = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex z = DECODE_B();
-
-        *((float*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) - y;
-        
-        DISPATCH();
-    };
-
-    DO_F_ADD_64: {
-        debug("F_ADD_64");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-        
-        *((double*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) +
-            *((double*) (current_call_frame->stack_base + y));
-            
-        DISPATCH();
-    };
-
-    DO_F_ADD_IM_64: {
-        debug("F_ADD_IM_64");
-
-        double x = DECODE_IM64(double);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
-
-        *((double*) (current_call_frame->stack_base + z)) =
-            x + *((double*) (current_call_frame->stack_base + y));
-        
-        DISPATCH();
-    };
-
-    DO_F_SUB_64: {
-        debug("F_SUB_64");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *((double*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) -
-            *((double*) (current_call_frame->stack_base + y));
-        
-        DISPATCH();
-    };
-
-    DO_F_SUB_IM_A_64: {
-        debug("F_SUB_IM_A_64");
+#define FRAME_NONE UINT32_MAX
+#define FRAME_HEADER_WORDS (sizeof(CallFrame) / sizeof(uint64_t))
+#define FRAME_REGISTERS(frame) ((uint64_t*) ((frame) + 1))
+// register words of a function's frame: its own registers, then its register constants copied in on entry
+#define FRAME_SLOTS(function) ((uint32_t) (function)->num_registers + (function)->bytecode.num_register_constants)
 
-        double x = DECODE_IM64(double);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
-
-        *((double*) (current_call_frame->stack_base + z)) =
-            x - *((double*) (current_call_frame->stack_base + y));
-        
-        DISPATCH();
-    };
-
-    DO_F_SUB_IM_B_64: {
-        debug("F_SUB_IM_B_64");
-
-        RegisterIndex x = DECODE_A();
-        double y = DECODE_IM64(double);
-        RegisterIndex z = DECODE_B();
-
-        *((double*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) - y;
-
-        DISPATCH();
-    };
-
-    DO_I_ADD_64: {
-        debug("I_ADD_64");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *(current_call_frame->stack_base + z) =
-            *(current_call_frame->stack_base + x) +
-            *(current_call_frame->stack_base + y);
-
-        DISPATCH();
-    };
-
-    DO_I_SUB_64: {
-        debug("I_SUB_64");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *(current_call_frame->stack_base + z) =
-            *(current_call_frame->stack_base + x) -
-            *(current_call_frame->stack_base + y);
-        
-        DISPATCH();
-    };
-
-    DO_F_EQ_32: {
-        debug("F_EQ_32");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) ==
-            *((float*) (current_call_frame->stack_base + y));
-
-        DISPATCH();
-    };
-
-    DO_F_EQ_IM_32: {
-        debug("F_EQ_IM_32");
-
-        float x = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
-
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            x == *((float*) (current_call_frame->stack_base + y));
-
-        DISPATCH();
-    };
-
-    DO_F_LT_32: {
-        debug("F_LT_32");
-
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
-
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) <
-            *((float*) (current_call_frame->stack_base + y));
-
-        DISPATCH();
-    };
-
-    DO_F_LT_IM_A_32: {
-        debug("F_LT_IM_A_32");
+typedef struct {
+    CallFrame const* call_frame;
+    MemoTable* table;
+    uint64_t hash;
+    RegisterIndex num_args;
+    uint64_t args [MEMO_MAX_ARGS];
+} MemoFrame;
 
-        float x = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
+typedef struct {
+    uint64_t timestamp;
+    FunctionIndex function;
+    CallEventKind kind;
+} CallEvent;
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            x < *((float*) (current_call_frame->stack_base + y));
+// calls count entries through a call instruction; a tail call replaces an activation in place and is counted in
+// tail_calls instead, against the edge from the caller it returns to
+typedef struct {
+    uint64_t calls;
+    uint64_t tail_calls;
+    uint64_t inclusive;
+    uint64_t exclusive;
+    uint32_t active;
+} CallGraphNode;
 
-        DISPATCH();
-    };
+typedef struct {
+    uint64_t calls;
+    uint64_t tail_calls;
+    uint64_t inclusive;
+    uint32_t active;
+} CallGraphEdge;
 
-    DO_F_LT_IM_B_32: {
-        debug("F_LT_IM_B_32");
+typedef struct {
+    FunctionIndex function;
+    FunctionIndex caller;
+    uint64_t start;
+    uint64_t children;
+} CallGraphActivation;
 
-        RegisterIndex x = DECODE_A();
-        float y = I_DECODE_IM32(float, last_instruction);
-        RegisterIndex z = DECODE_B();
+typedef struct {
+    stbds_arr(CallGraphNode) nodes;
+    stbds_hm(uint32_t, CallGraphEdge) edges;
+    stbds_arr(CallGraphActivation) activations;
+} CallGraph;
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((float*) (current_call_frame->stack_base + x)) < y;
+typedef struct {
+    Program const* program;
+    uint64_t* stack_base;
+    uint64_t* stack_max;
+    CallFrame* call_frame; // innermost call, NULL while the fiber is idle
+    BlockFrame* block_stack; // innermost block frame, one below stack_base while the fiber is idle
+    stbds_arr(MemoFrame) memo_frames;
+    CallFrame const* memo_call_frame;
+    CallEvent* call_events;
+    uint32_t call_event_capacity;
+    uint32_t num_call_events;
+    CallGraph* call_graph;
+} Fiber;
 
-        DISPATCH();
-    };
+uint64_t memo_hash(uint64_t const* args, RegisterIndex num_args) {
+    uint64_t hash = 0x9E3779B97F4A7C15ull * (num_args + 1);
 
-    DO_F_EQ_64: {
-        debug("F_EQ_64");
+    for (RegisterIndex i = 0; i < num_args; i++) {
+        hash = (hash ^ args[i]) * 0xBF58476D1CE4E5B9ull;
+        hash ^= hash >> 31;
+    }
 
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
+    return hash;
+}
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) ==
-            *((double*) (current_call_frame->stack_base + y));
+bool memo_lookup(MemoTable* table, uint64_t hash, uint64_t const* args, RegisterIndex num_args, uint64_t* result) {
+    ptrdiff_t index = stbds_hmgeti(table->entries, hash);
 
-        DISPATCH();
-    };
+    if (index >= 0 && memcmp(table->entries[index].value.args, args, num_args * sizeof(uint64_t)) == 0) {
+        table->hits++;
+        *result = table->entries[index].value.result;
+        return true;
+    }
 
-    DO_F_EQ_IM_64: {
-        debug("F_EQ_IM_64");
+    table->misses++;
+    return false;
+}
 
-        double x = DECODE_IM64(double);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
+void memo_insert(MemoTable* table, uint64_t hash, uint64_t const* args, RegisterIndex num_args, uint64_t result) {
+    size_t length = stbds_hmlenu(table->entries);
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            x == *((double*) (current_call_frame->stack_base + y));
+    // evict in insertion-ish order; stb_ds keeps entries dense so any index below the length is live
+    if (length >= table->capacity && stbds_hmgeti(table->entries, hash) < 0) {
+        uint64_t victim = table->entries[table->evict_cursor++ % length].key;
+        (void) stbds_hmdel(table->entries, victim);
+        table->evictions++;
+    }
 
-        DISPATCH();
-    };
+    MemoEntry entry = { .result = result };
+    memcpy(entry.args, args, num_args * sizeof(uint64_t));
 
-    DO_F_LT_64: {
-        debug("F_LT_64");
+    stbds_hmput(table->entries, hash, entry);
+}
 
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
+void memo_push_frame(Fiber *restrict fiber, CallFrame const* call_frame, MemoTable* table, uint64_t hash, uint64_t const* args, RegisterIndex num_args) {
+    MemoFrame frame = { call_frame, table, hash, num_args };
+    memcpy(frame.args, args, num_args * sizeof(uint64_t));
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) <
-            *((double*) (current_call_frame->stack_base + y));
+    stbds_arrpush(fiber->memo_frames, frame);
+    fiber->memo_call_frame = call_frame;
+}
 
-        DISPATCH();
-    };
+void memo_pop_frame(Fiber *restrict fiber, uint64_t result) {
+    MemoFrame frame = stbds_arrpop(fiber->memo_frames);
 
-    DO_F_LT_IM_A_64: {
-        debug("F_LT_IM_A_64");
+    memo_insert(frame.table, frame.hash, frame.args, frame.num_args, result);
 
-        double x = DECODE_IM64(double);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
+    fiber->memo_call_frame = stbds_arrlenu(fiber->memo_frames) > 0
+        ? stbds_arrlast(fiber->memo_frames).call_frame
+        : NULL;
+}
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            x < *((double*) (current_call_frame->stack_base + y));
+void memo_reset_frames(Fiber *restrict fiber) {
+    stbds_arrsetlen(fiber->memo_frames, 0);
+    fiber->memo_call_frame = NULL;
+}
 
-        DISPATCH();
-    };
+typedef Trap (*Evaluator) (Fiber *restrict fiber);
 
-    DO_F_LT_IM_B_64: {
-        debug("F_LT_IM_B_64");
+typedef struct {
+    uint64_t counts [256];
+    uint64_t cycles [256];
+    stbds_arr(uint64_t) function_instructions;
+} OpcodeProfile;
 
-        RegisterIndex x = DECODE_A();
-        double y = DECODE_IM64(double);
-        RegisterIndex z = DECODE_B();
+OpcodeProfile opcode_profile;
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *((double*) (current_call_frame->stack_base + x)) < y;
+#if defined(__x86_64__) || defined(__i386__)
+    #define profile_timestamp() __rdtsc()
+#else
+    uint64_t profile_timestamp() {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return ((uint64_t) now.tv_sec) * 1000000000ull + (uint64_t) now.tv_nsec;
+    }
+#endif
 
-        DISPATCH();
-    };
+void profile_reserve_functions(FunctionIndex num_functions) {
+    size_t old_length = stbds_arrlenu(opcode_profile.function_instructions);
+    if (old_length >= num_functions) return;
 
-    DO_S_EQ_64: {
-        debug("S_EQ_64");
+    stbds_arrsetlen(opcode_profile.function_instructions, num_functions);
+    memset(opcode_profile.function_instructions + old_length, 0, (num_functions - old_length) * sizeof(uint64_t));
+}
 
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
+void profile_reset() {
+    memset(opcode_profile.counts, 0, sizeof(opcode_profile.counts));
+    memset(opcode_profile.cycles, 0, sizeof(opcode_profile.cycles));
+    memset(opcode_profile.function_instructions, 0, stbds_arrlenu(opcode_profile.function_instructions) * sizeof(uint64_t));
+}
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *(current_call_frame->stack_base + x) ==
-            *(current_call_frame->stack_base + y);
+CallGraphEdge* call_graph_edge(CallGraph* graph, FunctionIndex caller, FunctionIndex callee) {
+    uint32_t key = (((uint32_t) caller) << 16) | callee;
 
-        DISPATCH();
-    };
+    ptrdiff_t index = stbds_hmgeti(graph->edges, key);
+    if (index < 0) {
+        stbds_hmput(graph->edges, key, (CallGraphEdge) {});
+        index = stbds_hmgeti(graph->edges, key);
+    }
 
-    DO_S_EQ_IM_64: {
-        debug("S_EQ_IM_64");
+    return &graph->edges[index].value;
+}
 
-        uint64_t x = DECODE_IM64(uint64_t);
-        RegisterIndex y = DECODE_A();
-        RegisterIndex z = DECODE_B();
+void call_graph_enter(CallGraph* graph, FunctionIndex function, FunctionIndex caller, uint64_t timestamp, bool tail) {
+    CallGraphActivation activation = { function, caller, timestamp, 0 };
+    stbds_arrpush(graph->activations, activation);
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            x == *(current_call_frame->stack_base + y);
+    CallGraphNode* node = graph->nodes + function;
+    if (tail) node->tail_calls++;
+    else node->calls++;
+    node->active++;
 
-        DISPATCH();
-    };
+    CallGraphEdge* edge = call_graph_edge(graph, caller, function);
+    if (tail) edge->tail_calls++;
+    else edge->calls++;
+    edge->active++;
+}
 
-    DO_S_LT_64: {
-        debug("S_LT_64");
+CallGraphActivation call_graph_leave(CallGraph* graph, uint64_t timestamp) {
+    CallGraphActivation activation = stbds_arrpop(graph->activations);
+    uint64_t elapsed = timestamp - activation.start;
 
-        RegisterIndex x = DECODE_A();
-        RegisterIndex y = DECODE_B();
-        RegisterIndex z = DECODE_C();
+    CallGraphNode* node = graph->nodes + activation.function;
+    node->exclusive += elapsed - activation.children;
 
-        *((uint8_t*) (current_call_frame->stack_base + z)) =
-            *(current_call_frame->stack_base + x) <
-            *(current_call_frame->stack_base + y);
+    // only the outermost activation of a recursive function, or of a recursive edge, contributes inclusive time
+    if (--node->active == 0) node->inclusive += elapsed;
 
-        DISPATCH();
-    };
+    CallGraphEdge* edge = call_graph_edge(graph, activation.caller, activation.function);
+    if (--edge->active == 0) edge->inclusive += elapsed;
 
-    DO_CALL_V: {
-        debug("CALL_V");
+    if (stbds_arrlenu(graph->activations) > 0) {
+        stbds_arrlast(graph->activations).children += elapsed;
+    }
 
-        FunctionIndex functionIndex = DECODE_W0();
-        RegisterIndex out = DECODE_W1();
+    return activation;
+}
 
-        Function const* new_function = fiber->program->functions + functionIndex;
+// folds the fiber's pending call events into its call graph; called by the call profiling eval when the
+// event buffer fills up and when eval exits. abandoning drops activations left open by a trap
+void call_graph_drain(Fiber *restrict fiber, bool abandon) {
+    CallGraph* graph = fiber->call_graph;
 
-        debug("\t%d %d %d", functionIndex, out, new_function->num_args);
+    size_t old_length = stbds_arrlenu(graph->nodes);
+    if (old_length < fiber->program->num_functions) {
+        stbds_arrsetlen(graph->nodes, fiber->program->num_functions);
+        memset(graph->nodes + old_length, 0, (fiber->program->num_functions - old_length) * sizeof(CallGraphNode));
+    }
 
-        if ( fiber->call_stack + 1 >= fiber->call_stack_max
-           | fiber->data_stack + new_function->num_registers >= fiber->data_stack_max
-           ) {
-            if (fiber->call_stack + 1 >= fiber->call_stack_max) return TRAP_CALL_OVERFLOW;
-            else return TRAP_STACK_OVERFLOW;
+    for (uint32_t i = 0; i < fiber->num_call_events; i++) {
+        CallEvent const* event = fiber->call_events + i;
+
+        switch (event->kind) {
+            case CALL_EVENT_ENTER: {
+                FunctionIndex caller = stbds_arrlenu(graph->activations) > 0
+                    ? stbds_arrlast(graph->activations).function
+                    : CALL_GRAPH_ROOT;
+                call_graph_enter(graph, event->function, caller, event->timestamp, false);
+            } break;
+
+            case CALL_EVENT_TAIL: {
+                if (stbds_arrlenu(graph->activations) == 0) break;
+                CallGraphActivation replaced = call_graph_leave(graph, event->timestamp);
+                call_graph_enter(graph, event->function, replaced.caller, event->timestamp, true);
+            } break;
+
+            case CALL_EVENT_EXIT: {
+                if (stbds_arrlenu(graph->activations) == 0) break;
+                call_graph_leave(graph, event->timestamp);
+            } break;
         }
-        
-        uint64_t* new_stack_base = fiber->data_stack;
+    }
 
-        RegisterIndex const* args = (RegisterIndex const*) (current_block_frame->instruction_pointer);
-        current_block_frame->instruction_pointer += CALC_ARG_SIZE(new_function->num_args);
+    fiber->num_call_events = 0;
 
-        for (RegisterIndex i = 0; i < new_function->num_args; i++) {
-            *(new_stack_base + i) =
-                *(current_call_frame->stack_base + args[i]);
+    if (abandon) {
+        for (size_t i = 0; i < stbds_arrlenu(graph->activations); i++) {
+            graph->nodes[graph->activations[i].function].active = 0;
+            call_graph_edge(graph, graph->activations[i].caller, graph->activations[i].function)->active = 0;
         }
+        stbds_arrsetlen(graph->activations, 0);
+    }
+}
 
-        Instruction const* start = new_function->bytecode.instructions + *new_function->bytecode.blocks;
-
-        BlockFrame new_block_frame = {start, start, out};
-        *(++fiber->block_stack) = new_block_frame;
-
-        CallFrame new_call_frame = {new_function, fiber->block_stack, new_stack_base};
-        *(++fiber->call_stack) = new_call_frame;
+void call_graph_attach(Fiber *restrict fiber, CallGraph* graph) {
+    fiber->call_graph = graph;
+    fiber->call_event_capacity = CALL_EVENT_CAPACITY;
+    fiber->num_call_events = 0;
+    fiber->call_events = realloc(fiber->call_events, CALL_EVENT_CAPACITY * sizeof(CallEvent));
+}
 
-        fiber->data_stack += new_function->num_registers;
+void call_graph_write_json(FILE* out, CallGraph const* graph) {
+    fprintf(out, "{\n  \"unit\": \"cycles\",\n  \"functions\": [");
 
-        SET_CONTEXT();
-        DISPATCH();
-    };
+    bool first = true;
+    for (size_t i = 0; i < stbds_arrlenu(graph->nodes); i++) {
+        CallGraphNode const* node = graph->nodes + i;
+        if (node->calls + node->tail_calls == 0) continue;
 
-    DO_TAIL_CALL_V: {
-        debug("TAIL_CALL_V");
+        fprintf(out, "%s\n    {\"function\": %lu, \"calls\": %lu, \"tail_calls\": %lu, \"inclusive\": %lu, \"exclusive\": %lu}",
+            first ? "" : ",", i, node->calls, node->tail_calls, node->inclusive, node->exclusive);
+        first = false;
+    }
 
-        FunctionIndex functionIndex = DECODE_W0();
+    fprintf(out, "\n  ],\n  \"edges\": [");
 
-        Function const* new_function = fiber->program->functions + functionIndex;
+    for (size_t i = 0; i < stbds_hmlenu(graph->edges); i++) {
+        FunctionIndex caller = graph->edges[i].key >> 16;
+        FunctionIndex callee = graph->edges[i].key & 0xFFFF;
+        CallGraphEdge const* edge = &graph->edges[i].value;
 
-        debug("\t%d %d %d", functionIndex, current_call_frame->root_block->out_index, new_function->num_args);
+        fprintf(out, "%s\n    {\"caller\": ", i == 0 ? "" : ",");
+        if (caller == CALL_GRAPH_ROOT) fprintf(out, "null");
+        else fprintf(out, "%d", caller);
+        fprintf(out, ", \"callee\": %d, \"calls\": %lu, \"tail_calls\": %lu, \"inclusive\": %lu}",
+            callee, edge->calls, edge->tail_calls, edge->inclusive);
+    }
 
-        int16_t register_delta = ((int16_t) current_function->num_registers) - ((int16_t) new_function->num_registers);
+    fprintf(out, "\n  ]\n}\n");
+}
 
-        if ( register_delta < 0
-           & fiber->data_stack + new_function->num_registers - current_function->num_registers >= fiber->data_stack_max
-           ) {
-            return TRAP_STACK_OVERFLOW;
-        }
+void call_graph_write_callgrind(FILE* out, CallGraph const* graph) {
+    fprintf(out, "# callgrind format\nversion: 1\ncreator: fast-interpreter-example\npositions: line\nevents: Cycles\n");
 
-        RegisterIndex const* args = (RegisterIndex const*) (current_block_frame->instruction_pointer);
-        current_block_frame->instruction_pointer += CALC_ARG_SIZE(new_function->num_args);
+    for (int64_t i = -1; i < (int64_t) stbds_arrlenu(graph->nodes); i++) {
+        FunctionIndex function = i < 0 ? CALL_GRAPH_ROOT : (FunctionIndex) i;
 
-        for (RegisterIndex i = 0; i < new_function->num_args; i++) {
-            register_scratch_space[i] =
-                *(current_call_frame->stack_base + args[i]);
+        if (i < 0) {
+            fprintf(out, "\nfn=<root>\n0 0\n");
+        } else {
+            if (graph->nodes[i].calls + graph->nodes[i].tail_calls == 0) continue;
+            fprintf(out, "\nfn=f%d\n0 %lu\n", function, graph->nodes[i].exclusive);
         }
 
-        uint64_t* new_stack_base = current_call_frame->stack_base;
+        for (size_t j = 0; j < stbds_hmlenu(graph->edges); j++) {
+            if ((graph->edges[j].key >> 16) != function) continue;
 
-        for (RegisterIndex i = 0; i < new_function->num_registers; i++) {
-            *(new_stack_base + i) = register_scratch_space[i];
+            // callgrind has no tail calls, so only real calls are counted and the inclusive cost covers the whole chain
+            CallGraphEdge const* edge = &graph->edges[j].value;
+            if (edge->tail_calls > 0) fprintf(out, "# %lu tail calls\n", edge->tail_calls);
+            fprintf(out, "cfn=f%d\ncalls=%lu 0\n0 %lu\n", graph->edges[j].key & 0xFFFF, edge->calls, edge->inclusive);
         }
-
-        Instruction const* start = new_function->bytecode.instructions + *new_function->bytecode.blocks;
-
-        fiber->block_stack = current_call_frame->root_block;
-        fiber->block_stack->start_pointer = start;
-        fiber->block_stack->instruction_pointer = start;
-
-        current_call_frame->function = new_function;
-        fiber->data_stack -= register_delta;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
-
-    DO_RET_V: {
-        debug("RET_V");
-
-        RegisterIndex y = DECODE_A();
-
-        BlockFrame* root_block = current_call_frame->root_block;
-        CallFrame* caller_frame = fiber->call_stack - 1;
-
-        *(caller_frame->stack_base + root_block->out_index) =
-            *(current_call_frame->stack_base + y);
-
-        fiber->call_stack--;
-        fiber->block_stack = current_call_frame->root_block - 1;
-        fiber->data_stack = current_call_frame->stack_base;
-
-        SET_CONTEXT();
-        DISPATCH();
-    };
+    }
 }
 
-Trap invoke(Fiber *restrict fiber, FunctionIndex functionIndex, uint64_t* ret_val, uint64_t* args) {
+#define EVAL_NAME eval
+#define EVAL_PROFILE 0
+#define EVAL_CALL_PROFILE 0
+#define EVAL_CHECKED 1
+#define EVAL_SAMPLED 0
+#include "eval.c"
+
+#define EVAL_NAME eval_unchecked
+#define EVAL_PROFILE 0
+#define EVAL_CALL_PROFILE 0
+#define EVAL_CHECKED 0
+#define EVAL_SAMPLED 0
+#include "eval.c"
+
+#define EVAL_NAME eval_profiled
+#define EVAL_PROFILE 1
+#define EVAL_CALL_PROFILE 0
+#define EVAL_CHECKED 1
+#define EVAL_SAMPLED 1
+#include "eval.c"
+
+#define EVAL_NAME eval_call_profiled
+#define EVAL_PROFILE 0
+#define EVAL_CALL_PROFILE 1
+#define EVAL_CHECKED 1
+#define EVAL_SAMPLED 1
+#include "eval.c"
+
+#define EVAL_NAME eval_sampled
+#define EVAL_PROFILE 0
+#define EVAL_CALL_PROFILE 0
+#define EVAL_CHECKED 1
+#define EVAL_SAMPLED 1
+#include "eval.c"
+
+Trap invoke_with(Evaluator evaluator, Fiber *restrict fiber, FunctionIndex functionIndex, uint64_t* ret_val, uint64_t* args) {
     debug("invoke");
 
     Function const* function = fiber->program->functions + functionIndex;
 
-    if ( fiber->call_stack + 2 >= fiber->call_stack_max
-       | fiber->data_stack + function->num_registers + 1 >= fiber->data_stack_max
-       ) {
+    // the wrapper's record, its one register and its root block, then the entry point's frame
+    CallFrame* wrapper_frame = (CallFrame*) (fiber->block_stack + 1);
+    if (FRAME_REGISTERS(wrapper_frame) + 2 + FRAME_HEADER_WORDS + FRAME_SLOTS(function) + 1 > fiber->stack_max) {
         return TRAP_STACK_OVERFLOW;
     }
     
     InstructionPointer wrapper_blocks[1] = { 0 };
     Instruction wrapper_instructions[] = { I_ENCODE_0(HALT) };
-    Bytecode wrapper_bytecode = {wrapper_blocks, wrapper_instructions};
+    Bytecode wrapper_bytecode = {wrapper_blocks, wrapper_instructions, 1, 1};
 
     Function wrapper = {0, 1, wrapper_bytecode};
 
-    BlockFrame wrapper_block_frame = {wrapper_instructions, wrapper_instructions, 0};
-    *(++fiber->block_stack) = wrapper_block_frame;
+    CallFrame* outer_frame = fiber->call_frame;
+    StackPtr outer = outer_frame != NULL ? (StackPtr) ((uint64_t*) outer_frame - fiber->stack_base) : FRAME_NONE;
 
-    CallFrame wrapper_call_frame = {&wrapper, fiber->block_stack, fiber->data_stack};
-    *(++fiber->call_stack) = wrapper_call_frame;
+    *wrapper_frame = (CallFrame) {&wrapper, outer, 0};
+    BlockFrame* wrapper_block = (BlockFrame*) (FRAME_REGISTERS(wrapper_frame) + 1);
+    *wrapper_block = (BlockFrame) {0, 0};
 
-    fiber->data_stack += 1;
+    InstructionPointer start = *function->bytecode.blocks;
 
-    Instruction const* start = function->bytecode.instructions + *function->bytecode.blocks;
-
-    BlockFrame block_frame = {start, start, 0};
-    *(++fiber->block_stack) = block_frame;
-    
-    CallFrame call_frame = {function, fiber->block_stack, fiber->data_stack};
-    *(++fiber->call_stack) = call_frame;
-
-    fiber->data_stack += function->num_registers;
+    CallFrame* call_frame = (CallFrame*) (wrapper_block + 1);
+    *call_frame = (CallFrame) {function, (StackPtr) ((uint64_t*) wrapper_frame - fiber->stack_base), 0};
 
     for (uint8_t i = 0; i < function->num_args; i++) {
-        *(call_frame.stack_base + i) = args[i];
+        FRAME_REGISTERS(call_frame)[i] = args[i];
+    }
+
+    for (uint32_t i = 0; i < function->bytecode.num_register_constants; i++) {
+        FRAME_REGISTERS(call_frame)[function->num_registers + i] = function->bytecode.constants[i];
     }
 
-    Trap result = eval(fiber);
+    BlockFrame* block_frame = (BlockFrame*) (FRAME_REGISTERS(call_frame) + FRAME_SLOTS(function));
+    *block_frame = (BlockFrame) {start, start};
+
+    fiber->call_frame = call_frame;
+    fiber->block_stack = block_frame;
+
+    Trap result = evaluator(fiber);
 
     if (result == OKAY) {
-        *ret_val = *((uint64_t*) (wrapper_call_frame.stack_base));
-        fiber->call_stack--;
-        fiber->block_stack--;
-        fiber->data_stack -= 1;
+        *ret_val = *FRAME_REGISTERS(wrapper_frame);
+        fiber->call_frame = outer_frame;
+        fiber->block_stack = (BlockFrame*) wrapper_frame - 1;
+    } else {
+        memo_reset_frames(fiber);
     }
 
     return result;
 }
 
+Trap invoke(Fiber *restrict fiber, FunctionIndex functionIndex, uint64_t* ret_val, uint64_t* args) {
+    return invoke_with(eval, fiber, functionIndex, ret_val, args);
+}
+
+Fiber fiber_create_sized(Program const* program, size_t words) {
+    uint64_t* stack = malloc(sizeof(uint64_t) * words);
+
+    Fiber fiber = {
+        .program = program,
+        .stack_base = stack,
+        .stack_max = stack + words,
+        .call_frame = NULL,
+        .block_stack = (BlockFrame*) stack - 1,
+    };
+
+    return fiber;
+}
+
+Fiber fiber_create(Program const* program) {
+    return fiber_create_sized(program, STACK_SIZE);
+}
+
+void fiber_destroy(Fiber* fiber) {
+    free(fiber->stack_base);
+    free(fiber->call_events);
+    stbds_arrfree(fiber->memo_frames);
+}
+
 char const* trap_name(Trap trap) {
     switch (trap) {
         case OKAY: return "OKAY";
         case TRAP_UNREACHABLE: return "UNREACHABLE";
-        case TRAP_CALL_OVERFLOW: return "CALL_OVERFLOW";
         case TRAP_STACK_OVERFLOW: return "STACK_OVERFLOW";
+        case TRAP_LINK_FAILED: return "LINK_FAILED";
         default: return "INVALID";
     }
 }
@@ -895,16 +700,25 @@ char const* opcode_name(OpCode op) {
     switch (op) {
         case HALT: return "HALT";
         case UNREACHABLE: return "UNREACHABLE";
+        case LAZY_LINK: return "LAZY_LINK";
         case READ_GLOBAL_32: return "READ_GLOBAL_32";
         case READ_GLOBAL_64: return "READ_GLOBAL_64";
+        case LOAD_GLOBAL_64: return "LOAD_GLOBAL_64";
+        case STORE_GLOBAL_64: return "STORE_GLOBAL_64";
         case COPY_IM_64: return "COPY_IM_64";
+        case COPY_64: return "COPY_64";
         case IF_NZ: return "IF_NZ";
         case WHEN_NZ: return "WHEN_NZ";
+        case SWITCH: return "SWITCH";
         case BLOCK: return "BLOCK";
         case BR: return "BR";
         case BR_NZ: return "BR_NZ";
         case RE: return "RE";
         case RE_NZ: return "RE_NZ";
+        case LOOP_F64: return "LOOP_F64";
+        case LOOP_IM_F64: return "LOOP_IM_F64";
+        case LOOP_I64: return "LOOP_I64";
+        case LOOP_IM_I64: return "LOOP_IM_I64";
         case F_ADD_32: return "F_ADD_32";
         case F_ADD_IM_32: return "F_ADD_IM_32";
         case F_SUB_32: return "F_SUB_32";
@@ -915,6 +729,9 @@ char const* opcode_name(OpCode op) {
         case F_SUB_64: return "F_SUB_64";
         case F_SUB_IM_A_64: return "F_SUB_IM_A_64";
         case F_SUB_IM_B_64: return "F_SUB_IM_B_64";
+        case F_MUL_64: return "F_MUL_64";
+        case F_DIV_64: return "F_DIV_64";
+        case F_SQRT_64: return "F_SQRT_64";
         case I_ADD_64: return "I_ADD_64";
         case I_SUB_64: return "I_SUB_64";
         case F_EQ_32: return "F_EQ_32";
@@ -930,6 +747,9 @@ char const* opcode_name(OpCode op) {
         case S_EQ_64: return "S_EQ_64";
         case S_EQ_IM_64: return "S_EQ_IM_64";
         case S_LT_64: return "S_LT_64";
+        case SELECT_64: return "SELECT_64";
+        case SELECT_F_LT_64: return "SELECT_F_LT_64";
+        case SELECT_S_LT_64: return "SELECT_S_LT_64";
         case CALL_V: return "CALL_V";
         case TAIL_CALL_V: return "TAIL_CALL_V";
         case RET_V: return "RET_V";
@@ -937,18 +757,280 @@ char const* opcode_name(OpCode op) {
     }
 }
 
-typedef stbds_arr(uint8_t) Encoder;
+int profile_compare_opcodes(void const* a, void const* b) {
+    uint64_t x = opcode_profile.cycles[*(OpCode const*) a];
+    uint64_t y = opcode_profile.cycles[*(OpCode const*) b];
+    return (x < y) - (x > y);
+}
 
-InstructionPointer encode_instr (Encoder* encoder, Instruction instr) {
-    uint8_t* bytes = (uint8_t*) &instr;
-    InstructionPointer offset = stbds_arrlenu(*encoder) / sizeof(Instruction);
-    for (size_t i = 0; i < sizeof(Instruction); i++) stbds_arrpush(*encoder, bytes[i]);
-    return offset;
+int profile_compare_functions(void const* a, void const* b) {
+    uint64_t x = opcode_profile.function_instructions[*(FunctionIndex const*) a];
+    uint64_t y = opcode_profile.function_instructions[*(FunctionIndex const*) b];
+    return (x < y) - (x > y);
 }
 
-InstructionPointer encode_0 (Encoder* encoder, OpCode opcode) {
-    debug("encode_0 %s", opcode_name(opcode));
-    Instruction e = I_ENCODE_0(opcode);
+void profile_report(FILE* out) {
+    OpCode opcodes [RET_V + 1];
+    uint64_t total_count = 0;
+    uint64_t total_cycles = 0;
+
+    for (int op = 0; op <= RET_V; op++) {
+        opcodes[op] = (OpCode) op;
+        total_count += opcode_profile.counts[op];
+        total_cycles += opcode_profile.cycles[op];
+    }
+
+    qsort(opcodes, RET_V + 1, sizeof(OpCode), profile_compare_opcodes);
+
+    fprintf(out, "%-16s %14s %7s %16s %7s %10s\n", "opcode", "count", "count%", "cycles", "cycle%", "cycles/op");
+
+    for (int i = 0; i <= RET_V; i++) {
+        OpCode op = opcodes[i];
+        uint64_t count = opcode_profile.counts[op];
+        uint64_t cycles = opcode_profile.cycles[op];
+        if (count == 0) continue;
+
+        fprintf(out, "%-16s %14lu %6.2f%% %16lu %6.2f%% %10.2f\n",
+            opcode_name(op),
+            count, 100.0 * (double) count / (double) total_count,
+            cycles, 100.0 * (double) cycles / (double) total_cycles,
+            (double) cycles / (double) count);
+    }
+
+    fprintf(out, "%-16s %14lu %7s %16lu\n", "total", total_count, "", total_cycles);
+
+    size_t num_functions = stbds_arrlenu(opcode_profile.function_instructions);
+    if (num_functions == 0) return;
+
+    FunctionIndex* functions = malloc(num_functions * sizeof(FunctionIndex));
+    for (size_t i = 0; i < num_functions; i++) functions[i] = (FunctionIndex) i;
+
+    qsort(functions, num_functions, sizeof(FunctionIndex), profile_compare_functions);
+
+    fprintf(out, "\n%-16s %14s %7s\n", "function", "instructions", "instr%");
+
+    for (size_t i = 0; i < num_functions; i++) {
+        uint64_t count = opcode_profile.function_instructions[functions[i]];
+        if (count == 0) continue;
+
+        fprintf(out, "f%-15d %14lu %6.2f%%\n", functions[i], count, 100.0 * (double) count / (double) total_count);
+    }
+
+    free(functions);
+}
+
+void profile_report_at_exit() {
+    profile_report(stderr);
+}
+
+typedef struct {
+    uint16_t depth;
+    bool truncated;
+    InstructionPointer block_start;
+    InstructionPointer instruction;
+    FunctionIndex frames [SAMPLE_MAX_DEPTH];
+} Sample;
+
+typedef struct {
+    Fiber const* volatile fiber;
+    Sample* samples;
+    size_t capacity;
+    volatile size_t num_samples;
+    volatile size_t dropped;
+    struct sigaction previous_action;
+} Sampler;
+
+Sampler sampler;
+
+// runs inside the SIGPROF handler: no allocation, no locks, just copy the current stack shape out of the fiber;
+// the sampling evaluators fence their fiber state at every dispatch, so the frames seen here are at most one
+// instruction stale
+void sampler_take_sample(int signal) {
+    (void) signal;
+
+    Fiber const* fiber = sampler.fiber;
+    if (fiber == NULL) return;
+
+    size_t index = sampler.num_samples;
+    if (index >= sampler.capacity) {
+        sampler.dropped++;
+        return;
+    }
+
+    Sample* sample = sampler.samples + index;
+    Program const* program = fiber->program;
+
+    CallFrame const* frame = fiber->call_frame;
+    BlockFrame const* block_frame = fiber->block_stack;
+
+    sample->depth = 0;
+    sample->truncated = false;
+    sample->block_start = UINT32_MAX;
+    sample->instruction = UINT32_MAX;
+
+    for (; frame != NULL; frame = frame->caller != FRAME_NONE ? (CallFrame const*) (fiber->stack_base + frame->caller) : NULL) {
+        size_t function_index = (size_t) (frame->function - program->functions);
+
+        // skip frames that do not belong to the program, such as invoke's wrapper
+        if (function_index >= program->num_functions) continue;
+
+        if (sample->depth == 0) {
+            sample->block_start = block_frame->start_pointer;
+            sample->instruction = block_frame->instruction_pointer;
+        }
+
+        if (sample->depth == SAMPLE_MAX_DEPTH) {
+            sample->truncated = true;
+            break;
+        }
+
+        sample->frames[sample->depth++] = (FunctionIndex) function_index;
+    }
+
+    if (sample->depth > 0) sampler.num_samples = index + 1;
+}
+
+bool sampler_start(Fiber const* fiber, int frequency, size_t capacity) {
+    sampler.samples = realloc(sampler.samples, capacity * sizeof(Sample));
+    sampler.capacity = capacity;
+    sampler.num_samples = 0;
+    sampler.dropped = 0;
+    sampler.fiber = fiber;
+
+    struct sigaction action = {};
+    action.sa_handler = sampler_take_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, &sampler.previous_action) != 0) return false;
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_usec = 1000000 / frequency;
+    timer.it_value = timer.it_interval;
+
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+void sampler_stop() {
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &sampler.previous_action, NULL);
+    sampler.fiber = NULL;
+}
+
+// writes one line per distinct stack, root first, in the folded format consumed by flamegraph.pl and friends;
+// the leaf function is followed by a pseudo frame naming the block and instruction that was executing
+void sampler_write_folded(FILE* out, Program const* program) {
+    stbds_sh(uint64_t) stacks = NULL;
+    stbds_sh_new_strdup(stacks);
+
+    char line [SAMPLE_MAX_DEPTH * 8 + 64];
+
+    for (size_t i = 0; i < sampler.num_samples; i++) {
+        Sample const* sample = sampler.samples + i;
+        size_t length = 0;
+
+        if (sample->truncated) length += snprintf(line + length, sizeof(line) - length, "...;");
+
+        for (uint16_t j = sample->depth; j > 0; j--) {
+            length += snprintf(line + length, sizeof(line) - length, "f%d;", sample->frames[j - 1]);
+        }
+
+        Bytecode const* bytecode = &program->functions[sample->frames[0]].bytecode;
+
+        int block_index = -1;
+        for (BlockIndex b = 0; b < bytecode->num_blocks; b++) {
+            if (bytecode->blocks[b] == sample->block_start) {
+                block_index = b;
+                break;
+            }
+        }
+
+        if (block_index >= 0) {
+            snprintf(line + length, sizeof(line) - length, "b%d:i%d", block_index, sample->instruction);
+        } else {
+            snprintf(line + length, sizeof(line) - length, "b?:i%d", sample->instruction);
+        }
+
+        ptrdiff_t existing = stbds_shgeti(stacks, line);
+        if (existing >= 0) stacks[existing].value++;
+        else stbds_shput(stacks, line, 1);
+    }
+
+    for (size_t i = 0; i < stbds_shlenu(stacks); i++) {
+        fprintf(out, "%s %lu\n", stacks[i].key, stacks[i].value);
+    }
+
+    stbds_shfree(stacks);
+}
+
+typedef struct {
+    stbds_arr(uint8_t) code;
+    stbds_arr(uint64_t) constants;
+    // the pool up to the last constant read as a register
+    uint32_t num_register_constants;
+} Encoder;
+
+InstructionPointer encode_instr (Encoder* encoder, Instruction instr) {
+    uint8_t* bytes = (uint8_t*) &instr;
+    InstructionPointer offset = stbds_arrlenu(encoder->code) / sizeof(Instruction);
+    for (size_t i = 0; i < sizeof(Instruction); i++) stbds_arrpush(encoder->code, bytes[i]);
+    return offset;
+}
+
+// pool index of im, adding it when the function has not used that value yet
+uint8_t encode_constant (Encoder* encoder, uint64_t im) {
+    size_t num_constants = stbds_arrlenu(encoder->constants);
+    for (size_t i = 0; i < num_constants; i++) {
+        if (encoder->constants[i] == im) return (uint8_t) i;
+    }
+
+    if (num_constants == MAX_CONSTANTS) {
+        fprintf(stderr, "encode: more than %d distinct constants in one function\n", MAX_CONSTANTS);
+        abort();
+    }
+
+    stbds_arrpush(encoder->constants, im);
+    return (uint8_t) num_constants;
+}
+
+// the read-only register holding value in a function with num_registers registers of its own
+RegisterIndex encode_constant_register (Encoder* encoder, RegisterIndex num_registers, uint64_t value) {
+    uint8_t k = encode_constant(encoder, value);
+    if (k >= encoder->num_register_constants) encoder->num_register_constants = k + 1u;
+
+    uint32_t r = (uint32_t) num_registers + k;
+    debug("encode_constant_register %lu r%u", value, r);
+
+    if (r > MAX_REGISTERS) {
+        fprintf(stderr, "encode: constant register r%u does not fit a register index\n", r);
+        abort();
+    }
+
+    return (RegisterIndex) r;
+}
+
+#if PACKED_INSTRUCTIONS
+    InstructionPointer encode_instr_k (Encoder* encoder, Instruction instr, uint64_t im) {
+        return encode_instr(encoder, I_ENCODE_K(instr, encode_constant(encoder, im)));
+    }
+#endif
+
+Bytecode encode_bytecode (Encoder* encoder, stbds_arr(InstructionPointer) blocks) {
+    return (Bytecode) {
+        .blocks = blocks,
+        .instructions = (Instruction const*) encoder->code,
+        .num_blocks = (BlockIndex) stbds_arrlenu(blocks),
+        .num_instructions = (InstructionPointer) (stbds_arrlenu(encoder->code) / sizeof(Instruction)),
+        .constants = encoder->constants,
+        .num_constants = (uint32_t) stbds_arrlenu(encoder->constants),
+        .num_register_constants = encoder->num_register_constants,
+    };
+}
+
+InstructionPointer encode_0 (Encoder* encoder, OpCode opcode) {
+    debug("encode_0 %s", opcode_name(opcode));
+    Instruction e = I_ENCODE_0(opcode);
     debug("\t%s", opcode_name(I_DECODE_OPCODE(e)));
     return encode_instr(encoder, e);
 }
@@ -988,6 +1070,46 @@ InstructionPointer encode_w1 (Encoder* encoder, OpCode opcode, uint16_t w, uint8
     return encode_instr(encoder, e);
 }
 
+InstructionPointer encode_w2 (Encoder* encoder, OpCode opcode, uint16_t w, uint8_t a, uint8_t b) {
+    debug("encode_w2 %s %d %d %d", opcode_name(opcode), w, a, b);
+    #if PACKED_INSTRUCTIONS
+        if (w > UINT8_MAX) {
+            fprintf(stderr, "encode: %s needs an 8-bit index in the packed encoding, got %d\n", opcode_name(opcode), w);
+            abort();
+        }
+    #endif
+    Instruction e = I_ENCODE_W2(opcode, w, a, b);
+    debug("\t%s %d %d %d", opcode_name(I_DECODE_OPCODE(e)), I_DECODE_W2_W0(e), I_DECODE_W1(e), I_DECODE_W2(e));
+    return encode_instr(encoder, e);
+}
+
+#if PACKED_INSTRUCTIONS
+// a packed word has no room for a 32-bit immediate or for W0 next to a constant index, so only the forms that
+// leave C free exist
+InstructionPointer encode_0_im (Encoder* encoder, OpCode opcode, uint32_t im) {
+    debug("encode_0_im %s %u", opcode_name(opcode), im);
+    return encode_instr_k(encoder, I_ENCODE_0(opcode), im);
+}
+
+InstructionPointer encode_1_im (Encoder* encoder, OpCode opcode, uint32_t im, uint8_t a) {
+    debug("encode_1_im %s %u %d", opcode_name(opcode), im, a);
+    return encode_instr_k(encoder, I_ENCODE_1(opcode, a), im);
+}
+
+InstructionPointer encode_2_im (Encoder* encoder, OpCode opcode, uint32_t im, uint8_t a, uint8_t b) {
+    debug("encode_2_im %s %u %d %d", opcode_name(opcode), im, a, b);
+    return encode_instr_k(encoder, I_ENCODE_2(opcode, a, b), im);
+}
+
+// the wide encoding puts a 64-bit immediate in the word after its instruction; here it goes to the pool and the
+// instruction just encoded gets its index
+InstructionPointer encode_im64 (Encoder* encoder, uint64_t im) {
+    debug("encode_im64 %lu", im);
+    Instruction* last = (Instruction*) (encoder->code + stbds_arrlenu(encoder->code)) - 1;
+    *last = I_ENCODE_K(*last, encode_constant(encoder, im));
+    return (InstructionPointer) (last - (Instruction*) encoder->code);
+}
+#else
 InstructionPointer encode_0_im (Encoder* encoder, OpCode opcode, uint32_t im) {
     debug("encode_0_im %s %u", opcode_name(opcode), im);
     Instruction e = I_ENCODE_IM32(uint32_t, I_ENCODE_0(opcode), im);
@@ -1035,20 +1157,39 @@ InstructionPointer encode_im64 (Encoder* encoder, uint64_t im) {
     Instruction e = BITCAST(uint64_t, Instruction, im);
     return encode_instr(encoder, e);
 }
+#endif
 
 void encode_registers (Encoder* encoder, RegisterIndex num_registers, RegisterIndex* indices) {
-    for (size_t i = 0; i < num_registers; i++) stbds_arrpush(*encoder, indices[i]);
+    for (size_t i = 0; i < num_registers; i++) stbds_arrpush(encoder->code, indices[i]);
     size_t padding = ALIGNMENT_DELTA(num_registers, alignof(Instruction));
     debug("encoded %d registers:", num_registers);
     for (size_t i = 0; i < num_registers; i++) debug("\tr%d", indices[i]);
     debug("adding %lu padding", padding);
-    for (size_t i = 0; i < padding; i++) stbds_arrpush(*encoder, 0);
+    for (size_t i = 0; i < padding; i++) stbds_arrpush(encoder->code, 0);
+}
+
+void encode_blocks (Encoder* encoder, uint16_t num_blocks, BlockIndex const* indices) {
+    for (size_t i = 0; i < num_blocks; i++) stbds_arrpush(encoder->code, indices[i]);
+    size_t padding = ALIGNMENT_DELTA(num_blocks, alignof(Instruction));
+    debug("encoded %d blocks:", num_blocks);
+    for (size_t i = 0; i < num_blocks; i++) debug("\tb%d", indices[i]);
+    debug("adding %lu padding", padding);
+    for (size_t i = 0; i < padding; i++) stbds_arrpush(encoder->code, 0);
 }
 
-void disas(Function const* functions, InstructionPointer const* blocks, Instruction const* instructions) {
+void disas(Function const* functions, Bytecode const* bytecode) {
+    InstructionPointer const* blocks = bytecode->blocks;
+    Instruction const* instructions = bytecode->instructions;
+
+    for (uint32_t k = 0; k < bytecode->num_constants; k++) {
+        printf("[k%u]: %lu (%g)\n", k, bytecode->constants[k], BITCAST(uint64_t, double, bytecode->constants[k]));
+    }
+
+    // a block entered from several places, like the cases of a SWITCH sharing one, is listed once
+    bool listed [MAX_BLOCKS] = {};
     BlockIndex to_disas [MAX_BLOCKS] = {};
     BlockIndex num_blocks = 0;
-    #define DISAS_BLOCK(block) (to_disas[num_blocks++] = block)
+    #define DISAS_BLOCK(block) if (!listed[block]) { listed[block] = true; to_disas[num_blocks++] = block; }
     DISAS_BLOCK(0);
 
     while (num_blocks > 0) {
@@ -1070,7 +1211,8 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
 
             switch (opcode) {
                 case HALT:
-                case UNREACHABLE: {
+                case UNREACHABLE:
+                case LAZY_LINK: {
                     block_done = true;
                 } break;
 
@@ -1086,12 +1228,32 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                     printf(" g%d r%d", index, destination);
                 } break;
 
+                case LOAD_GLOBAL_64: {
+                    GlobalIndex index = I_DECODE_W2_W0(instr);
+                    RegisterIndex destination = I_DECODE_W1(instr);
+                    RegisterIndex offset = I_DECODE_W2(instr);
+                    printf(" g%d[r%d] r%d", index, offset, destination);
+                } break;
+
+                case STORE_GLOBAL_64: {
+                    GlobalIndex index = I_DECODE_W2_W0(instr);
+                    RegisterIndex source = I_DECODE_W1(instr);
+                    RegisterIndex offset = I_DECODE_W2(instr);
+                    printf(" r%d g%d[r%d]", source, index, offset);
+                } break;
+
                 case COPY_IM_64: {
-                    uint64_t imm = BITCAST(Instruction, uint64_t, instructions[block + ip++]);
+                    uint64_t imm = I_IMMEDIATE_64(uint64_t, instr, bytecode->constants, instructions[block + ip++]);
                     RegisterIndex destination = I_DECODE_A(instr);
                     printf(" %lu r%d", imm, destination);
                 } break;
 
+                case COPY_64: {
+                    RegisterIndex source = I_DECODE_A(instr);
+                    RegisterIndex destination = I_DECODE_B(instr);
+                    printf(" r%d r%d", source, destination);
+                } break;
+
                 case IF_NZ: {
                     BlockIndex then_index = I_DECODE_A(instr);
                     BlockIndex else_index = I_DECODE_B(instr);
@@ -1099,7 +1261,6 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                     printf(" b%d b%d r%d", then_index, else_index, condition);
                     DISAS_BLOCK(else_index);
                     DISAS_BLOCK(then_index);
-                    block_done = true;
                 } break;
 
                 case WHEN_NZ: {
@@ -1109,6 +1270,17 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                     DISAS_BLOCK(new_block_index);
                 } break;
 
+                case SWITCH: {
+                    RegisterIndex index = I_DECODE_A(instr);
+                    uint8_t num_cases = I_DECODE_B(instr);
+                    BlockIndex const* table = (BlockIndex const*) (instructions + block + ip);
+                    ip += CALC_SWITCH_SIZE(num_cases);
+                    printf(" r%d (%d : ", index, num_cases);
+                    for (uint16_t i = 1; i <= num_cases; i++) printf("b%d, ", table[i]);
+                    printf("else b%d)", table[0]);
+                    for (uint16_t i = 0; i <= num_cases; i++) DISAS_BLOCK(table[i]);
+                } break;
+
                 case BLOCK: {
                     BlockIndex new_block_index = I_DECODE_A(instr);
                     printf(" b%d", new_block_index);
@@ -1139,6 +1311,28 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                     printf(" b%d r%d", relative_block_index, condition);
                 } break;
 
+                case LOOP_F64:
+                case LOOP_I64: {
+                    RegisterIndex counter = I_DECODE_A(instr);
+                    RegisterIndex limit = I_DECODE_B(instr);
+                    BlockIndex relative_block_index = I_DECODE_C(instr);
+                    printf(" r%d r%d b%d", counter, limit, relative_block_index);
+                } break;
+
+                case LOOP_IM_F64: {
+                    RegisterIndex counter = I_DECODE_A(instr);
+                    BlockIndex relative_block_index = I_DECODE_B(instr);
+                    double limit = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
+                    printf(" r%d %f b%d", counter, limit, relative_block_index);
+                } break;
+
+                case LOOP_IM_I64: {
+                    RegisterIndex counter = I_DECODE_A(instr);
+                    BlockIndex relative_block_index = I_DECODE_B(instr);
+                    int64_t limit = I_IMMEDIATE_64(int64_t, instr, bytecode->constants, instructions[block + ip++]);
+                    printf(" r%d %" PRId64 " b%d", counter, limit, relative_block_index);
+                } break;
+
                 case F_ADD_32: {
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex y = I_DECODE_B(instr);
@@ -1147,7 +1341,7 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case F_ADD_IM_32: {
-                    float x = I_DECODE_IM32(float, instr);
+                    float x = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", x, y, z);
@@ -1161,14 +1355,14 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case F_SUB_IM_A_32: {
-                    float x = I_DECODE_IM32(float, instr);
+                    float x = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", x, y, z);
                 } break;
 
                 case F_SUB_IM_B_32: {
-                    float y = I_DECODE_IM32(float, instr);
+                    float y = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", y, x, z);
@@ -1182,7 +1376,7 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case F_ADD_IM_64: {
-                    double x = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double x = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", x, y, z);
@@ -1198,17 +1392,31 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 case F_SUB_IM_A_64: {
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
-                    double x = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double x = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     printf(" %f r%d r%d", x, y, z);
                 } break;
 
                 case F_SUB_IM_B_64: {
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
-                    double y = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double y = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     printf(" %f r%d r%d", y, x, z);
                 } break;
 
+                case F_MUL_64:
+                case F_DIV_64: {
+                    RegisterIndex x = I_DECODE_A(instr);
+                    RegisterIndex y = I_DECODE_B(instr);
+                    RegisterIndex z = I_DECODE_C(instr);
+                    printf(" r%d r%d r%d", x, y, z);
+                } break;
+
+                case F_SQRT_64: {
+                    RegisterIndex x = I_DECODE_A(instr);
+                    RegisterIndex y = I_DECODE_B(instr);
+                    printf(" r%d r%d", x, y);
+                } break;
+
                 case I_ADD_64: {
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex y = I_DECODE_B(instr);
@@ -1231,7 +1439,7 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case F_EQ_IM_32: {
-                    float x = I_DECODE_IM32(float, instr);
+                    float x = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", x, y, z);
@@ -1245,14 +1453,14 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case F_LT_IM_A_32: {
-                    float x = I_DECODE_IM32(float, instr);
+                    float x = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", x, y, z);
                 } break;
 
                 case F_LT_IM_B_32: {
-                    float y = I_DECODE_IM32(float, instr);
+                    float y = I_IMMEDIATE_32(float, instr, bytecode->constants, 0);
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %f r%d r%d", y, x, z);
@@ -1268,7 +1476,7 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 case F_EQ_IM_64: {
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
-                    double x = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double x = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     printf(" %f r%d r%d", x, y, z);
                 } break;
 
@@ -1282,14 +1490,14 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 case F_LT_IM_A_64: {
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
-                    double x = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double x = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     printf(" %f r%d r%d", x, y, z);
                 } break;
 
                 case F_LT_IM_B_64: {
                     RegisterIndex x = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
-                    double y = BITCAST(Instruction, double, instructions[block + ip++]);
+                    double y = I_IMMEDIATE_64(double, instr, bytecode->constants, instructions[block + ip++]);
                     printf(" %f r%d r%d", y, x, z);
                 } break;
 
@@ -1301,7 +1509,7 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                 } break;
 
                 case S_EQ_IM_64: {
-                    uint64_t x = BITCAST(Instruction, uint64_t, instructions[block + ip++]);
+                    uint64_t x = I_IMMEDIATE_64(uint64_t, instr, bytecode->constants, instructions[block + ip++]);
                     RegisterIndex y = I_DECODE_A(instr);
                     RegisterIndex z = I_DECODE_B(instr);
                     printf(" %lu r%d r%d", x, y, z);
@@ -1314,6 +1522,15 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
                     printf(" r%d r%d r%d", x, y, z);
                 } break;
 
+                case SELECT_64:
+                case SELECT_F_LT_64:
+                case SELECT_S_LT_64: {
+                    RegisterIndex x = I_DECODE_A(instr);
+                    RegisterIndex y = I_DECODE_B(instr);
+                    RegisterIndex z = I_DECODE_C(instr);
+                    printf(" r%d r%d r%d", x, y, z);
+                } break;
+
                 case CALL_V: {
                     FunctionIndex functionIndex = I_DECODE_W0(instr);
                     RegisterIndex out = I_DECODE_W1(instr);
@@ -1365,6 +1582,581 @@ void disas(Function const* functions, InstructionPointer const* blocks, Instruct
     }
 }
 
+bool opcode_ends_block(OpCode opcode) {
+    switch (opcode) {
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+        case BR:
+        case RE:
+        case TAIL_CALL_V:
+        case RET_V:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// instructions whose immediate is a constant pool index in the packed encoding
+bool opcode_has_immediate(OpCode opcode) {
+    switch (opcode) {
+        case COPY_IM_64:
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+        case F_ADD_IM_64:
+        case F_SUB_IM_A_64:
+        case F_SUB_IM_B_64:
+        case F_EQ_IM_32:
+        case F_LT_IM_A_32:
+        case F_LT_IM_B_32:
+        case F_EQ_IM_64:
+        case F_LT_IM_A_64:
+        case F_LT_IM_B_64:
+        case S_EQ_IM_64:
+        case LOOP_IM_F64:
+        case LOOP_IM_I64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+InstructionPointerOffset instruction_length(Function const* functions, Instruction const* instr) {
+    switch (I_DECODE_OPCODE(*instr)) {
+        case COPY_IM_64:
+        case F_ADD_IM_64:
+        case F_SUB_IM_A_64:
+        case F_SUB_IM_B_64:
+        case F_EQ_IM_64:
+        case F_LT_IM_A_64:
+        case F_LT_IM_B_64:
+        case S_EQ_IM_64:
+        case LOOP_IM_F64:
+        case LOOP_IM_I64:
+            return IM64_LENGTH;
+
+        case CALL_V:
+        case TAIL_CALL_V:
+            return 1 + CALC_ARG_SIZE(functions[I_DECODE_W0(*instr)].num_args);
+
+        case SWITCH:
+            return 1 + CALC_SWITCH_SIZE(I_DECODE_B(*instr));
+
+        default:
+            return 1;
+    }
+}
+
+bool function_is_locally_pure(Program const* program, FunctionIndex index, bool const* pure) {
+    Function const* function = program->functions + index;
+
+    bool visited [MAX_BLOCKS] = {};
+    BlockIndex to_visit [MAX_BLOCKS];
+    BlockIndex num_to_visit = 0;
+
+    #define VISIT_BLOCK(block) if (!visited[block]) { visited[block] = true; to_visit[num_to_visit++] = block; }
+    VISIT_BLOCK(0);
+
+    while (num_to_visit > 0) {
+        Instruction const* instr = function->bytecode.instructions + function->bytecode.blocks[to_visit[--num_to_visit]];
+
+        while (true) {
+            OpCode opcode = I_DECODE_OPCODE(*instr);
+
+            switch (opcode) {
+                case READ_GLOBAL_32:
+                case READ_GLOBAL_64:
+                case LOAD_GLOBAL_64:
+                case STORE_GLOBAL_64:
+                case LAZY_LINK:
+                    return false;
+
+                case CALL_V:
+                case TAIL_CALL_V: {
+                    FunctionIndex callee = I_DECODE_W0(*instr);
+                    if (callee >= program->num_functions || !pure[callee]) return false;
+                } break;
+
+                case IF_NZ:
+                    VISIT_BLOCK(I_DECODE_A(*instr));
+                    VISIT_BLOCK(I_DECODE_B(*instr));
+                    break;
+
+                case WHEN_NZ:
+                case BLOCK:
+                    VISIT_BLOCK(I_DECODE_A(*instr));
+                    break;
+
+                case SWITCH: {
+                    BlockIndex const* table = (BlockIndex const*) (instr + 1);
+                    for (uint16_t i = 0; i <= I_DECODE_B(*instr); i++) VISIT_BLOCK(table[i]);
+                } break;
+
+                default:
+                    if (opcode > RET_V) return false;
+                    break;
+            }
+
+            if (opcode_ends_block(opcode)) break;
+
+            instr += instruction_length(program->functions, instr);
+        }
+    }
+
+    #undef VISIT_BLOCK
+
+    return true;
+}
+
+// a function is pure when it never reads globals and only calls pure functions;
+// recursion is assumed pure until proven otherwise, so this is the greatest fixpoint
+bool function_is_pure(Program const* program, FunctionIndex index) {
+    bool* pure = malloc(program->num_functions * sizeof(bool));
+    for (FunctionIndex i = 0; i < program->num_functions; i++) pure[i] = true;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (FunctionIndex i = 0; i < program->num_functions; i++) {
+            if (pure[i] && !function_is_locally_pure(program, i, pure)) {
+                pure[i] = false;
+                changed = true;
+            }
+        }
+    }
+
+    bool result = pure[index];
+    free(pure);
+
+    return result;
+}
+
+// links a lazily loaded function and everything it can call, so the purity walk sees their code rather than the
+// LAZY_LINK stubs; false when one of them does not link
+bool function_link_reachable(Program const* program, FunctionIndex index, bool* visited) {
+    if (visited[index]) return true;
+    visited[index] = true;
+
+    Bytecode const* bytecode = &program->functions[index].bytecode;
+    if (I_DECODE_OPCODE(bytecode->instructions[bytecode->blocks[0]]) == LAZY_LINK) {
+        if (program->link == NULL || !program->link(program->link_context, index)) return false;
+    }
+
+    for (BlockIndex b = 0; b < bytecode->num_blocks; b++) {
+        Instruction const* instr = bytecode->instructions + bytecode->blocks[b];
+
+        while (true) {
+            OpCode opcode = I_DECODE_OPCODE(*instr);
+
+            if (opcode == CALL_V || opcode == TAIL_CALL_V) {
+                FunctionIndex callee = I_DECODE_W0(*instr);
+                if (callee >= program->num_functions || !function_link_reachable(program, callee, visited)) return false;
+            }
+
+            if (opcode_ends_block(opcode)) break;
+
+            instr += instruction_length(program->functions, instr);
+        }
+    }
+
+    return true;
+}
+
+bool memoize(Program const* program, FunctionIndex index, size_t capacity) {
+    // the memo table is runtime state hung off of the otherwise immutable function
+    Function* function = (Function*) program->functions + index;
+
+    bool* visited = calloc(program->num_functions, sizeof(bool));
+    bool linked = function_link_reachable(program, index, visited);
+    free(visited);
+
+    if (function->num_args > MEMO_MAX_ARGS || capacity == 0 || !linked || !function_is_pure(program, index)) {
+        return false;
+    }
+
+    if (function->memo == NULL) {
+        function->memo = calloc(1, sizeof(MemoTable));
+    }
+
+    function->memo->capacity = capacity;
+
+    return true;
+}
+
+void memo_report(Program const* program) {
+    for (FunctionIndex i = 0; i < program->num_functions; i++) {
+        MemoTable const* table = program->functions[i].memo;
+        if (table == NULL) continue;
+
+        printf("memo f%d: %lu hits, %lu misses, %lu evictions, %lu/%lu entries\n",
+            i, table->hits, table->misses, table->evictions, stbds_hmlenu(table->entries), table->capacity);
+    }
+}
+
+#define VERIFY_UNBOUNDED UINT32_MAX
+
+typedef struct {
+    FunctionIndex caller;
+    FunctionIndex callee;
+    bool adds_frame;
+    // nesting depth of the block the call is made from, so the caller keeps depth + 1 block frames live across it
+    int16_t block_depth;
+} VerifyCall;
+
+// worst case a call to a function can push onto the fiber's stack, counting its own frame
+typedef struct {
+    uint32_t call_frames; // VERIFY_UNBOUNDED when recursion is reachable
+    uint32_t words;
+} StackBound;
+
+typedef struct {
+    char const* error;
+    FunctionIndex function;
+    InstructionPointer instruction;
+    StackBound* stack_bounds;
+    RegisterIndex max_registers;
+    stbds_arr(VerifyCall) calls;
+} Verification;
+
+#define VERIFY_FAIL(message) { verification->error = message; verification->instruction = ip; return false; }
+#define VERIFY_REGISTER(r) if ((r) >= FRAME_SLOTS(function)) VERIFY_FAIL("register index out of range")
+#define VERIFY_DESTINATION(r) if ((r) >= function->num_registers) VERIFY_FAIL("write to a constant or out of range register")
+#define VERIFY_BLOCK(b, depth) if (!verify_enter_block(block_depth, (b), (depth), function->bytecode.num_blocks, to_visit, &num_to_visit)) VERIFY_FAIL("block index out of range or block entered at two depths")
+#if PACKED_INSTRUCTIONS
+    #define VERIFY_CONSTANT(instr) if (I_DECODE_K(instr) >= function->bytecode.num_constants) VERIFY_FAIL("constant index out of range")
+#else
+    #define VERIFY_CONSTANT(instr)
+#endif
+
+// blocks are only ever entered from one nesting depth, which is what lets BR and RE depths be checked statically
+bool verify_enter_block(int16_t* block_depth, BlockIndex block, int16_t depth, BlockIndex num_blocks, BlockIndex* to_visit, BlockIndex* num_to_visit) {
+    if (block >= num_blocks) return false;
+    if (block_depth[block] >= 0) return block_depth[block] == depth;
+
+    block_depth[block] = depth;
+    to_visit[(*num_to_visit)++] = block;
+    return true;
+}
+
+bool verify_function(Program const* program, FunctionIndex index, Verification* verification) {
+    Function const* function = program->functions + index;
+    Bytecode const* bytecode = &function->bytecode;
+    InstructionPointer ip = 0;
+
+    verification->function = index;
+
+    if (bytecode->num_blocks == 0) VERIFY_FAIL("function has no blocks");
+    if (function->num_args > function->num_registers) VERIFY_FAIL("more arguments than registers");
+    if (bytecode->num_register_constants > bytecode->num_constants) VERIFY_FAIL("register constants past the end of the pool");
+    if (FRAME_SLOTS(function) > MAX_REGISTERS + 1) VERIFY_FAIL("constant registers past the last register index");
+
+    int16_t block_depth [MAX_BLOCKS];
+    for (int b = 0; b < MAX_BLOCKS; b++) block_depth[b] = -1;
+
+    BlockIndex to_visit [MAX_BLOCKS];
+    BlockIndex num_to_visit = 0;
+
+    StackBound* bound = verification->stack_bounds + index;
+    bound->call_frames = 1;
+    bound->words = FRAME_HEADER_WORDS + FRAME_SLOTS(function) + 1;
+
+    VERIFY_BLOCK(0, 0);
+
+    while (num_to_visit > 0) {
+        BlockIndex block = to_visit[--num_to_visit];
+        int16_t depth = block_depth[block];
+
+        uint32_t words = FRAME_HEADER_WORDS + FRAME_SLOTS(function) + (uint32_t) depth + 1;
+        if (words > bound->words) bound->words = words;
+
+        ip = bytecode->blocks[block];
+
+        while (true) {
+            if (ip >= bytecode->num_instructions) VERIFY_FAIL("block runs past the end of its function");
+
+            Instruction instr = bytecode->instructions[ip];
+            OpCode opcode = I_DECODE_OPCODE(instr);
+            InstructionPointerOffset length = 1;
+
+            switch (opcode) {
+                case HALT:
+                    VERIFY_FAIL("HALT outside of the invoke wrapper");
+
+                case LAZY_LINK:
+                    VERIFY_FAIL("function is not linked");
+
+                case UNREACHABLE:
+                    break;
+
+                case READ_GLOBAL_32:
+                case READ_GLOBAL_64:
+                    if (I_DECODE_W0(instr) >= program->num_globals) VERIFY_FAIL("global index out of range");
+                    VERIFY_DESTINATION(I_DECODE_W1(instr));
+                    break;
+
+                case LOAD_GLOBAL_64:
+                    if (I_DECODE_W2_W0(instr) >= program->num_globals) VERIFY_FAIL("global index out of range");
+                    VERIFY_DESTINATION(I_DECODE_W1(instr));
+                    VERIFY_REGISTER(I_DECODE_W2(instr));
+                    break;
+
+                case STORE_GLOBAL_64:
+                    if (I_DECODE_W2_W0(instr) >= program->num_globals) VERIFY_FAIL("global index out of range");
+                    VERIFY_REGISTER(I_DECODE_W1(instr));
+                    VERIFY_REGISTER(I_DECODE_W2(instr));
+                    break;
+
+                case COPY_IM_64:
+                    VERIFY_DESTINATION(I_DECODE_A(instr));
+                    VERIFY_CONSTANT(instr);
+                    length = IM64_LENGTH;
+                    break;
+
+                case COPY_64:
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    VERIFY_DESTINATION(I_DECODE_B(instr));
+                    break;
+
+                case IF_NZ:
+                    VERIFY_REGISTER(I_DECODE_C(instr));
+                    VERIFY_BLOCK(I_DECODE_A(instr), depth + 1);
+                    VERIFY_BLOCK(I_DECODE_B(instr), depth + 1);
+                    break;
+
+                case WHEN_NZ:
+                    VERIFY_REGISTER(I_DECODE_B(instr));
+                    VERIFY_BLOCK(I_DECODE_A(instr), depth + 1);
+                    break;
+
+                case BLOCK:
+                    VERIFY_BLOCK(I_DECODE_A(instr), depth + 1);
+                    break;
+
+                case SWITCH: {
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    length = 1 + CALC_SWITCH_SIZE(I_DECODE_B(instr));
+                    if (ip + length > bytecode->num_instructions) VERIFY_FAIL("jump table runs past the end of its function");
+
+                    BlockIndex const* table = (BlockIndex const*) (bytecode->instructions + ip + 1);
+                    for (uint16_t i = 0; i <= I_DECODE_B(instr); i++) VERIFY_BLOCK(table[i], depth + 1);
+                } break;
+
+                // BR leaves at least the current block, so it may not leave the function's root block
+                case BR:
+                    if (I_DECODE_A(instr) >= depth) VERIFY_FAIL("branch depth out of range");
+                    break;
+
+                case BR_NZ:
+                    if (I_DECODE_A(instr) >= depth) VERIFY_FAIL("branch depth out of range");
+                    VERIFY_REGISTER(I_DECODE_B(instr));
+                    break;
+
+                case RE:
+                    if (I_DECODE_A(instr) > depth) VERIFY_FAIL("restart depth out of range");
+                    break;
+
+                case RE_NZ:
+                    if (I_DECODE_A(instr) > depth) VERIFY_FAIL("restart depth out of range");
+                    VERIFY_REGISTER(I_DECODE_B(instr));
+                    break;
+
+                case LOOP_F64:
+                case LOOP_I64:
+                    if (I_DECODE_C(instr) > depth) VERIFY_FAIL("restart depth out of range");
+                    VERIFY_DESTINATION(I_DECODE_A(instr));
+                    VERIFY_REGISTER(I_DECODE_B(instr));
+                    break;
+
+                case LOOP_IM_F64:
+                case LOOP_IM_I64:
+                    if (I_DECODE_B(instr) > depth) VERIFY_FAIL("restart depth out of range");
+                    VERIFY_DESTINATION(I_DECODE_A(instr));
+                    VERIFY_CONSTANT(instr);
+                    length = IM64_LENGTH;
+                    break;
+
+                case F_ADD_64:
+                case F_SUB_64:
+                case F_MUL_64:
+                case F_DIV_64:
+                case F_ADD_32:
+                case F_SUB_32:
+                case I_ADD_64:
+                case I_SUB_64:
+                case F_EQ_32:
+                case F_LT_32:
+                case F_EQ_64:
+                case F_LT_64:
+                case S_EQ_64:
+                case S_LT_64:
+                case SELECT_64:
+                case SELECT_F_LT_64:
+                case SELECT_S_LT_64:
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    VERIFY_REGISTER(I_DECODE_B(instr));
+                    VERIFY_DESTINATION(I_DECODE_C(instr));
+                    break;
+
+                case F_ADD_IM_32:
+                case F_SUB_IM_A_32:
+                case F_SUB_IM_B_32:
+                case F_EQ_IM_32:
+                case F_LT_IM_A_32:
+                case F_LT_IM_B_32:
+                    VERIFY_CONSTANT(instr);
+                    // fallthrough
+                case F_SQRT_64:
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    VERIFY_DESTINATION(I_DECODE_B(instr));
+                    break;
+
+                case F_ADD_IM_64:
+                case F_SUB_IM_A_64:
+                case F_SUB_IM_B_64:
+                case F_EQ_IM_64:
+                case F_LT_IM_A_64:
+                case F_LT_IM_B_64:
+                case S_EQ_IM_64:
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    VERIFY_DESTINATION(I_DECODE_B(instr));
+                    VERIFY_CONSTANT(instr);
+                    length = IM64_LENGTH;
+                    break;
+
+                case CALL_V:
+                case TAIL_CALL_V: {
+                    FunctionIndex callee = I_DECODE_W0(instr);
+                    if (callee >= program->num_functions) VERIFY_FAIL("function index out of range");
+                    if (opcode == CALL_V) VERIFY_DESTINATION(I_DECODE_W1(instr));
+
+                    RegisterIndex num_args = program->functions[callee].num_args;
+                    length = 1 + CALC_ARG_SIZE(num_args);
+                    if (ip + length > bytecode->num_instructions) VERIFY_FAIL("argument list runs past the end of its function");
+
+                    RegisterIndex const* args = (RegisterIndex const*) (bytecode->instructions + ip + 1);
+                    for (RegisterIndex i = 0; i < num_args; i++) VERIFY_REGISTER(args[i]);
+
+                    VerifyCall call = {index, callee, opcode == CALL_V, depth};
+                    stbds_arrpush(verification->calls, call);
+                } break;
+
+                case RET_V:
+                    VERIFY_REGISTER(I_DECODE_A(instr));
+                    break;
+
+                default:
+                    VERIFY_FAIL("invalid opcode");
+            }
+
+            ip += length;
+            if (ip > bytecode->num_instructions) VERIFY_FAIL("instruction runs past the end of its function");
+
+            if (opcode_ends_block(opcode)) break;
+        }
+    }
+
+    return true;
+}
+
+#undef VERIFY_FAIL
+#undef VERIFY_REGISTER
+#undef VERIFY_DESTINATION
+#undef VERIFY_BLOCK
+#undef VERIFY_CONSTANT
+
+// worst case over the call graph: a call stacks the callee's need on top of the caller's frame and the blocks live at
+// the call site, a tail call replaces the caller's frame. the values only grow, and without a cycle
+// through a call no chain is longer than num_functions frames, so anything past that is unbounded
+void verify_stack_bounds(Program const* program, Verification* verification) {
+    StackBound* bounds = verification->stack_bounds;
+    uint32_t limit = (uint32_t) program->num_functions + 1;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t c = 0; c < stbds_arrlenu(verification->calls); c++) {
+            VerifyCall const* call = verification->calls + c;
+            StackBound* caller = bounds + call->caller;
+            StackBound const* callee = bounds + call->callee;
+            if (caller->call_frames == VERIFY_UNBOUNDED) continue;
+
+            StackBound through = *callee;
+            if (call->adds_frame && through.call_frames != VERIFY_UNBOUNDED) {
+                through.call_frames += 1;
+                through.words += FRAME_HEADER_WORDS + FRAME_SLOTS(program->functions + call->caller) + (uint32_t) call->block_depth + 1;
+            }
+            if (through.call_frames > limit) through.call_frames = VERIFY_UNBOUNDED;
+
+            if (through.call_frames > caller->call_frames) { caller->call_frames = through.call_frames; changed = true; }
+            if (through.words > caller->words) { caller->words = through.words; changed = true; }
+        }
+    }
+}
+
+void verification_free(Verification* verification) {
+    free(verification->stack_bounds);
+    verification->stack_bounds = NULL;
+    stbds_arrfree(verification->calls);
+}
+
+// checks every register, block, branch depth, global and function index against its table so a verified program can
+// run on eval_unchecked; on failure error, function and instruction say where
+bool verify(Program const* program, Verification* verification) {
+    memset(verification, 0, sizeof(Verification));
+
+    verification->stack_bounds = malloc((program->num_functions > 0 ? program->num_functions : 1) * sizeof(StackBound));
+
+    for (FunctionIndex i = 0; i < program->num_functions; i++) {
+        if (!verify_function(program, i, verification)) {
+            verification_free(verification);
+            return false;
+        }
+
+        RegisterIndex num_registers = program->functions[i].num_registers;
+        if (num_registers > verification->max_registers) verification->max_registers = num_registers;
+    }
+
+    verify_stack_bounds(program, verification);
+
+    return true;
+}
+
+// stack an invoke of the entry point can reach, including the wrapper frame invoke_with pushes below it
+StackBound verify_fiber_size(Verification const* verification, FunctionIndex entry) {
+    StackBound bound = verification->stack_bounds[entry];
+    if (bound.call_frames == VERIFY_UNBOUNDED) return bound;
+
+    bound.call_frames += 1;
+    bound.words += FRAME_HEADER_WORDS + 1 + 1;
+    return bound;
+}
+
+// a fiber for a bounded entry point is allocated at exactly the size it can reach, so it never traps on overflow and
+// invoke_verified always runs it on eval_unchecked; recursive entry points get the default fixed-size stacks
+Fiber fiber_create_for(Program const* program, Verification const* verification, FunctionIndex entry) {
+    StackBound size = verify_fiber_size(verification, entry);
+    if (size.call_frames == VERIFY_UNBOUNDED) return fiber_create(program);
+
+    return fiber_create_sized(program, size.words);
+}
+
+// runs on eval_unchecked when the entry point's stack bound is finite and fits in what is left of the fiber's
+// stack; otherwise falls back to the checked eval
+Trap invoke_verified(Verification const* verification, Fiber *restrict fiber, FunctionIndex function, uint64_t* ret_val, uint64_t* args) {
+    StackBound size = verify_fiber_size(verification, function);
+
+    bool fits = size.call_frames != VERIFY_UNBOUNDED
+        && (uint64_t*) (fiber->block_stack + 1) + size.words <= fiber->stack_max;
+
+    return invoke_with(fits ? eval_unchecked : eval, fiber, function, ret_val, args);
+}
+
+#include "module.c"
+#include "optimize.c"
+#include "ir.c"
 
 double ackermann(double m, double n) {
     if (m == 0.0) return n + 1.0;
@@ -1386,149 +2178,262 @@ double loop_ackermann(double m, double n) {
     return a;
 }
 
-int main (int argc, char** argv) {
-    stbds_arr(Function) functions = NULL;
+FunctionIndex encode_ackermann (stbds_arr(Function)* functions) {
+    FunctionIndex ack = (FunctionIndex) stbds_arrlenu(*functions);
 
-    FunctionIndex ack = (FunctionIndex) stbds_arrlenu(functions);
-    {
-        stbds_arr(InstructionPointer) blocks = NULL;
-        Encoder instructions = NULL;
-
-        uint64_t zero = BITCAST(double, uint64_t, 0.0);
-        uint64_t one = BITCAST(double, uint64_t, 1.0);
-        uint64_t two = BITCAST(double, uint64_t, 2.0);
-
-        RegisterIndex m = 0;
-        RegisterIndex n = 1;
-
-        RegisterIndex cond = 2;
-        RegisterIndex m_minus_1 = 2;
-        RegisterIndex n_minus_1 = 3;
-
-        InstructionPointer entry_block =
-            // m == 0
-            encode_2(&instructions, F_EQ_IM_64, m, cond);
-            encode_im64(&instructions, zero);
-            encode_2(&instructions, WHEN_NZ, 1, cond);
-            // n == 0
-            encode_2(&instructions, F_EQ_IM_64, n, cond);
-            encode_im64(&instructions, zero);
-            encode_2(&instructions, WHEN_NZ, 2, cond);
-
-        // fallthrough case
-            // m - 1
-            encode_2(&instructions, F_SUB_IM_B_64, m, m_minus_1);
-            encode_im64(&instructions, one);
-            // n - 1
-            encode_2(&instructions, F_SUB_IM_B_64, n, n_minus_1);
-            encode_im64(&instructions, one);
-
-            encode_w1(&instructions, CALL_V, ack, n_minus_1);
-            encode_registers(&instructions, 2, (RegisterIndex[]){m, n_minus_1});
-
-            encode_w0(&instructions, TAIL_CALL_V, ack);
-            encode_registers(&instructions, 2, (RegisterIndex[]){m_minus_1, n_minus_1});
-
-        stbds_arrpush(blocks, entry_block);
-
-        InstructionPointer m_eql_0 =
-            encode_2(&instructions, F_ADD_IM_64, n, n);
-            encode_im64(&instructions, one);
-            encode_1(&instructions, RET_V, n);
-
-        stbds_arrpush(blocks, m_eql_0);
-
-        InstructionPointer n_eql_0 =
-            encode_2(&instructions, F_SUB_IM_B_64, m, m);
-            encode_im64(&instructions, one);
-            encode_1(&instructions, COPY_IM_64, n);
-            encode_im64(&instructions, one);
-            encode_w0(&instructions, TAIL_CALL_V, ack);
-            encode_registers(&instructions, 2, (RegisterIndex[]){m, n});
-
-        stbds_arrpush(blocks, n_eql_0);
-
-        Bytecode bytecode = {blocks, (Instruction const*) instructions};
-
-        Function function = {2, 4, bytecode};
-        stbds_arrpush(functions, function);
-
-        #if DEBUG_TRACE
-            disas(&function, blocks, (Instruction const*) instructions);
-        #endif
-    }
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
 
-    FunctionIndex loop_ack = (FunctionIndex) stbds_arrlenu(functions);
-    {
-        stbds_arr(InstructionPointer) blocks = NULL;
-        Encoder instructions = NULL;
+    uint64_t zero = BITCAST(double, uint64_t, 0.0);
+    uint64_t one = BITCAST(double, uint64_t, 1.0);
+    uint64_t two = BITCAST(double, uint64_t, 2.0);
 
-        uint64_t zero = BITCAST(double, uint64_t, 0.0);
-        uint64_t one = BITCAST(double, uint64_t, 1.0);
-        uint64_t lc = BITCAST(double, uint64_t, loop_count);
+    RegisterIndex m = 0;
+    RegisterIndex n = 1;
 
-        RegisterIndex m = 0;
-        RegisterIndex n = 1;
-        RegisterIndex i = 2;
-        RegisterIndex a = 3;
-        RegisterIndex b = 4;
-        RegisterIndex cond = 4;
+    RegisterIndex cond = 2;
+    RegisterIndex m_minus_1 = 2;
+    RegisterIndex n_minus_1 = 3;
 
-        InstructionPointer entry_block =
-            encode_1(&instructions, COPY_IM_64, i);
-            encode_im64(&instructions, zero);
-            encode_1(&instructions, COPY_IM_64, a);
-            encode_im64(&instructions, zero);
+    InstructionPointer entry_block =
+        // m == 0
+        encode_2(&instructions, F_EQ_IM_64, m, cond);
+        encode_im64(&instructions, zero);
+        encode_2(&instructions, WHEN_NZ, 1, cond);
+        // n == 0
+        encode_2(&instructions, F_EQ_IM_64, n, cond);
+        encode_im64(&instructions, zero);
+        encode_2(&instructions, WHEN_NZ, 2, cond);
 
-            encode_1(&instructions, BLOCK, 1);
+    // fallthrough case
+        // m - 1
+        encode_2(&instructions, F_SUB_IM_B_64, m, m_minus_1);
+        encode_im64(&instructions, one);
+        // n - 1
+        encode_2(&instructions, F_SUB_IM_B_64, n, n_minus_1);
+        encode_im64(&instructions, one);
 
-            encode_1(&instructions, RET_V, a);
+        encode_w1(&instructions, CALL_V, ack, n_minus_1);
+        encode_registers(&instructions, 2, (RegisterIndex[]){m, n_minus_1});
 
-        stbds_arrpush(blocks, entry_block);
-        
-        InstructionPointer loop_block =
-            encode_2(&instructions, F_EQ_IM_64, i, cond);
-            encode_im64(&instructions, lc);
-            encode_2(&instructions, BR_NZ, 0, cond);
+        encode_w0(&instructions, TAIL_CALL_V, ack);
+        encode_registers(&instructions, 2, (RegisterIndex[]){m_minus_1, n_minus_1});
 
-            encode_w1(&instructions, CALL_V, ack, b);
-            encode_registers(&instructions, 2, (RegisterIndex[]){m, n});
-            encode_3(&instructions, F_ADD_64, a, b, a);
+    stbds_arrpush(blocks, entry_block);
 
-            encode_2(&instructions, F_ADD_IM_64, i, i);
-            encode_im64(&instructions, one);
+    InstructionPointer m_eql_0 =
+        encode_2(&instructions, F_ADD_IM_64, n, n);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, RET_V, n);
 
-            encode_1(&instructions, RE, 0);
-        
-        stbds_arrpush(blocks, loop_block);
+    stbds_arrpush(blocks, m_eql_0);
 
-        Bytecode bytecode = {blocks, (Instruction const*) instructions};
+    InstructionPointer n_eql_0 =
+        encode_2(&instructions, F_SUB_IM_B_64, m, m);
+        encode_im64(&instructions, one);
+        encode_1(&instructions, COPY_IM_64, n);
+        encode_im64(&instructions, one);
+        encode_w0(&instructions, TAIL_CALL_V, ack);
+        encode_registers(&instructions, 2, (RegisterIndex[]){m, n});
 
-        Function function = {2, 5, bytecode};
-        stbds_arrpush(functions, function);
+    stbds_arrpush(blocks, n_eql_0);
 
-        #if DEBUG_TRACE
-            disas(&function, blocks, (Instruction const*) instructions);
-        #endif
-    }
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {2, 4, bytecode};
+    stbds_arrpush(*functions, function);
+
+    #if DEBUG_TRACE
+        disas(*functions, &bytecode);
+    #endif
+
+    return ack;
+}
+
+FunctionIndex encode_loop_ackermann (stbds_arr(Function)* functions, FunctionIndex ack) {
+    FunctionIndex loop_ack = (FunctionIndex) stbds_arrlenu(*functions);
+
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    uint64_t zero = BITCAST(double, uint64_t, 0.0);
+    uint64_t lc = BITCAST(double, uint64_t, loop_count);
+
+    RegisterIndex m = 0;
+    RegisterIndex n = 1;
+    RegisterIndex i = 2;
+    RegisterIndex a = 3;
+    RegisterIndex b = 4;
+    RegisterIndex cond = 4;
+
+    // the test runs once in front of the loop, after that LOOP_IM_F64 steps i, compares it and restarts in one go
+    InstructionPointer entry_block =
+        encode_1(&instructions, COPY_IM_64, i);
+        encode_im64(&instructions, zero);
+        encode_1(&instructions, COPY_IM_64, a);
+        encode_im64(&instructions, zero);
+
+        encode_2(&instructions, F_EQ_IM_64, i, cond);
+        encode_im64(&instructions, lc);
+        encode_3(&instructions, IF_NZ, 2, 1, cond);
+
+        encode_1(&instructions, RET_V, a);
+
+    stbds_arrpush(blocks, entry_block);
+    
+    InstructionPointer loop_block =
+        encode_w1(&instructions, CALL_V, ack, b);
+        encode_registers(&instructions, 2, (RegisterIndex[]){m, n});
+        encode_3(&instructions, F_ADD_64, a, b, a);
+
+        encode_2(&instructions, LOOP_IM_F64, i, 0);
+        encode_im64(&instructions, lc);
+        encode_1(&instructions, BR, 0);
+    
+    stbds_arrpush(blocks, loop_block);
+
+    InstructionPointer done_block =
+        encode_1(&instructions, BR, 0);
+
+    stbds_arrpush(blocks, done_block);
+
+    Bytecode bytecode = encode_bytecode(&instructions, blocks);
+
+    Function function = {2, 5, bytecode};
+    stbds_arrpush(*functions, function);
+
+    #if DEBUG_TRACE
+        disas(*functions, &bytecode);
+    #endif
+
+    return loop_ack;
+}
+
+#ifndef INTERP_NO_MAIN
+int main (int argc, char** argv) {
+    stbds_arr(Function) functions = NULL;
+
+    FunctionIndex ack = encode_ackermann(&functions);
+    FunctionIndex loop_ack = encode_loop_ackermann(&functions, ack);
 
     Program program = {
         .functions = functions,
         .globals = NULL,
+        .num_functions = (FunctionIndex) stbds_arrlenu(functions),
     };
 
-    uint64_t* data_stack = malloc(STACK_SIZE);
-    CallFrame* call_stack = malloc(sizeof(CallFrame) * MAX_CALL_FRAMES);
-    BlockFrame* block_stack = malloc(sizeof(BlockFrame) * MAX_CALL_FRAMES * MAX_BLOCKS);
+    bool use_memo = false;
+    char const* sample_path = NULL;
+    char const* call_graph_path = NULL;
+    char const* emit_path = NULL;
+    char const* load_path = NULL;
+    bool lazy = false;
+    bool use_optimizer = false;
+    bool use_ir = false;
+    Evaluator evaluator = eval;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--memo") == 0) {
+            use_memo = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            evaluator = eval_profiled;
+            atexit(profile_report_at_exit);
+        } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+            sample_path = argv[++i];
+        } else if (strcmp(argv[i], "--callgraph") == 0 && i + 1 < argc) {
+            call_graph_path = argv[++i];
+            evaluator = eval_call_profiled;
+        } else if (strcmp(argv[i], "--emit") == 0 && i + 1 < argc) {
+            emit_path = argv[++i];
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            load_path = argv[++i];
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = true;
+        } else if (strcmp(argv[i], "--optimize") == 0) {
+            use_optimizer = true;
+        } else if (strcmp(argv[i], "--ir") == 0) {
+            use_ir = true;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 4;
+        }
+    }
 
-    Fiber fiber = {
-        .program = &program,
-        .call_stack = call_stack,
-        .call_stack_max = call_stack + MAX_CALL_FRAMES,
-        .block_stack = block_stack,
-        .data_stack = data_stack,
-        .data_stack_max = data_stack + STACK_SIZE,
-    };
+    // the sampler reads fiber state from a signal handler, which only the evaluators built with EVAL_SAMPLED fence
+    if (sample_path != NULL && evaluator == eval) evaluator = eval_sampled;
+
+    // the optimizer and the IR round trip rewrite the built-in functions before anything is emitted; they trust
+    // their input, so that is verified first, and the output goes through the verifier again below, before it is
+    // emitted or run
+    if (use_optimizer || use_ir) {
+        if (load_path != NULL) {
+            printf("--optimize and --ir apply to the built-in functions, not to a loaded module\n");
+            return 4;
+        }
+
+        Verification input = {};
+        if (!verify(&program, &input)) {
+            printf("Verification failed in f%d at i%d: %s\n", input.function, input.instruction, input.error);
+            return 6;
+        }
+        verification_free(&input);
+    }
+
+    if (use_optimizer) {
+        OptimizeReport report;
+        optimize(functions, program.num_functions, &report);
+        optimize_report(stdout, &report);
+        optimize_report_free(&report);
+    }
+
+    // lifts every function to IR, lists it, and lowers it back in place of the bytecode
+    if (use_ir) {
+        FunctionIndex lowered = 0;
+        for (FunctionIndex i = 0; i < program.num_functions; i++) lowered += ir_round_trip(functions, i, stdout);
+        printf("ir: %d of %d functions lowered from IR\n", lowered, program.num_functions);
+    }
+
+    // the built-in functions are verified before they can be emitted, so a module never holds bytecode the verifier
+    // rejects; a loaded module replaces them and is verified on its own below
+    Verification verification = {};
+    if (load_path == NULL && !verify(&program, &verification)) {
+        printf("Verification failed in f%d at i%d: %s\n", verification.function, verification.instruction, verification.error);
+        return 6;
+    }
+
+    if (emit_path != NULL) {
+        FILE* module_file = fopen(emit_path, "wb");
+        if (module_file == NULL || !module_write(module_file, &program, loop_ack, 0, NULL)) {
+            printf("Cannot write module %s\n", emit_path);
+            return 5;
+        }
+        fclose(module_file);
+    }
+
+    Module module = {};
+    if (load_path != NULL) {
+        char const* error = module_load(load_path, &module, lazy);
+        if (error != NULL) {
+            printf("Cannot load module %s: %s\n", load_path, error);
+            return 5;
+        }
+
+        program = module.program;
+        loop_ack = module.entry;
+    }
+
+    // a lazy module is not resident yet; its functions are validated as they link and run on the checked eval
+    if (load_path != NULL && !lazy && !verify(&program, &verification)) {
+        printf("Verification failed in f%d at i%d: %s\n", verification.function, verification.instruction, verification.error);
+        return 6;
+    }
+
+    if (use_memo && !memoize(&program, ack, MEMO_DEFAULT_CAPACITY)) {
+        printf("Cannot memoize f%d: function is impure or does not link\n", ack);
+        return 3;
+    }
+
+    Fiber fiber = lazy ? fiber_create(&program) : fiber_create_for(&program, &verification, loop_ack);
 
     uint64_t ret_val = 0xdeadbeef;
     double m = 3.0;
@@ -1536,22 +2441,67 @@ int main (int argc, char** argv) {
     uint64_t args [2] = {BITCAST(double, uint64_t, m), BITCAST(double, uint64_t, n)};
     double expected = loop_ackermann(m, n);
 
+    CallGraph call_graph = {};
+    if (call_graph_path != NULL) call_graph_attach(&fiber, &call_graph);
+
+    if (sample_path != NULL && !sampler_start(&fiber, SAMPLE_DEFAULT_FREQUENCY, SAMPLE_DEFAULT_CAPACITY)) {
+        printf("Cannot start sampling profiler\n");
+        return 5;
+    }
+
     clock_t start = clock();
-    Trap result = invoke(&fiber, loop_ack, &ret_val, args);
+    Trap result = evaluator == eval && !lazy
+        ? invoke_verified(&verification, &fiber, loop_ack, &ret_val, args)
+        : invoke_with(evaluator, &fiber, loop_ack, &ret_val, args);
     clock_t end = clock();
 
+    if (sample_path != NULL) {
+        sampler_stop();
+
+        FILE* sample_file = fopen(sample_path, "w");
+        if (sample_file == NULL) {
+            printf("Cannot open %s\n", sample_path);
+            return 5;
+        }
+
+        sampler_write_folded(sample_file, &program);
+        fclose(sample_file);
+
+        printf("Wrote %lu samples to %s (%lu dropped)\n", sampler.num_samples, sample_path, sampler.dropped);
+    }
+
     double elapsed = (((double) (end - start)) / ((double) CLOCKS_PER_SEC));
 
+    if (call_graph_path != NULL) {
+        FILE* call_graph_file = fopen(call_graph_path, "w");
+        if (call_graph_file == NULL) {
+            printf("Cannot open %s\n", call_graph_path);
+            return 5;
+        }
+
+        size_t path_length = strlen(call_graph_path);
+        if (path_length >= 5 && strcmp(call_graph_path + path_length - 5, ".json") == 0) {
+            call_graph_write_json(call_graph_file, &call_graph);
+        } else {
+            call_graph_write_callgrind(call_graph_file, &call_graph);
+        }
+
+        fclose(call_graph_file);
+    }
+
     if (result == OKAY) {
         double res = BITCAST(uint64_t, double, ret_val);
         printf("Result: %f (in %fs) [expected %f]\n", res, elapsed, expected);
+        if (use_memo) memo_report(&program);
         if (res != expected) {
             return 1;
         }
     } else {
         printf("Trap: %s\n", trap_name(result));
+        if (result == TRAP_LINK_FAILED) printf("Link error: %s\n", module.link_error);
         return 2;
     }
 
     return 0;
 }
+#endif
@@ -0,0 +1,34 @@
+function mandelbrot(size, max_iterations)
+    local scale = 2.0 / size
+    local count = 0.0
+    local y = 0.0
+    while y ~= size do
+        local ci = y * scale - 1.0
+        local x = 0.0
+        while x ~= size do
+            local cr = x * scale - 1.5
+            local zr, zi = 0.0, 0.0
+            local i = 0.0
+            while true do
+                if i == max_iterations then
+                    count = count + 1.0
+                    break
+                end
+                local zr2, zi2 = zr * zr, zi * zi
+                if 4.0 < zr2 + zi2 then break end
+                zi = zr * zi * 2.0 + ci
+                zr = zr2 - zi2 + cr
+                i = i + 1.0
+            end
+            x = x + 1.0
+        end
+        y = y + 1.0
+    end
+    return count
+end
+
+local start = os.clock()
+local result = mandelbrot(200.0, 50.0)
+local stop = os.clock()
+
+print(result, "(in ", stop - start, "s)")
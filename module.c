@@ -0,0 +1,373 @@
+// module.c is the on-disk form of a Program. The file is mapped privately and executed in place: block tables and
+// instructions are used straight out of the mapping, so every process that loads the same module shares one page
+// cache copy of the code, and only the pages of globals that a process stores to get copied.
+//
+// layout, every section aligned to 8 bytes:
+//     ModuleHeader
+//     ModuleFunction [num_functions]
+//     ModuleGlobal [num_globals]
+//     per function: InstructionPointer blocks [num_blocks], Instruction instructions [num_instructions],
+//                   uint64_t constants [num_constants], the first num_register_constants of them copied into
+//                   every frame of the function
+//     per global: bytes [size]
+// all offsets are from the start of the file and all block offsets are relative to the function's instructions,
+// so the image is position independent. the header records the instruction width it was written with, and a build
+// using the other encoding refuses to load it.
+//
+// a lazily loaded module starts every function out as a stub whose only instruction is LAZY_LINK; the first call
+// into the stub validates and installs that one function, so the work done at startup does not grow with the code
+// a process never runs.
+
+#define MODULE_MAGIC "BCMODULE"
+#define MODULE_VERSION 8
+#define MODULE_ALIGN(x) (((x) + alignof(uint64_t) - 1) & ~((uint64_t) alignof(uint64_t) - 1))
+
+typedef struct {
+    char magic [8];
+    uint32_t version;
+    uint32_t num_functions;
+    uint32_t num_globals;
+    uint32_t entry;
+    uint32_t instruction_size;
+    uint32_t reserved;
+    uint64_t functions;
+    uint64_t globals;
+    uint64_t size;
+} ModuleHeader;
+
+typedef struct {
+    RegisterIndex num_args;
+    RegisterIndex num_registers;
+    BlockIndex num_blocks;
+    uint8_t reserved;
+    uint32_t num_constants;
+    uint32_t num_register_constants;
+    uint32_t unused;
+    uint64_t blocks;
+    uint64_t instructions;
+    uint64_t num_instructions;
+    uint64_t constants;
+} ModuleFunction;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} ModuleGlobal;
+
+typedef struct {
+    void* mapping;
+    size_t size;
+    FunctionIndex entry;
+    Function* functions;
+    uint8_t** globals;
+    char const* link_error;
+    Program program;
+} Module;
+
+InstructionPointer const module_stub_blocks [1] = { 0 };
+Instruction const module_stub_instructions [1] = { I_ENCODE_0(LAZY_LINK) };
+
+bool module_write_at(FILE* out, uint64_t offset, void const* data, size_t size) {
+    return fseek(out, (long) offset, SEEK_SET) == 0 && fwrite(data, 1, size, out) == size;
+}
+
+bool module_write(FILE* out, Program const* program, FunctionIndex entry, GlobalIndex num_globals, size_t const* global_sizes) {
+    ModuleHeader header = {
+        .magic = MODULE_MAGIC,
+        .version = MODULE_VERSION,
+        .num_functions = program->num_functions,
+        .num_globals = num_globals,
+        .entry = entry,
+        .instruction_size = sizeof(Instruction),
+    };
+
+    uint64_t offset = MODULE_ALIGN(sizeof(ModuleHeader));
+    header.functions = offset;
+    offset = MODULE_ALIGN(offset + program->num_functions * sizeof(ModuleFunction));
+    header.globals = offset;
+    offset = MODULE_ALIGN(offset + num_globals * sizeof(ModuleGlobal));
+
+    for (FunctionIndex i = 0; i < program->num_functions; i++) {
+        Function const* function = program->functions + i;
+        Bytecode const* bytecode = &function->bytecode;
+
+        ModuleFunction descriptor = {
+            .num_args = function->num_args,
+            .num_registers = function->num_registers,
+            .num_blocks = bytecode->num_blocks,
+            .num_instructions = bytecode->num_instructions,
+            .num_constants = bytecode->num_constants,
+            .num_register_constants = bytecode->num_register_constants,
+        };
+
+        descriptor.blocks = offset;
+        offset = MODULE_ALIGN(offset + bytecode->num_blocks * sizeof(InstructionPointer));
+        descriptor.instructions = offset;
+        offset = MODULE_ALIGN(offset + descriptor.num_instructions * sizeof(Instruction));
+        descriptor.constants = offset;
+        offset += descriptor.num_constants * sizeof(uint64_t);
+
+        if (!module_write_at(out, header.functions + i * sizeof(ModuleFunction), &descriptor, sizeof(descriptor))
+         || !module_write_at(out, descriptor.blocks, bytecode->blocks, bytecode->num_blocks * sizeof(InstructionPointer))
+         || !module_write_at(out, descriptor.instructions, bytecode->instructions, descriptor.num_instructions * sizeof(Instruction))
+         || !module_write_at(out, descriptor.constants, bytecode->constants, descriptor.num_constants * sizeof(uint64_t))
+        ) {
+            return false;
+        }
+    }
+
+    for (GlobalIndex i = 0; i < num_globals; i++) {
+        ModuleGlobal global = { offset, global_sizes[i] };
+        offset = MODULE_ALIGN(offset + global.size);
+
+        if (!module_write_at(out, header.globals + i * sizeof(ModuleGlobal), &global, sizeof(global))
+         || !module_write_at(out, global.offset, program->globals[i], global.size)
+        ) {
+            return false;
+        }
+    }
+
+    header.size = offset;
+
+    if (!module_write_at(out, 0, &header, sizeof(header)) || fseek(out, 0, SEEK_END) != 0) return false;
+
+    // pad the tail so the file is exactly header.size long, without touching a last section that already ends there
+    long end = ftell(out);
+    return end >= 0 && ((uint64_t) end >= offset || module_write_at(out, offset - 1, "", 1));
+}
+
+bool module_in_bounds(Module const* module, uint64_t offset, uint64_t size, size_t alignment) {
+    return offset % alignment == 0 && offset <= module->size && size <= module->size - offset;
+}
+
+// walks every block once so eval never meets an unknown opcode, a truncated instruction or an index past a table
+char const* module_validate_bytecode(Module const* module, Bytecode const* bytecode) {
+    Instruction const* instructions = bytecode->instructions;
+    InstructionPointer num_instructions = bytecode->num_instructions;
+    uint32_t num_globals = ((ModuleHeader const*) module->mapping)->num_globals;
+
+    if (bytecode->num_blocks == 0) return "function has no blocks";
+
+    for (BlockIndex b = 0; b < bytecode->num_blocks; b++) {
+        InstructionPointer ip = bytecode->blocks[b];
+
+        while (true) {
+            if (ip >= num_instructions) return "block runs past the end of its function";
+
+            Instruction instr = instructions[ip];
+            OpCode opcode = I_DECODE_OPCODE(instr);
+
+            switch (opcode) {
+                case READ_GLOBAL_32:
+                case READ_GLOBAL_64:
+                    if (I_DECODE_W0(instr) >= num_globals) return "global index out of range";
+                    break;
+
+                case LOAD_GLOBAL_64:
+                case STORE_GLOBAL_64:
+                    if (I_DECODE_W2_W0(instr) >= num_globals) return "global index out of range";
+                    break;
+
+                case IF_NZ:
+                    if (I_DECODE_B(instr) >= bytecode->num_blocks) return "block index out of range";
+                    // fallthrough
+                case WHEN_NZ:
+                case BLOCK:
+                    if (I_DECODE_A(instr) >= bytecode->num_blocks) return "block index out of range";
+                    break;
+
+                case SWITCH: {
+                    if (ip + 1 + CALC_SWITCH_SIZE(I_DECODE_B(instr)) > num_instructions) return "jump table runs past the end of its function";
+                    BlockIndex const* table = (BlockIndex const*) (instructions + ip + 1);
+                    for (uint16_t i = 0; i <= I_DECODE_B(instr); i++) {
+                        if (table[i] >= bytecode->num_blocks) return "block index out of range";
+                    }
+                } break;
+
+                case CALL_V:
+                case TAIL_CALL_V:
+                    if (I_DECODE_W0(instr) >= module->program.num_functions) return "function index out of range";
+                    break;
+
+                case LAZY_LINK:
+                    return "LAZY_LINK is reserved for loader stubs";
+
+                default:
+                    if (opcode > RET_V) return "invalid opcode";
+                    #if PACKED_INSTRUCTIONS
+                        if (opcode_has_immediate(opcode) && I_DECODE_K(instr) >= bytecode->num_constants) {
+                            return "constant index out of range";
+                        }
+                    #endif
+                    break;
+            }
+
+            ip += instruction_length(module->functions, instructions + ip);
+            if (ip > num_instructions) return "instruction runs past the end of its function";
+
+            if (opcode_ends_block(opcode)) break;
+        }
+    }
+
+    return NULL;
+}
+
+char const* module_link_function(Module* module, FunctionIndex index) {
+    uint8_t* base = module->mapping;
+    ModuleHeader const* header = (ModuleHeader const*) base;
+    ModuleFunction const* descriptor = (ModuleFunction const*) (base + header->functions) + index;
+
+    if (!module_in_bounds(module, descriptor->blocks, descriptor->num_blocks * sizeof(InstructionPointer), alignof(InstructionPointer))) {
+        return "block table out of bounds";
+    }
+    if (descriptor->num_instructions > UINT32_MAX) return "function too long";
+    if (!module_in_bounds(module, descriptor->instructions, descriptor->num_instructions * sizeof(Instruction), alignof(Instruction))) {
+        return "instructions out of bounds";
+    }
+
+    // the constant pool was checked when the stub was made
+    Bytecode bytecode = {
+        (InstructionPointer const*) (base + descriptor->blocks),
+        (Instruction const*) (base + descriptor->instructions),
+        descriptor->num_blocks,
+        (InstructionPointer) descriptor->num_instructions,
+        (uint64_t const*) (base + descriptor->constants),
+        descriptor->num_constants,
+        descriptor->num_register_constants,
+    };
+
+    char const* error = module_validate_bytecode(module, &bytecode);
+    if (error != NULL) return error;
+
+    // a lazy module never goes through verify, so registers, depths and argument counts are checked here. the
+    // verifier reads the bytecode through the program, and the callees' arities come from the stubs' descriptors
+    Bytecode stub = module->functions[index].bytecode;
+    module->functions[index].bytecode = bytecode;
+
+    Verification verification = { .stack_bounds = calloc(module->program.num_functions, sizeof(StackBound)) };
+    if (!verify_function(&module->program, index, &verification)) {
+        module->functions[index].bytecode = stub;
+        error = verification.error;
+    }
+    verification_free(&verification);
+
+    return error;
+}
+
+// Program.link for lazily loaded modules, called by LAZY_LINK
+bool module_link(void* context, FunctionIndex index) {
+    Module* module = context;
+
+    char const* error = module_link_function(module, index);
+    if (error != NULL) {
+        module->link_error = error;
+        return false;
+    }
+
+    return true;
+}
+
+void module_unload(Module* module) {
+    if (module->mapping != NULL) munmap(module->mapping, module->size);
+    free(module->functions);
+    free(module->globals);
+    memset(module, 0, sizeof(Module));
+}
+
+// returns NULL on success or a description of the first problem found; the module is left unloaded on failure.
+// a lazy module links functions on first call and must stay at the same address while its program runs
+char const* module_load(char const* path, Module* module, bool lazy) {
+    memset(module, 0, sizeof(Module));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return "cannot open module";
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(ModuleHeader)) {
+        close(fd);
+        return "module is too small";
+    }
+
+    module->size = (size_t) status.st_size;
+    module->mapping = mmap(NULL, module->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (module->mapping == MAP_FAILED) {
+        module->mapping = NULL;
+        return "cannot map module";
+    }
+
+    uint8_t* base = module->mapping;
+    ModuleHeader const* header = (ModuleHeader const*) base;
+
+    char const* error = NULL;
+
+    #define MODULE_CHECK(condition, message) if (!(condition)) { error = message; goto failed; }
+
+    MODULE_CHECK(memcmp(header->magic, MODULE_MAGIC, sizeof(header->magic)) == 0, "not a module");
+    MODULE_CHECK(header->version == MODULE_VERSION, "unsupported module version");
+    MODULE_CHECK(header->instruction_size == sizeof(Instruction), "module was written with another instruction encoding");
+    MODULE_CHECK(header->size == module->size, "module size does not match its header");
+    MODULE_CHECK(header->num_functions > 0 && header->num_functions <= UINT16_MAX, "bad function count");
+    MODULE_CHECK(header->num_globals <= UINT16_MAX, "bad global count");
+    MODULE_CHECK(header->entry < header->num_functions, "entry function out of range");
+    MODULE_CHECK(module_in_bounds(module, header->functions, header->num_functions * sizeof(ModuleFunction), alignof(uint64_t)), "function table out of bounds");
+    MODULE_CHECK(module_in_bounds(module, header->globals, header->num_globals * sizeof(ModuleGlobal), alignof(uint64_t)), "global table out of bounds");
+
+    ModuleFunction const* descriptors = (ModuleFunction const*) (base + header->functions);
+    ModuleGlobal const* globals = (ModuleGlobal const*) (base + header->globals);
+
+    module->functions = calloc(header->num_functions, sizeof(Function));
+    module->globals = calloc(header->num_globals > 0 ? header->num_globals : 1, sizeof(uint8_t*));
+    module->entry = (FunctionIndex) header->entry;
+
+    for (uint32_t i = 0; i < header->num_functions; i++) {
+        ModuleFunction const* descriptor = descriptors + i;
+
+        // a call copies the register constants into the frame before LAZY_LINK runs, so the stub already carries them
+        MODULE_CHECK(descriptor->num_register_constants <= descriptor->num_constants, "register constants past the end of the pool");
+        MODULE_CHECK((uint32_t) descriptor->num_registers + descriptor->num_register_constants <= MAX_REGISTERS + 1, "too many constants");
+        MODULE_CHECK(module_in_bounds(module, descriptor->constants, descriptor->num_constants * sizeof(uint64_t), alignof(uint64_t)), "constants out of bounds");
+
+        Bytecode stub = {
+            module_stub_blocks,
+            module_stub_instructions,
+            1,
+            1,
+            (uint64_t const*) (base + descriptor->constants),
+            descriptor->num_constants,
+            descriptor->num_register_constants,
+        };
+
+        module->functions[i] = (Function) {descriptor->num_args, descriptor->num_registers, stub};
+    }
+
+    for (uint32_t i = 0; i < header->num_globals; i++) {
+        MODULE_CHECK(module_in_bounds(module, globals[i].offset, globals[i].size, alignof(uint64_t)), "global out of bounds");
+        module->globals[i] = base + globals[i].offset;
+    }
+
+    module->program = (Program) {
+        .functions = module->functions,
+        .globals = module->globals,
+        .num_globals = (GlobalIndex) header->num_globals,
+        .num_functions = (FunctionIndex) header->num_functions,
+        .link = lazy ? module_link : NULL,
+        .link_context = lazy ? module : NULL,
+    };
+
+    if (!lazy) {
+        for (uint32_t i = 0; i < header->num_functions; i++) {
+            error = module_link_function(module, (FunctionIndex) i);
+            if (error != NULL) goto failed;
+        }
+    }
+
+    #undef MODULE_CHECK
+
+    return NULL;
+
+failed:
+    module_unload(module);
+    return error;
+}
@@ -0,0 +1,95 @@
+local pi = 3.141592653589793
+local solar_mass = 4.0 * pi * pi
+local days_per_year = 365.24
+
+local function body(x, y, z, vx, vy, vz, mass)
+    return {
+        x = x, y = y, z = z,
+        vx = vx * days_per_year, vy = vy * days_per_year, vz = vz * days_per_year,
+        mass = mass * solar_mass,
+    }
+end
+
+local bodies = {
+    body(0, 0, 0, 0, 0, 0, 1),
+    body(
+        4.84143144246472090e+00, -1.16032004402742839e+00, -1.03622044471123109e-01,
+        1.66007664274403694e-03, 7.69901118419740425e-03, -6.90460016972063023e-05,
+        9.54791938424326609e-04),
+    body(
+        8.34336671824457987e+00, 4.12479856412430479e+00, -4.03523417114321381e-01,
+        -2.76742510726862411e-03, 4.99852801234917238e-03, 2.30417297573763929e-05,
+        2.85885980666130812e-04),
+    body(
+        1.28943695621391310e+01, -1.51111514016986312e+01, -2.23307578892655734e-01,
+        2.96460137564761618e-03, 2.37847173959480950e-03, -2.96589568540237556e-05,
+        4.36624404335156298e-05),
+    body(
+        1.53796971148509165e+01, -2.59193146099879641e+01, 1.79258772950371181e-01,
+        2.68067772490389322e-03, 1.62824170038242295e-03, -9.51592254519715870e-05,
+        5.15138902046611451e-05),
+}
+
+local function offset_momentum()
+    local px, py, pz = 0.0, 0.0, 0.0
+    for _, b in ipairs(bodies) do
+        px = px + b.vx * b.mass
+        py = py + b.vy * b.mass
+        pz = pz + b.vz * b.mass
+    end
+    bodies[1].vx = -px / solar_mass
+    bodies[1].vy = -py / solar_mass
+    bodies[1].vz = -pz / solar_mass
+end
+
+local function advance(dt)
+    local n = #bodies
+    for i = 1, n do
+        local bi = bodies[i]
+        for j = i + 1, n do
+            local bj = bodies[j]
+            local dx, dy, dz = bi.x - bj.x, bi.y - bj.y, bi.z - bj.z
+            local d2 = dx * dx + dy * dy + dz * dz
+            local mag = dt / (d2 * math.sqrt(d2))
+            local mj_mag, mi_mag = bj.mass * mag, bi.mass * mag
+            bi.vx = bi.vx - dx * mj_mag
+            bj.vx = bj.vx + dx * mi_mag
+            bi.vy = bi.vy - dy * mj_mag
+            bj.vy = bj.vy + dy * mi_mag
+            bi.vz = bi.vz - dz * mj_mag
+            bj.vz = bj.vz + dz * mi_mag
+        end
+    end
+    for _, b in ipairs(bodies) do
+        b.x = b.x + dt * b.vx
+        b.y = b.y + dt * b.vy
+        b.z = b.z + dt * b.vz
+    end
+end
+
+local function energy()
+    local e = 0.0
+    local n = #bodies
+    for i = 1, n do
+        local bi = bodies[i]
+        e = e + (bi.vx * bi.vx + bi.vy * bi.vy + bi.vz * bi.vz) * bi.mass * 0.5
+        for j = i + 1, n do
+            local bj = bodies[j]
+            local dx, dy, dz = bi.x - bj.x, bi.y - bj.y, bi.z - bj.z
+            e = e - bi.mass * bj.mass / math.sqrt(dx * dx + dy * dy + dz * dz)
+        end
+    end
+    return e
+end
+
+function nbody(steps)
+    offset_momentum()
+    for step = 1, steps do advance(0.01) end
+    return energy()
+end
+
+local start = os.clock()
+local result = nbody(50000)
+local stop = os.clock()
+
+print(string.format("%.17g", result), "(in ", stop - start, "s)")
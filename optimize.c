@@ -0,0 +1,2255 @@
+// optimize.c rewrites verified bytecode into equivalent, cheaper bytecode. A function is decoded into one instruction
+// list per block, the passes rewrite those lists, and the result goes back through the same encoder frontends use.
+// Control flow stays structured throughout: a pass may turn a conditional branch into an unconditional one or drop a
+// block, but every block is still entered from a single nesting depth, so the output verifies whenever the input did.
+//
+// the analyses run over a graph with one node per instruction. Entering a block leads to its first instruction, BR
+// leads past every instruction that can have entered the blocks being left, and RE leads back to the first
+// instruction of the block it restarts. A block entered from several places merges the facts of all of them, which is
+// conservative but never wrong.
+
+typedef struct {
+    OpCode opcode;
+    // byte operands at their encoded positions: W1 is c and W2 is b
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    // W0, or the global of the W2 form
+    uint16_t w;
+    uint64_t immediate;
+    // CALL_V and TAIL_CALL_V: where the argument registers start in DecodedFunction.args, SWITCH: where its table
+    // starts in DecodedFunction.tables, with the number of cases in b
+    uint32_t args;
+} DecodedInstruction;
+
+// the most blocks one instruction enters: a SWITCH's default and up to UINT8_MAX cases
+#define MAX_TARGETS (UINT8_MAX + 1)
+
+typedef struct {
+    RegisterIndex num_args;
+    RegisterIndex num_registers;
+    stbds_arr(uint64_t) constants;
+    // one instruction list per block, each ending in the instruction that ends the block
+    stbds_arr(stbds_arr(DecodedInstruction)) blocks;
+    stbds_arr(RegisterIndex) args;
+    stbds_arr(BlockIndex) tables;
+} DecodedFunction;
+
+// why a call was or was not inlined
+typedef ENUM_T(uint8_t) {
+    INLINE_DONE,
+    INLINE_RECURSIVE,      // the callee can reach itself
+    INLINE_TOO_LARGE,      // more than INLINE_MAX_INSTRUCTIONS
+    INLINE_TAIL_CALL,      // a tail call in the callee would return from the caller
+    INLINE_NOT_RESIDENT,   // the callee is a lazy stub
+    INLINE_MEMOIZED,       // the call has to go through the callee's memo table
+    INLINE_NO_REGISTERS,   // the callee's registers and constants do not fit in the caller's frame
+    INLINE_NO_BLOCKS,      // the callee's blocks do not fit in the caller's block indices
+} InlineOutcome;
+
+typedef struct {
+    FunctionIndex caller;
+    FunctionIndex callee;
+    InlineOutcome outcome;
+} InlineDecision;
+
+// callees above this many instructions stay calls
+#define INLINE_MAX_INSTRUCTIONS 32
+
+typedef struct {
+    stbds_arr(InlineDecision) decisions; // one per CALL_V the inliner looked at
+    uint32_t inlined;      // calls replaced by a copy of the callee
+    uint32_t loops;        // self tail calls replaced by a restart of the root block
+    uint32_t hoisted;      // loop invariant instructions moved in front of their loop
+    uint32_t counted;      // counted loops moved onto the LOOP_ instructions
+    uint32_t folded;       // instructions replaced by the constant they compute
+    uint32_t propagated;   // register reads redirected to the original of a copy
+    uint32_t immediates;   // generic instructions moved onto an _IM_ form or a constant register
+    uint32_t branches;     // conditional branches and selects decided at compile time
+    uint32_t selects;      // conditional assignments turned into SELECT_ instructions
+    uint32_t dead;         // instructions removed because nothing reads what they write
+    uint32_t blocks;       // unreachable blocks removed
+    uint32_t coalesced;    // copies whose source and destination the allocator gave one register
+    uint64_t registers_before;
+    uint64_t registers_after;
+    uint64_t words_before;
+    uint64_t words_after;
+} OptimizeReport;
+
+bool opcode_has_immediate_32(OpCode opcode) {
+    switch (opcode) {
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+        case F_EQ_IM_32:
+        case F_LT_IM_A_32:
+        case F_LT_IM_B_32:
+            return true;
+        default:
+            return false;
+    }
+}
+
+DecodedInstruction decode_instruction(Function const* functions, Bytecode const* bytecode, Instruction const* instr, DecodedFunction* function) {
+    OpCode opcode = I_DECODE_OPCODE(*instr);
+    DecodedInstruction decoded = { opcode, I_DECODE_A(*instr), I_DECODE_B(*instr), I_DECODE_C(*instr) };
+
+    switch (opcode) {
+        case READ_GLOBAL_32:
+        case READ_GLOBAL_64:
+            decoded = (DecodedInstruction) { .opcode = opcode, .c = I_DECODE_W1(*instr), .w = I_DECODE_W0(*instr) };
+            break;
+
+        case LOAD_GLOBAL_64:
+        case STORE_GLOBAL_64:
+            decoded = (DecodedInstruction) { .opcode = opcode, .b = I_DECODE_W2(*instr), .c = I_DECODE_W1(*instr), .w = I_DECODE_W2_W0(*instr) };
+            break;
+
+        // the restart depth is in c for every LOOP_ instruction, the immediate forms keep it in b
+        case LOOP_IM_F64:
+        case LOOP_IM_I64:
+            decoded = (DecodedInstruction) { .opcode = opcode, .a = I_DECODE_A(*instr), .c = I_DECODE_B(*instr), .immediate = I_IMMEDIATE_64(uint64_t, *instr, bytecode->constants, instr[1]) };
+            break;
+
+        case CALL_V:
+        case TAIL_CALL_V: {
+            decoded = (DecodedInstruction) { .opcode = opcode, .w = I_DECODE_W0(*instr), .args = (uint32_t) stbds_arrlenu(function->args) };
+            if (opcode == CALL_V) decoded.c = I_DECODE_W1(*instr);
+
+            RegisterIndex const* registers = (RegisterIndex const*) (instr + 1);
+            for (RegisterIndex i = 0; i < functions[decoded.w].num_args; i++) stbds_arrpush(function->args, registers[i]);
+        } break;
+
+        case SWITCH: {
+            decoded.c = 0;
+            decoded.args = (uint32_t) stbds_arrlenu(function->tables);
+
+            BlockIndex const* table = (BlockIndex const*) (instr + 1);
+            for (uint16_t i = 0; i <= decoded.b; i++) stbds_arrpush(function->tables, table[i]);
+        } break;
+
+        default:
+            if (opcode_has_immediate_32(opcode)) {
+                decoded.immediate = I_IMMEDIATE_32(uint32_t, *instr, bytecode->constants, 0);
+                decoded.c = 0;
+            } else if (opcode_has_immediate(opcode)) {
+                decoded.immediate = I_IMMEDIATE_64(uint64_t, *instr, bytecode->constants, instr[1]);
+                decoded.c = 0;
+            }
+            break;
+    }
+
+    return decoded;
+}
+
+void decode_function(Function const* functions, FunctionIndex index, DecodedFunction* decoded) {
+    Function const* function = functions + index;
+    Bytecode const* bytecode = &function->bytecode;
+
+    memset(decoded, 0, sizeof(DecodedFunction));
+    decoded->num_args = function->num_args;
+    decoded->num_registers = function->num_registers;
+
+    // a packed build's immediates behind the register constants come back as the instructions' own
+    for (uint32_t k = 0; k < bytecode->num_register_constants; k++) stbds_arrpush(decoded->constants, bytecode->constants[k]);
+
+    for (BlockIndex b = 0; b < bytecode->num_blocks; b++) {
+        stbds_arr(DecodedInstruction) block = NULL;
+        InstructionPointer ip = bytecode->blocks[b];
+
+        while (true) {
+            Instruction const* instr = bytecode->instructions + ip;
+            DecodedInstruction decoded_instr = decode_instruction(functions, bytecode, instr, decoded);
+            stbds_arrpush(block, decoded_instr);
+
+            ip += instruction_length(functions, instr);
+            if (opcode_ends_block(decoded_instr.opcode)) break;
+        }
+
+        stbds_arrpush(decoded->blocks, block);
+    }
+}
+
+void decoded_function_free(DecodedFunction* decoded) {
+    for (size_t b = 0; b < stbds_arrlenu(decoded->blocks); b++) stbds_arrfree(decoded->blocks[b]);
+    stbds_arrfree(decoded->blocks);
+    stbds_arrfree(decoded->constants);
+    stbds_arrfree(decoded->args);
+    stbds_arrfree(decoded->tables);
+    memset(decoded, 0, sizeof(DecodedFunction));
+}
+
+// the blocks an instruction enters: BLOCK's and WHEN_NZ's, both arms of an IF_NZ, or a SWITCH's default followed
+// by its cases; returns how many there are
+uint32_t decoded_targets(DecodedFunction const* decoded, DecodedInstruction const* instr, BlockIndex* targets) {
+    switch (instr->opcode) {
+        case BLOCK:
+        case WHEN_NZ:
+            targets[0] = instr->a;
+            return 1;
+
+        case IF_NZ:
+            targets[0] = instr->a;
+            targets[1] = instr->b;
+            return 2;
+
+        case SWITCH:
+            for (uint32_t i = 0; i <= instr->b; i++) targets[i] = decoded->tables[instr->args + i];
+            return (uint32_t) instr->b + 1;
+
+        default:
+            return 0;
+    }
+}
+
+// nesting depth of each block below the root, following the instructions that enter blocks from block 0; entered
+// is false for the blocks nothing enters, whose depth is left 0
+void decoded_block_depths(DecodedFunction const* function, uint8_t* depth, bool* entered) {
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(function->blocks);
+    BlockIndex to_visit [MAX_BLOCKS] = { 0 };
+    BlockIndex num_to_visit = 1;
+
+    memset(depth, 0, num_blocks * sizeof(uint8_t));
+    memset(entered, 0, num_blocks * sizeof(bool));
+    entered[0] = true;
+
+    while (num_to_visit > 0) {
+        BlockIndex b = to_visit[--num_to_visit];
+
+        for (size_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) {
+            BlockIndex targets [MAX_TARGETS];
+            uint32_t num_targets = decoded_targets(function, function->blocks[b] + i, targets);
+
+            for (uint32_t t = 0; t < num_targets; t++) {
+                if (entered[targets[t]]) continue;
+                entered[targets[t]] = true;
+                depth[targets[t]] = depth[b] + 1;
+                to_visit[num_to_visit++] = targets[t];
+            }
+        }
+    }
+}
+
+void encode_decoded_instruction(Encoder* encoder, Function const* functions, DecodedFunction const* decoded, DecodedInstruction const* instr) {
+    OpCode opcode = instr->opcode;
+
+    switch (opcode) {
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+            encode_0(encoder, opcode);
+            break;
+
+        case READ_GLOBAL_32:
+        case READ_GLOBAL_64:
+            encode_w1(encoder, opcode, instr->w, instr->c);
+            break;
+
+        case LOAD_GLOBAL_64:
+        case STORE_GLOBAL_64:
+            encode_w2(encoder, opcode, instr->w, instr->c, instr->b);
+            break;
+
+        case CALL_V:
+            encode_w1(encoder, opcode, instr->w, instr->c);
+            encode_registers(encoder, functions[instr->w].num_args, decoded->args + instr->args);
+            break;
+
+        case TAIL_CALL_V:
+            encode_w0(encoder, opcode, instr->w);
+            encode_registers(encoder, functions[instr->w].num_args, decoded->args + instr->args);
+            break;
+
+        case SWITCH:
+            encode_2(encoder, opcode, instr->a, instr->b);
+            encode_blocks(encoder, (uint16_t) (instr->b + 1), decoded->tables + instr->args);
+            break;
+
+        case COPY_IM_64:
+            encode_1(encoder, opcode, instr->a);
+            encode_im64(encoder, instr->immediate);
+            break;
+
+        case LOOP_IM_F64:
+        case LOOP_IM_I64:
+            encode_2(encoder, opcode, instr->a, instr->c);
+            encode_im64(encoder, instr->immediate);
+            break;
+
+        case BLOCK:
+        case BR:
+        case RE:
+        case RET_V:
+            encode_1(encoder, opcode, instr->a);
+            break;
+
+        case COPY_64:
+        case WHEN_NZ:
+        case BR_NZ:
+        case RE_NZ:
+        case F_SQRT_64:
+            encode_2(encoder, opcode, instr->a, instr->b);
+            break;
+
+        default:
+            if (opcode_has_immediate_32(opcode)) {
+                encode_2_im(encoder, opcode, (uint32_t) instr->immediate, instr->a, instr->b);
+            } else if (opcode_has_immediate(opcode)) {
+                encode_2(encoder, opcode, instr->a, instr->b);
+                encode_im64(encoder, instr->immediate);
+            } else {
+                encode_3(encoder, opcode, instr->a, instr->b, instr->c);
+            }
+            break;
+    }
+}
+
+// the entries of the pool encoding gives a function, value included unless it is NULL: the constants, and in a packed
+// build every immediate they do not already hold, once
+uint32_t decoded_pool_size(DecodedFunction const* function, uint64_t const* value) {
+    stbds_arr(uint64_t) pool = NULL;
+    for (size_t k = 0; k < stbds_arrlenu(function->constants); k++) stbds_arrpush(pool, function->constants[k]);
+
+#if PACKED_INSTRUCTIONS
+    for (size_t b = 0; b < stbds_arrlenu(function->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) {
+            DecodedInstruction const* instr = function->blocks[b] + i;
+            if (!opcode_has_immediate(instr->opcode)) continue;
+
+            uint64_t im = opcode_has_immediate_32(instr->opcode) ? (uint32_t) instr->immediate : instr->immediate;
+            bool pooled = false;
+            for (size_t k = 0; k < stbds_arrlenu(pool) && !pooled; k++) pooled = pool[k] == im;
+            if (!pooled) stbds_arrpush(pool, im);
+        }
+    }
+#endif
+
+    bool pooled = value == NULL;
+    for (size_t k = 0; k < stbds_arrlenu(pool) && !pooled; k++) pooled = pool[k] == *value;
+
+    uint32_t size = (uint32_t) stbds_arrlenu(pool) + !pooled;
+    stbds_arrfree(pool);
+    return size;
+}
+
+// the pool keeps its order, so constant registers mean the same after encoding; a packed build appends the
+// immediates behind it
+Bytecode encode_decoded_function(Function const* functions, DecodedFunction const* decoded) {
+    stbds_arr(InstructionPointer) blocks = NULL;
+    Encoder instructions = {};
+
+    for (size_t k = 0; k < stbds_arrlenu(decoded->constants); k++) stbds_arrpush(instructions.constants, decoded->constants[k]);
+    instructions.num_register_constants = (uint32_t) stbds_arrlenu(decoded->constants);
+
+    for (size_t b = 0; b < stbds_arrlenu(decoded->blocks); b++) {
+        stbds_arrpush(blocks, (InstructionPointer) (stbds_arrlenu(instructions.code) / sizeof(Instruction)));
+
+        for (size_t i = 0; i < stbds_arrlenu(decoded->blocks[b]); i++) {
+            encode_decoded_instruction(&instructions, functions, decoded, decoded->blocks[b] + i);
+        }
+    }
+
+    return encode_bytecode(&instructions, blocks);
+}
+
+// pointers to the registers an instruction reads, so passes can rename them; returns how many there are
+uint32_t decoded_sources(Function const* functions, DecodedFunction* decoded, DecodedInstruction* instr, RegisterIndex** sources) {
+    switch (instr->opcode) {
+        case LOAD_GLOBAL_64:
+            sources[0] = &instr->b;
+            return 1;
+
+        case STORE_GLOBAL_64:
+            sources[0] = &instr->c;
+            sources[1] = &instr->b;
+            return 2;
+
+        case IF_NZ:
+            sources[0] = &instr->c;
+            return 1;
+
+        case WHEN_NZ:
+        case BR_NZ:
+        case RE_NZ:
+            sources[0] = &instr->b;
+            return 1;
+
+        case COPY_64:
+        case F_SQRT_64:
+        case SWITCH:
+        case RET_V:
+            sources[0] = &instr->a;
+            return 1;
+
+        case SELECT_64:
+            sources[0] = &instr->a;
+            sources[1] = &instr->b;
+            sources[2] = &instr->c;
+            return 3;
+
+        case CALL_V:
+        case TAIL_CALL_V: {
+            RegisterIndex num_args = functions[instr->w].num_args;
+            for (RegisterIndex i = 0; i < num_args; i++) sources[i] = decoded->args + instr->args + i;
+            return num_args;
+        }
+
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+        case READ_GLOBAL_32:
+        case READ_GLOBAL_64:
+        case COPY_IM_64:
+        case BLOCK:
+        case BR:
+        case RE:
+            return 0;
+
+        default:
+            sources[0] = &instr->a;
+            if (opcode_has_immediate(instr->opcode)) return 1;
+            sources[1] = &instr->b;
+            return 2;
+    }
+}
+
+// the operand naming the register an instruction writes, NULL when it writes none; whole is false when it only
+// stores to the low bytes and the rest of the old value survives, as with 32-bit floats and comparison results
+RegisterIndex* decoded_destination_operand(DecodedInstruction* instr, bool* whole) {
+    *whole = true;
+
+    switch (instr->opcode) {
+        case READ_GLOBAL_32:
+        case READ_GLOBAL_64:
+        case LOAD_GLOBAL_64:
+        case CALL_V:
+            return &instr->c;
+
+        case COPY_IM_64:
+        case LOOP_F64:
+        case LOOP_IM_F64:
+        case LOOP_I64:
+        case LOOP_IM_I64:
+            return &instr->a;
+
+        case COPY_64:
+        case F_SQRT_64:
+        case F_ADD_IM_64:
+        case F_SUB_IM_A_64:
+        case F_SUB_IM_B_64:
+            return &instr->b;
+
+        case F_ADD_64:
+        case F_SUB_64:
+        case F_MUL_64:
+        case F_DIV_64:
+        case I_ADD_64:
+        case I_SUB_64:
+        case SELECT_64:
+        case SELECT_F_LT_64:
+        case SELECT_S_LT_64:
+            return &instr->c;
+
+        case F_ADD_32:
+        case F_SUB_32:
+        case F_EQ_32:
+        case F_LT_32:
+        case F_EQ_64:
+        case F_LT_64:
+        case S_EQ_64:
+        case S_LT_64:
+            *whole = false;
+            return &instr->c;
+
+        case F_ADD_IM_32:
+        case F_SUB_IM_A_32:
+        case F_SUB_IM_B_32:
+        case F_EQ_IM_32:
+        case F_LT_IM_A_32:
+        case F_LT_IM_B_32:
+        case F_EQ_IM_64:
+        case F_LT_IM_A_64:
+        case F_LT_IM_B_64:
+        case S_EQ_IM_64:
+            *whole = false;
+            return &instr->b;
+
+        default:
+            return NULL;
+    }
+}
+
+bool decoded_destination(DecodedInstruction const* instr, RegisterIndex* destination, bool* whole) {
+    DecodedInstruction copy = *instr;
+    RegisterIndex* operand = decoded_destination_operand(&copy, whole);
+    if (operand == NULL) return false;
+
+    *destination = *operand;
+    return true;
+}
+
+// the back edges of counted loops, which restart the block c levels up; decoding moves the depth of the immediate
+// forms from b into c as well
+bool opcode_is_loop(OpCode opcode) {
+    return opcode == LOOP_F64 || opcode == LOOP_IM_F64 || opcode == LOOP_I64 || opcode == LOOP_IM_I64;
+}
+
+// instructions whose destination is one of their sources as well: the LOOP_ counters, and the value SELECT_64 keeps
+// when its condition is zero
+bool opcode_reads_destination(OpCode opcode) {
+    return opcode_is_loop(opcode) || opcode == SELECT_64;
+}
+
+// instructions that have to stay even when nothing reads the register they write
+bool opcode_has_effects(OpCode opcode) {
+    return opcode == CALL_V || opcode_is_loop(opcode);
+}
+
+bool opcode_is_comparison(OpCode opcode) {
+    switch (opcode) {
+        case F_EQ_32:
+        case F_EQ_IM_32:
+        case F_LT_32:
+        case F_LT_IM_A_32:
+        case F_LT_IM_B_32:
+        case F_EQ_64:
+        case F_EQ_IM_64:
+        case F_LT_64:
+        case F_LT_IM_A_64:
+        case F_LT_IM_B_64:
+        case S_EQ_64:
+        case S_EQ_IM_64:
+        case S_LT_64:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// what eval would store for an arithmetic instruction or comparison given the values of its sources, with the
+// same floating point operations in the same order. x and y are the sources in decoded_sources order
+bool optimize_evaluate(DecodedInstruction const* instr, uint64_t x, uint64_t y, uint64_t* result) {
+    double dx = BITCAST(uint64_t, double, x);
+    double dy = BITCAST(uint64_t, double, y);
+    double di = BITCAST(uint64_t, double, instr->immediate);
+    float fx = BITCAST(uint32_t, float, (uint32_t) x);
+    float fy = BITCAST(uint32_t, float, (uint32_t) y);
+    float fi = BITCAST(uint32_t, float, (uint32_t) instr->immediate);
+
+    switch (instr->opcode) {
+        case COPY_64:       *result = x; return true;
+        case F_ADD_64:      *result = BITCAST(double, uint64_t, dx + dy); return true;
+        case F_ADD_IM_64:   *result = BITCAST(double, uint64_t, di + dx); return true;
+        case F_SUB_64:      *result = BITCAST(double, uint64_t, dx - dy); return true;
+        case F_SUB_IM_A_64: *result = BITCAST(double, uint64_t, di - dx); return true;
+        case F_SUB_IM_B_64: *result = BITCAST(double, uint64_t, dx - di); return true;
+        case F_MUL_64:      *result = BITCAST(double, uint64_t, dx * dy); return true;
+        case F_DIV_64:      *result = BITCAST(double, uint64_t, dx / dy); return true;
+        case F_SQRT_64:     *result = BITCAST(double, uint64_t, sqrt(dx)); return true;
+        case I_ADD_64:      *result = x + y; return true;
+        case I_SUB_64:      *result = x - y; return true;
+
+        case F_EQ_32:       *result = fx == fy; return true;
+        case F_EQ_IM_32:    *result = fi == fx; return true;
+        case F_LT_32:       *result = fx < fy; return true;
+        case F_LT_IM_A_32:  *result = fi < fx; return true;
+        case F_LT_IM_B_32:  *result = fx < fi; return true;
+        case F_EQ_64:       *result = dx == dy; return true;
+        case F_EQ_IM_64:    *result = di == dx; return true;
+        case F_LT_64:       *result = dx < dy; return true;
+        case F_LT_IM_A_64:  *result = di < dx; return true;
+        case F_LT_IM_B_64:  *result = dx < di; return true;
+        case S_EQ_64:       *result = x == y; return true;
+        case S_EQ_IM_64:    *result = instr->immediate == x; return true;
+        case S_LT_64:       *result = x < y; return true;
+
+        case SELECT_F_LT_64: *result = dx < dy ? x : y; return true;
+        case SELECT_S_LT_64: *result = x < y ? x : y; return true;
+
+        default:
+            return false;
+    }
+}
+
+typedef struct {
+    DecodedFunction* function;
+    uint32_t num_nodes;
+    // node of each block's first instruction, and one past the last block
+    uint32_t block_start [MAX_BLOCKS + 1];
+    stbds_arr(BlockIndex) node_block;
+    // reachable nodes that enter each block
+    stbds_arr(uint32_t) entries [MAX_BLOCKS];
+    stbds_arr(bool) reachable;
+} OptimizeGraph;
+
+DecodedInstruction* optimize_node(OptimizeGraph const* graph, uint32_t node) {
+    BlockIndex block = graph->node_block[node];
+    return graph->function->blocks[block] + (node - graph->block_start[block]);
+}
+
+// nodes a BR out of block at depth continues at
+void optimize_exits(OptimizeGraph const* graph, BlockIndex block, uint8_t depth, stbds_arr(uint32_t)* out) {
+    for (size_t e = 0; e < stbds_arrlenu(graph->entries[block]); e++) {
+        uint32_t entry = graph->entries[block][e];
+        if (depth == 0) stbds_arrpush(*out, entry + 1);
+        else optimize_exits(graph, graph->node_block[entry], depth - 1, out);
+    }
+}
+
+// first nodes of the blocks a RE in block at depth restarts
+void optimize_restarts(OptimizeGraph const* graph, BlockIndex block, uint8_t depth, stbds_arr(uint32_t)* out) {
+    if (depth == 0) {
+        stbds_arrpush(*out, graph->block_start[block]);
+        return;
+    }
+
+    for (size_t e = 0; e < stbds_arrlenu(graph->entries[block]); e++) {
+        uint32_t entry = graph->entries[block][e];
+        optimize_restarts(graph, graph->node_block[entry], depth - 1, out);
+    }
+}
+
+void optimize_successors(OptimizeGraph const* graph, uint32_t node, stbds_arr(uint32_t)* out) {
+    DecodedInstruction const* instr = optimize_node(graph, node);
+    BlockIndex block = graph->node_block[node];
+
+    stbds_arrsetlen(*out, 0);
+
+    switch (instr->opcode) {
+        case HALT:
+        case UNREACHABLE:
+        case LAZY_LINK:
+        case TAIL_CALL_V:
+        case RET_V:
+            break;
+
+        case BLOCK:
+            stbds_arrpush(*out, graph->block_start[instr->a]);
+            break;
+
+        case IF_NZ:
+            stbds_arrpush(*out, graph->block_start[instr->a]);
+            stbds_arrpush(*out, graph->block_start[instr->b]);
+            break;
+
+        case WHEN_NZ:
+            stbds_arrpush(*out, graph->block_start[instr->a]);
+            stbds_arrpush(*out, node + 1);
+            break;
+
+        case SWITCH: {
+            BlockIndex targets [MAX_TARGETS];
+            uint32_t num_targets = decoded_targets(graph->function, instr, targets);
+            for (uint32_t t = 0; t < num_targets; t++) stbds_arrpush(*out, graph->block_start[targets[t]]);
+        } break;
+
+        case BR:
+            optimize_exits(graph, block, instr->a, out);
+            break;
+
+        case BR_NZ:
+            optimize_exits(graph, block, instr->a, out);
+            stbds_arrpush(*out, node + 1);
+            break;
+
+        case RE:
+            optimize_restarts(graph, block, instr->a, out);
+            break;
+
+        case RE_NZ:
+            optimize_restarts(graph, block, instr->a, out);
+            stbds_arrpush(*out, node + 1);
+            break;
+
+        case LOOP_F64:
+        case LOOP_IM_F64:
+        case LOOP_I64:
+        case LOOP_IM_I64:
+            optimize_restarts(graph, block, instr->c, out);
+            stbds_arrpush(*out, node + 1);
+            break;
+
+        default:
+            stbds_arrpush(*out, node + 1);
+            break;
+    }
+}
+
+void optimize_graph_free(OptimizeGraph* graph) {
+    for (int b = 0; b < MAX_BLOCKS; b++) stbds_arrfree(graph->entries[b]);
+    stbds_arrfree(graph->node_block);
+    stbds_arrfree(graph->reachable);
+}
+
+// numbers the instructions and finds what is reachable from the function's first instruction. where a BR can go
+// depends on which entries into its block are reachable, so the search repeats until the entries stop changing
+void optimize_graph_build(OptimizeGraph* graph, DecodedFunction* function) {
+    memset(graph, 0, sizeof(OptimizeGraph));
+    graph->function = function;
+
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(function->blocks);
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        graph->block_start[b] = graph->num_nodes;
+        for (size_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) stbds_arrpush(graph->node_block, b);
+        graph->num_nodes += (uint32_t) stbds_arrlenu(function->blocks[b]);
+    }
+    graph->block_start[num_blocks] = graph->num_nodes;
+
+    stbds_arrsetlen(graph->reachable, graph->num_nodes);
+
+    stbds_arr(uint32_t) to_visit = NULL;
+    stbds_arr(uint32_t) successors = NULL;
+    size_t num_entries = SIZE_MAX;
+
+    while (true) {
+        size_t found = 0;
+        for (BlockIndex b = 0; b < num_blocks; b++) found += stbds_arrlenu(graph->entries[b]);
+        if (found == num_entries) break;
+        num_entries = found;
+
+        memset(graph->reachable, 0, graph->num_nodes * sizeof(bool));
+        graph->reachable[0] = true;
+        stbds_arrpush(to_visit, 0);
+
+        while (stbds_arrlenu(to_visit) > 0) {
+            uint32_t node = stbds_arrpop(to_visit);
+            optimize_successors(graph, node, &successors);
+
+            for (size_t s = 0; s < stbds_arrlenu(successors); s++) {
+                uint32_t next = successors[s];
+                if (graph->reachable[next]) continue;
+                graph->reachable[next] = true;
+                stbds_arrpush(to_visit, next);
+            }
+        }
+
+        for (BlockIndex b = 0; b < num_blocks; b++) stbds_arrsetlen(graph->entries[b], 0);
+
+        for (uint32_t node = 0; node < graph->num_nodes; node++) {
+            if (!graph->reachable[node]) continue;
+
+            BlockIndex targets [MAX_TARGETS];
+            uint32_t num_targets = decoded_targets(function, optimize_node(graph, node), targets);
+            for (uint32_t t = 0; t < num_targets; t++) stbds_arrpush(graph->entries[targets[t]], node);
+        }
+    }
+
+    stbds_arrfree(to_visit);
+    stbds_arrfree(successors);
+}
+
+typedef ENUM_T(uint8_t) {
+    KNOWN_NOTHING,
+    KNOWN_BYTE, // the low byte, which is all a comparison writes and all a branch reads
+    KNOWN_WORD,
+} Knowledge;
+
+typedef struct {
+    Knowledge known;
+    // a register holding the same value, itself when there is none
+    RegisterIndex copy;
+    uint64_t value;
+} RegisterFact;
+
+// what the forward analysis knows before each reachable instruction
+typedef struct {
+    RegisterIndex num_registers;
+    stbds_arr(RegisterFact) facts;
+    stbds_arr(bool) seen;
+} OptimizeFacts;
+
+RegisterFact optimize_fact(DecodedFunction const* function, RegisterFact const* facts, RegisterIndex r) {
+    if (r >= function->num_registers) {
+        return (RegisterFact) { KNOWN_WORD, r, function->constants[r - function->num_registers] };
+    }
+    return facts[r];
+}
+
+void optimize_transfer(Function const* functions, DecodedFunction* function, DecodedInstruction* instr, RegisterFact* facts) {
+    RegisterIndex destination;
+    bool whole;
+    if (!decoded_destination(instr, &destination, &whole)) return;
+
+    RegisterIndex* sources [MAX_REGISTERS + 1];
+    uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+
+    RegisterFact result = { KNOWN_NOTHING, destination, 0 };
+
+    if (instr->opcode == COPY_IM_64) {
+        result = (RegisterFact) { KNOWN_WORD, destination, instr->immediate };
+    } else if (instr->opcode != CALL_V) {
+        RegisterFact x = num_sources > 0 ? optimize_fact(function, facts, *sources[0]) : (RegisterFact) {};
+        RegisterFact y = num_sources > 1 ? optimize_fact(function, facts, *sources[1]) : (RegisterFact) { KNOWN_WORD };
+
+        uint64_t value;
+        if (num_sources > 0 && x.known == KNOWN_WORD && y.known == KNOWN_WORD && optimize_evaluate(instr, x.value, y.value, &value)) {
+            if (whole) result = (RegisterFact) { KNOWN_WORD, destination, value };
+            else if (opcode_is_comparison(instr->opcode)) result = (RegisterFact) { KNOWN_BYTE, destination, value };
+        }
+
+        if (instr->opcode == COPY_64) result.copy = x.copy;
+    }
+
+    for (RegisterIndex r = 0; r < function->num_registers; r++) {
+        if (facts[r].copy == destination) facts[r].copy = r;
+    }
+
+    facts[destination] = result;
+}
+
+// true when into changed
+bool optimize_meet(RegisterFact* into, RegisterFact const* from, RegisterIndex num_registers) {
+    bool changed = false;
+
+    for (RegisterIndex r = 0; r < num_registers; r++) {
+        RegisterFact merged = into[r];
+
+        if (merged.copy != from[r].copy) merged.copy = r;
+
+        if (merged.known == KNOWN_WORD && from[r].known == KNOWN_WORD && merged.value == from[r].value) {
+            // unchanged
+        } else if (merged.known != KNOWN_NOTHING && from[r].known != KNOWN_NOTHING && (uint8_t) merged.value == (uint8_t) from[r].value) {
+            merged.known = KNOWN_BYTE;
+            merged.value = (uint8_t) merged.value;
+        } else {
+            merged.known = KNOWN_NOTHING;
+            merged.value = 0;
+        }
+
+        if (merged.known != into[r].known || merged.copy != into[r].copy || merged.value != into[r].value) {
+            into[r] = merged;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+void optimize_facts_free(OptimizeFacts* facts) {
+    stbds_arrfree(facts->facts);
+    stbds_arrfree(facts->seen);
+}
+
+void optimize_facts_build(Function const* functions, OptimizeGraph const* graph, OptimizeFacts* facts) {
+    DecodedFunction* function = graph->function;
+    RegisterIndex n = function->num_registers;
+
+    memset(facts, 0, sizeof(OptimizeFacts));
+    facts->num_registers = n;
+    stbds_arrsetlen(facts->facts, (size_t) graph->num_nodes * n + n);
+    stbds_arrsetlen(facts->seen, graph->num_nodes);
+    memset(facts->seen, 0, graph->num_nodes * sizeof(bool));
+
+    // the registers past the arguments start out as whatever the stack held
+    RegisterFact* entry = facts->facts;
+    for (RegisterIndex r = 0; r < n; r++) entry[r] = (RegisterFact) { KNOWN_NOTHING, r, 0 };
+    facts->seen[0] = true;
+
+    RegisterFact* scratch = facts->facts + (size_t) graph->num_nodes * n;
+    stbds_arr(uint32_t) to_visit = NULL;
+    stbds_arr(bool) queued = NULL;
+    stbds_arr(uint32_t) successors = NULL;
+
+    stbds_arrsetlen(queued, graph->num_nodes);
+    memset(queued, 0, graph->num_nodes * sizeof(bool));
+    stbds_arrpush(to_visit, 0);
+    queued[0] = true;
+
+    while (stbds_arrlenu(to_visit) > 0) {
+        uint32_t node = stbds_arrpop(to_visit);
+        queued[node] = false;
+
+        memcpy(scratch, facts->facts + (size_t) node * n, n * sizeof(RegisterFact));
+        optimize_transfer(functions, function, optimize_node(graph, node), scratch);
+        optimize_successors(graph, node, &successors);
+
+        for (size_t s = 0; s < stbds_arrlenu(successors); s++) {
+            uint32_t next = successors[s];
+            RegisterFact* into = facts->facts + (size_t) next * n;
+            bool changed;
+
+            if (!facts->seen[next]) {
+                memcpy(into, scratch, n * sizeof(RegisterFact));
+                facts->seen[next] = true;
+                changed = true;
+            } else {
+                changed = optimize_meet(into, scratch, n);
+            }
+
+            if (changed && !queued[next]) {
+                queued[next] = true;
+                stbds_arrpush(to_visit, next);
+            }
+        }
+    }
+
+    stbds_arrfree(to_visit);
+    stbds_arrfree(queued);
+    stbds_arrfree(successors);
+}
+
+// immediate form of a generic instruction whose source at position known is a constant
+#define NO_IMMEDIATE_FORM HALT
+
+OpCode optimize_immediate_form(OpCode opcode, uint32_t known) {
+    switch (opcode) {
+        case F_ADD_32: return F_ADD_IM_32;
+        case F_SUB_32: return known == 0 ? F_SUB_IM_A_32 : F_SUB_IM_B_32;
+        case F_EQ_32:  return F_EQ_IM_32;
+        case F_LT_32:  return known == 0 ? F_LT_IM_A_32 : F_LT_IM_B_32;
+        case F_ADD_64: return F_ADD_IM_64;
+        case F_SUB_64: return known == 0 ? F_SUB_IM_A_64 : F_SUB_IM_B_64;
+        case F_EQ_64:  return F_EQ_IM_64;
+        case F_LT_64:  return known == 0 ? F_LT_IM_A_64 : F_LT_IM_B_64;
+        case S_EQ_64:  return S_EQ_IM_64;
+        default:       return NO_IMMEDIATE_FORM;
+    }
+}
+
+// whether the frame, its registers followed by the whole pool, still fits the register indices once value is in the
+// pool, as a constant register or, in a packed build, as an immediate
+bool optimize_pool_room(DecodedFunction const* function, uint64_t value) {
+    return (uint32_t) function->num_registers + decoded_pool_size(function, &value) <= MAX_REGISTERS + 1;
+}
+
+// the constant register holding value, adding it to the pool while there are register indices left
+bool optimize_constant_register(DecodedFunction* function, uint64_t value, RegisterIndex* r) {
+    size_t num_constants = stbds_arrlenu(function->constants);
+
+    for (size_t k = 0; k < num_constants; k++) {
+        if (function->constants[k] == value) {
+            *r = (RegisterIndex) (function->num_registers + k);
+            return true;
+        }
+    }
+
+    if (!optimize_pool_room(function, value)) return false;
+
+    stbds_arrpush(function->constants, value);
+    *r = (RegisterIndex) (function->num_registers + num_constants);
+    return true;
+}
+
+// one rewrite of every reachable instruction with what the analysis knows before it; true when anything changed
+bool optimize_rewrite(Function const* functions, OptimizeGraph const* graph, OptimizeFacts const* facts, OptimizeReport* report) {
+    DecodedFunction* function = graph->function;
+    RegisterIndex n = function->num_registers;
+    bool changed = false;
+
+    for (size_t b = 0; b < stbds_arrlenu(function->blocks); b++) {
+        stbds_arr(DecodedInstruction) rewritten = NULL;
+
+        for (uint32_t node = graph->block_start[b]; node < graph->block_start[b + 1]; node++) {
+            DecodedInstruction instr = *optimize_node(graph, node);
+
+            if (!graph->reachable[node]) {
+                stbds_arrpush(rewritten, instr);
+                continue;
+            }
+
+            RegisterFact const* known = facts->facts + (size_t) node * n;
+
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, &instr, sources);
+            bool whole;
+            RegisterIndex* written = decoded_destination_operand(&instr, &whole);
+
+            for (uint32_t s = 0; s < num_sources; s++) {
+                RegisterIndex r = *sources[s];
+                // LOOP_ and SELECT_64 read and write their destination through one operand, renaming it would move the write
+                if (sources[s] == written) continue;
+                if (r < n && known[r].copy != r) {
+                    *sources[s] = known[r].copy;
+                    report->propagated++;
+                    changed = true;
+                }
+            }
+
+            RegisterIndex destination = 0;
+            bool writes = decoded_destination(&instr, &destination, &whole);
+
+            RegisterFact x = num_sources > 0 ? optimize_fact(function, known, *sources[0]) : (RegisterFact) {};
+            RegisterFact y = num_sources > 1 ? optimize_fact(function, known, *sources[1]) : (RegisterFact) { KNOWN_WORD };
+            uint64_t value;
+
+            bool foldable = writes && whole && !opcode_has_effects(instr.opcode) && instr.opcode != COPY_IM_64 && num_sources > 0
+                // a copy out of the pool already costs no more than the immediate it would become
+                && !(instr.opcode == COPY_64 && *sources[0] >= n);
+
+            if (foldable && x.known == KNOWN_WORD && y.known == KNOWN_WORD && optimize_evaluate(&instr, x.value, y.value, &value)
+             && optimize_pool_room(function, value)) {
+                instr = (DecodedInstruction) { .opcode = COPY_IM_64, .a = destination, .immediate = value };
+                report->folded++;
+                changed = true;
+            } else if (writes && !opcode_has_effects(instr.opcode) && num_sources == 2 && !opcode_has_immediate(instr.opcode) && (x.known == KNOWN_WORD) != (y.known == KNOWN_WORD)) {
+                uint32_t constant = x.known == KNOWN_WORD ? 0 : 1;
+                RegisterFact c = constant == 0 ? x : y;
+                RegisterIndex other = *sources[1 - constant];
+                OpCode form = optimize_immediate_form(instr.opcode, constant);
+                RegisterIndex r;
+
+                if (form != NO_IMMEDIATE_FORM && optimize_pool_room(function, opcode_has_immediate_32(form) ? (uint32_t) c.value : c.value)) {
+                    bool narrow = opcode_has_immediate_32(form);
+                    instr = (DecodedInstruction) { .opcode = form, .a = other, .b = destination, .immediate = narrow ? (uint32_t) c.value : c.value };
+                    report->immediates++;
+                    changed = true;
+                } else if (*sources[constant] < n && optimize_constant_register(function, c.value, &r)) {
+                    *sources[constant] = r;
+                    report->immediates++;
+                    changed = true;
+                }
+            } else if ((instr.opcode == LOOP_F64 || instr.opcode == LOOP_I64) && y.known == KNOWN_WORD && optimize_pool_room(function, y.value)) {
+                instr = (DecodedInstruction) { .opcode = instr.opcode == LOOP_F64 ? LOOP_IM_F64 : LOOP_IM_I64, .a = instr.a, .c = instr.c, .immediate = y.value };
+                report->immediates++;
+                changed = true;
+            }
+
+            RegisterFact condition = {};
+            switch (instr.opcode) {
+                case IF_NZ:
+                    condition = optimize_fact(function, known, instr.c);
+                    break;
+                case WHEN_NZ:
+                case BR_NZ:
+                case RE_NZ:
+                    condition = optimize_fact(function, known, instr.b);
+                    break;
+                case SELECT_64:
+                    condition = optimize_fact(function, known, instr.a);
+                    break;
+                default:
+                    break;
+            }
+
+            // a known index picks its case, or the default, and all of it counts
+            if (instr.opcode == SWITCH) {
+                RegisterFact index = optimize_fact(function, known, instr.a);
+                if (index.known == KNOWN_WORD) {
+                    BlockIndex const* table = function->tables + instr.args;
+                    instr = (DecodedInstruction) { .opcode = BLOCK, .a = table[index.value < instr.b ? index.value + 1 : 0] };
+                    report->branches++;
+                    changed = true;
+                }
+            }
+
+            bool ends = false;
+
+            if (condition.known != KNOWN_NOTHING) {
+                bool taken = (uint8_t) condition.value != 0;
+                report->branches++;
+                changed = true;
+
+                switch (instr.opcode) {
+                    case IF_NZ:
+                        instr = (DecodedInstruction) { .opcode = BLOCK, .a = taken ? instr.a : instr.b };
+                        break;
+                    case WHEN_NZ:
+                        if (!taken) continue;
+                        instr = (DecodedInstruction) { .opcode = BLOCK, .a = instr.a };
+                        break;
+                    case BR_NZ:
+                        if (!taken) continue;
+                        instr = (DecodedInstruction) { .opcode = BR, .a = instr.a };
+                        ends = true;
+                        break;
+                    case RE_NZ:
+                        if (!taken) continue;
+                        instr = (DecodedInstruction) { .opcode = RE, .a = instr.a };
+                        ends = true;
+                        break;
+                    case SELECT_64:
+                        if (!taken) continue;
+                        instr = (DecodedInstruction) { .opcode = COPY_64, .a = instr.b, .b = instr.c };
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            // entering a block that only leaves again does nothing
+            if (instr.opcode == BLOCK && stbds_arrlenu(function->blocks[instr.a]) == 1
+             && function->blocks[instr.a][0].opcode == BR && function->blocks[instr.a][0].a == 0) {
+                report->dead++;
+                changed = true;
+                continue;
+            }
+
+            stbds_arrpush(rewritten, instr);
+            if (ends) break;
+        }
+
+        stbds_arrfree(function->blocks[b]);
+        function->blocks[b] = rewritten;
+    }
+
+    return changed;
+}
+
+typedef struct {
+    uint64_t bits [(MAX_REGISTERS + 1) / 64];
+} RegisterSet;
+
+#define REGISTER_SET_HAS(set, r) (((set).bits[(r) / 64] >> ((r) % 64)) & 1)
+#define REGISTER_SET_ADD(set, r) ((set).bits[(r) / 64] |= (uint64_t) 1 << ((r) % 64))
+#define REGISTER_SET_REMOVE(set, r) ((set).bits[(r) / 64] &= ~((uint64_t) 1 << ((r) % 64)))
+
+// registers live before and after each reachable node, iterated backwards to a fixpoint. a partial write keeps the
+// register live, the bytes it leaves alone still flow through
+void optimize_liveness(Function const* functions, OptimizeGraph const* graph, stbds_arr(RegisterSet)* live_in, stbds_arr(RegisterSet)* live_out) {
+    DecodedFunction* function = graph->function;
+    stbds_arr(uint32_t) successors = NULL;
+
+    stbds_arrsetlen(*live_in, graph->num_nodes);
+    stbds_arrsetlen(*live_out, graph->num_nodes);
+    memset(*live_in, 0, graph->num_nodes * sizeof(RegisterSet));
+    memset(*live_out, 0, graph->num_nodes * sizeof(RegisterSet));
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (uint32_t node = graph->num_nodes; node-- > 0;) {
+            if (!graph->reachable[node]) continue;
+
+            RegisterSet out = {};
+            optimize_successors(graph, node, &successors);
+            for (size_t s = 0; s < stbds_arrlenu(successors); s++) {
+                for (int w = 0; w < (MAX_REGISTERS + 1) / 64; w++) out.bits[w] |= (*live_in)[successors[s]].bits[w];
+            }
+            (*live_out)[node] = out;
+
+            DecodedInstruction* instr = optimize_node(graph, node);
+            RegisterIndex destination;
+            bool whole;
+            if (decoded_destination(instr, &destination, &whole) && whole) REGISTER_SET_REMOVE(out, destination);
+
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+            for (uint32_t s = 0; s < num_sources; s++) REGISTER_SET_ADD(out, *sources[s]);
+
+            if (memcmp(&out, *live_in + node, sizeof(RegisterSet)) != 0) {
+                (*live_in)[node] = out;
+                changed = true;
+            }
+        }
+    }
+
+    stbds_arrfree(successors);
+}
+
+// removes instructions whose result nothing reads, and moves that only rename a result; true when anything was
+// removed
+bool optimize_dead_writes(Function const* functions, OptimizeGraph const* graph, OptimizeReport* report) {
+    DecodedFunction* function = graph->function;
+    stbds_arr(RegisterSet) live_in = NULL;
+    stbds_arr(RegisterSet) live_out = NULL;
+    optimize_liveness(functions, graph, &live_in, &live_out);
+
+    bool removed = false;
+
+    for (size_t b = 0; b < stbds_arrlenu(function->blocks); b++) {
+        stbds_arr(DecodedInstruction) kept = NULL;
+
+        for (uint32_t node = graph->block_start[b]; node < graph->block_start[b + 1]; node++) {
+            DecodedInstruction const* instr = optimize_node(graph, node);
+            RegisterIndex destination;
+            bool whole;
+
+            if (graph->reachable[node] && !opcode_has_effects(instr->opcode) && decoded_destination(instr, &destination, &whole)
+             && !REGISTER_SET_HAS(live_out[node], destination)) {
+                report->dead++;
+                removed = true;
+                continue;
+            }
+
+            // a result moved straight into another register and not read again is written there directly
+            DecodedInstruction const* next = node + 1 < graph->block_start[b + 1] ? optimize_node(graph, node + 1) : NULL;
+            if (graph->reachable[node] && next != NULL && next->opcode == COPY_64 && !opcode_reads_destination(instr->opcode) && decoded_destination(instr, &destination, &whole)
+             && whole && next->a == destination && next->b != destination && !REGISTER_SET_HAS(live_out[node + 1], destination)) {
+                DecodedInstruction merged = *instr;
+                *decoded_destination_operand(&merged, &whole) = next->b;
+                stbds_arrpush(kept, merged);
+
+                node++;
+                report->dead++;
+                removed = true;
+                continue;
+            }
+
+            stbds_arrpush(kept, *instr);
+        }
+
+        stbds_arrfree(function->blocks[b]);
+        function->blocks[b] = kept;
+    }
+
+    stbds_arrfree(live_in);
+    stbds_arrfree(live_out);
+
+    return removed;
+}
+
+// instructions that only compute their destination from their sources, so running them earlier or more often than
+// the program does changes nothing but that register
+bool opcode_is_pure(OpCode opcode) {
+    switch (opcode) {
+        case COPY_IM_64:
+        case COPY_64:
+        case SELECT_64:
+        case SELECT_F_LT_64:
+        case SELECT_S_LT_64:
+            return true;
+        default:
+            return opcode_is_comparison(opcode) || (opcode >= F_ADD_32 && opcode <= I_SUB_64);
+    }
+}
+
+// a loop is a block some RE restarts. the pass looks at loops whose block is entered from one place and whose nested
+// blocks are only entered from inside the loop, so everything that runs while the loop's frame is on the block stack
+// is known. it makes one change per call and returns whether it did:
+//
+// an instruction of the loop block itself whose sources the loop never writes, and whose destination nothing outside
+// the loop reads and nothing else writes, moves in front of the instruction entering the loop. it runs once instead of
+// every iteration, and possibly when the loop exits before reaching it, which only that register can tell.
+//
+// a counted loop, one that starts by leaving when a counter equals a limit and ends by adding one to the counter and
+// restarting, gets its test moved in front of its entry as an IF_NZ over an empty block, and its back edge turned
+// into a LOOP_ instruction that increments, compares and restarts in one instruction. the test runs once more when the
+// loop ends so its destination holds what it did before, which the body, writing it nowhere else, never sees change
+// either way
+bool optimize_loops(Function const* functions, DecodedFunction* function, OptimizeReport* report) {
+    OptimizeGraph graph;
+    optimize_graph_build(&graph, function);
+
+    stbds_arr(RegisterSet) live_in = NULL;
+    stbds_arr(RegisterSet) live_out = NULL;
+    optimize_liveness(functions, &graph, &live_in, &live_out);
+
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(function->blocks);
+    RegisterIndex n = function->num_registers;
+    uint8_t depth [MAX_BLOCKS];
+    bool entered [MAX_BLOCKS];
+    decoded_block_depths(function, depth, entered);
+
+    bool changed = false;
+
+    for (BlockIndex loop = 1; loop < num_blocks && !changed; loop++) {
+        if (!graph.reachable[graph.block_start[loop]] || stbds_arrlenu(graph.entries[loop]) != 1) continue;
+
+        uint32_t entry = graph.entries[loop][0];
+        BlockIndex parent = graph.node_block[entry];
+
+        bool inside [MAX_BLOCKS] = {};
+        inside[loop] = true;
+        for (bool grew = true; grew;) {
+            grew = false;
+            for (BlockIndex b = 0; b < num_blocks; b++) {
+                for (size_t e = 0; e < stbds_arrlenu(graph.entries[b]) && !inside[b]; e++) {
+                    if (inside[graph.node_block[graph.entries[b][e]]]) inside[b] = grew = true;
+                }
+            }
+        }
+
+        bool closed = true;
+        for (BlockIndex b = 0; b < num_blocks; b++) {
+            if (!inside[b] || b == loop) continue;
+            for (size_t e = 0; e < stbds_arrlenu(graph.entries[b]); e++) closed &= inside[graph.node_block[graph.entries[b][e]]];
+        }
+        if (!closed) continue;
+
+        uint32_t restarts = 0;
+        uint16_t writes_inside [MAX_REGISTERS + 1] = {};
+        uint16_t writes_outside [MAX_REGISTERS + 1] = {};
+        bool read_outside [MAX_REGISTERS + 1] = {};
+
+        for (uint32_t node = 0; node < graph.num_nodes; node++) {
+            if (!graph.reachable[node]) continue;
+
+            DecodedInstruction* instr = optimize_node(&graph, node);
+            BlockIndex b = graph.node_block[node];
+
+            if (inside[b]) {
+                uint8_t up = 0xFF;
+                if (instr->opcode == RE || instr->opcode == RE_NZ) up = instr->a;
+                if (opcode_is_loop(instr->opcode)) up = instr->c;
+                if (up != 0xFF && depth[b] - up == depth[loop]) restarts++;
+            }
+
+            RegisterIndex destination;
+            bool whole;
+            if (decoded_destination(instr, &destination, &whole)) {
+                if (inside[b]) writes_inside[destination]++;
+                else writes_outside[destination]++;
+            }
+
+            if (!inside[b]) {
+                RegisterIndex* sources [MAX_REGISTERS + 1];
+                uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+                for (uint32_t s = 0; s < num_sources; s++) read_outside[*sources[s]] = true;
+            }
+        }
+
+        if (restarts == 0) continue;
+
+        stbds_arr(DecodedInstruction) body = function->blocks[loop];
+        stbds_arr(DecodedInstruction) kept = NULL;
+        stbds_arr(DecodedInstruction) hoisted = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(body); i++) {
+            DecodedInstruction* instr = body + i;
+            RegisterIndex destination;
+            bool whole;
+
+            bool invariant = opcode_is_pure(instr->opcode) && decoded_destination(instr, &destination, &whole)
+                && writes_inside[destination] == 1 && writes_outside[destination] == 0 && !read_outside[destination]
+                && !REGISTER_SET_HAS(live_in[graph.block_start[loop]], destination);
+
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+            for (uint32_t s = 0; s < num_sources && invariant; s++) invariant = *sources[s] >= n || writes_inside[*sources[s]] == 0;
+
+            if (invariant) {
+                stbds_arrpush(hoisted, *instr);
+                writes_inside[destination]--;
+            } else {
+                stbds_arrpush(kept, *instr);
+            }
+        }
+
+        if (stbds_arrlenu(hoisted) > 0) {
+            stbds_arr(DecodedInstruction) outer = NULL;
+            uint32_t at = entry - graph.block_start[parent];
+
+            for (uint32_t i = 0; i < stbds_arrlenu(function->blocks[parent]); i++) {
+                if (i == at) {
+                    for (size_t h = 0; h < stbds_arrlenu(hoisted); h++) stbds_arrpush(outer, hoisted[h]);
+                }
+                stbds_arrpush(outer, function->blocks[parent][i]);
+            }
+
+            report->hoisted += (uint32_t) stbds_arrlenu(hoisted);
+            stbds_arrfree(function->blocks[parent]);
+            stbds_arrfree(function->blocks[loop]);
+            function->blocks[parent] = outer;
+            function->blocks[loop] = kept;
+            stbds_arrfree(hoisted);
+
+            changed = true;
+            continue;
+        }
+
+        stbds_arrfree(kept);
+
+        // the counted loop shape, see above
+        size_t length = stbds_arrlenu(body);
+        DecodedInstruction* enter = optimize_node(&graph, entry);
+        if (enter->opcode != BLOCK || restarts != 1 || length < 4 || num_blocks == MAX_BLOCKS) continue;
+
+        DecodedInstruction test = body[0];
+        DecodedInstruction leave = body[1];
+        DecodedInstruction step = body[length - 2];
+        DecodedInstruction back = body[length - 1];
+
+        // a float counter steps by F_ADD_IM_64 1.0, an integer one by I_ADD_64 with a constant register holding 1
+        RegisterIndex counter;
+        bool integer;
+
+        if (step.opcode == F_ADD_IM_64 && step.a == step.b && step.immediate == BITCAST(double, uint64_t, 1.0)) {
+            counter = step.a;
+            integer = false;
+        } else if (step.opcode == I_ADD_64 && (step.a == step.c) != (step.b == step.c)) {
+            RegisterIndex one = step.a == step.c ? step.b : step.a;
+            if (one < n || function->constants[one - n] != 1) continue;
+            counter = step.c;
+            integer = true;
+        } else {
+            continue;
+        }
+
+        if (back.opcode != RE || back.a != 0) continue;
+
+        OpCode compare = integer ? S_EQ_64 : F_EQ_64;
+        OpCode compare_im = integer ? S_EQ_IM_64 : F_EQ_IM_64;
+        DecodedInstruction loop_back = { .opcode = integer ? LOOP_I64 : LOOP_F64, .a = counter, .c = 0 };
+        RegisterIndex condition;
+
+        if (test.opcode == compare && (test.a == counter) != (test.b == counter)) {
+            condition = test.c;
+            loop_back.b = test.a == counter ? test.b : test.a;
+        } else if (test.opcode == compare_im && test.a == counter) {
+            condition = test.b;
+            loop_back.opcode = integer ? LOOP_IM_I64 : LOOP_IM_F64;
+            loop_back.immediate = test.immediate;
+        } else {
+            continue;
+        }
+
+        if (leave.opcode != BR_NZ || leave.a != 0 || leave.b != condition || condition == counter) continue;
+        // the test is the only write to its destination in the loop, or the body could read back its own value
+        if (writes_inside[counter] != 1 || writes_inside[condition] != 1) continue;
+        if (test.opcode == compare && (condition == loop_back.b || (loop_back.b < n && writes_inside[loop_back.b] != 0))) continue;
+
+        stbds_arr(DecodedInstruction) outer = NULL;
+        uint32_t at = entry - graph.block_start[parent];
+        for (uint32_t i = 0; i < stbds_arrlenu(function->blocks[parent]); i++) {
+            if (i == at) {
+                stbds_arrpush(outer, test);
+                stbds_arrpush(outer, ((DecodedInstruction) { .opcode = IF_NZ, .a = num_blocks, .b = loop, .c = condition }));
+            } else {
+                stbds_arrpush(outer, function->blocks[parent][i]);
+            }
+        }
+
+        stbds_arr(DecodedInstruction) counted = NULL;
+        for (size_t i = 2; i < length - 2; i++) stbds_arrpush(counted, body[i]);
+        stbds_arrpush(counted, loop_back);
+        stbds_arrpush(counted, test);
+        stbds_arrpush(counted, ((DecodedInstruction) { .opcode = BR, .a = 0 }));
+
+        stbds_arr(DecodedInstruction) skip = NULL;
+        stbds_arrpush(skip, ((DecodedInstruction) { .opcode = BR, .a = 0 }));
+
+        stbds_arrfree(function->blocks[parent]);
+        stbds_arrfree(function->blocks[loop]);
+        function->blocks[parent] = outer;
+        function->blocks[loop] = counted;
+        stbds_arrpush(function->blocks, skip);
+
+        report->counted++;
+        changed = true;
+    }
+
+    stbds_arrfree(live_in);
+    stbds_arrfree(live_out);
+    optimize_graph_free(&graph);
+
+    return changed;
+}
+
+// a register nothing uses yet, moving the constant registers up by one to make room; false when there are no register
+// indices left
+bool optimize_new_register(Function const* functions, DecodedFunction* function, RegisterIndex* r) {
+    RegisterIndex n = function->num_registers;
+    if (n + stbds_arrlenu(function->constants) > MAX_REGISTERS) return false;
+
+    for (size_t b = 0; b < stbds_arrlenu(function->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) {
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, function->blocks[b] + i, sources);
+            for (uint32_t s = 0; s < num_sources; s++) {
+                if (*sources[s] >= n) (*sources[s])++;
+            }
+        }
+    }
+
+    function->num_registers = (RegisterIndex) (n + 1);
+    *r = n;
+    return true;
+}
+
+#define NO_SELECT_FORM HALT
+
+// the select writing x when the comparison finds x < y and y otherwise
+OpCode optimize_select_form(OpCode compare) {
+    switch (compare) {
+        case F_LT_64: return SELECT_F_LT_64;
+        case S_LT_64: return SELECT_S_LT_64;
+        default:      return NO_SELECT_FORM;
+    }
+}
+
+// the instruction of a block that only assigns one register and leaves, NULL for any other block
+DecodedInstruction const* optimize_assignment(DecodedFunction const* function, BlockIndex block) {
+    stbds_arr(DecodedInstruction) code = function->blocks[block];
+    if (stbds_arrlenu(code) != 2 || code[1].opcode != BR || code[1].a != 0) return NULL;
+
+    RegisterIndex destination;
+    bool whole;
+    if (!opcode_is_pure(code[0].opcode) || opcode_reads_destination(code[0].opcode)) return NULL;
+    if (!decoded_destination(code, &destination, &whole) || !whole) return NULL;
+
+    return code;
+}
+
+// a conditional block that only assigns a register becomes straight-line code: the assignment writes a new register
+// instead, and a SELECT_64 copies that over the old one when the condition holds. an else arm assigning the same
+// register runs in between and writes it directly. the assignments are pure, so running the one the program would
+// have skipped changes nothing but its own register, and an unpredictable condition costs neither a mispredicted
+// dispatch nor a block frame. when the arms pick between the operands of the F_LT_64 or S_LT_64 just before, the
+// select compares them itself and the comparison is left for optimize_dead_writes. like optimize_loops it makes one
+// change per call and returns whether it did
+bool optimize_selects(Function const* functions, DecodedFunction* function, OptimizeReport* report) {
+    OptimizeGraph graph;
+    optimize_graph_build(&graph, function);
+    bool changed = false;
+
+    for (uint32_t node = 0; node < graph.num_nodes && !changed; node++) {
+        DecodedInstruction const* instr = optimize_node(&graph, node);
+        if (!graph.reachable[node] || (instr->opcode != IF_NZ && instr->opcode != WHEN_NZ)) continue;
+
+        RegisterIndex condition = instr->opcode == IF_NZ ? instr->c : instr->b;
+        DecodedInstruction const* then = optimize_assignment(function, instr->a);
+        if (then == NULL) continue;
+
+        RegisterIndex destination = 0;
+        bool whole;
+        decoded_destination(then, &destination, &whole);
+
+        // an else arm that only leaves is the same as none
+        DecodedInstruction const* otherwise = NULL;
+        if (instr->opcode == IF_NZ) {
+            stbds_arr(DecodedInstruction) code = function->blocks[instr->b];
+            bool leaves = stbds_arrlenu(code) == 1 && code[0].opcode == BR && code[0].a == 0;
+
+            if (!leaves) {
+                RegisterIndex other;
+                otherwise = optimize_assignment(function, instr->b);
+                if (otherwise == NULL || !decoded_destination(otherwise, &other, &whole) || other != destination) continue;
+                if (condition == destination) continue;
+            }
+        }
+
+        BlockIndex b = graph.node_block[node];
+        uint32_t at = node - graph.block_start[b];
+        DecodedInstruction const* compare = at > 0 ? function->blocks[b] + at - 1 : NULL;
+
+        OpCode fused = compare != NULL ? optimize_select_form(compare->opcode) : NO_SELECT_FORM;
+
+        // r = x < y ? x : y, or with no else arm r = x < r ? x : r
+        bool picks = fused != NO_SELECT_FORM && compare->c == condition && condition != compare->a && condition != compare->b
+            && then->opcode == COPY_64 && then->a == compare->a
+            && (otherwise == NULL ? destination == compare->b : otherwise->opcode == COPY_64 && otherwise->a == compare->b);
+
+        stbds_arr(DecodedInstruction) sequence = NULL;
+
+        if (picks) {
+            stbds_arrpush(sequence, ((DecodedInstruction) { .opcode = fused, .a = compare->a, .b = compare->b, .c = destination }));
+        } else {
+            RegisterIndex taken;
+            if (!optimize_new_register(functions, function, &taken)) continue;
+
+            DecodedInstruction assignment = *then;
+            *decoded_destination_operand(&assignment, &whole) = taken;
+            stbds_arrpush(sequence, assignment);
+            if (otherwise != NULL) stbds_arrpush(sequence, *otherwise);
+            stbds_arrpush(sequence, ((DecodedInstruction) { .opcode = SELECT_64, .a = condition, .b = taken, .c = destination }));
+        }
+
+        stbds_arr(DecodedInstruction) rewritten = NULL;
+        for (uint32_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) {
+            if (i != at) {
+                stbds_arrpush(rewritten, function->blocks[b][i]);
+                continue;
+            }
+            for (size_t k = 0; k < stbds_arrlenu(sequence); k++) stbds_arrpush(rewritten, sequence[k]);
+        }
+
+        stbds_arrfree(sequence);
+        stbds_arrfree(function->blocks[b]);
+        function->blocks[b] = rewritten;
+
+        report->selects++;
+        changed = true;
+    }
+
+    optimize_graph_free(&graph);
+    return changed;
+}
+
+// drops blocks nothing enters and numbers the rest in their old order, then drops constants nothing reads. a kept
+// block is cut after its last reachable instruction and ends in UNREACHABLE instead, since the dead tail may name
+// blocks that are gone
+void optimize_compact(Function const* functions, OptimizeGraph const* graph, OptimizeReport* report) {
+    DecodedFunction* function = graph->function;
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(function->blocks);
+    BlockIndex renumber [MAX_BLOCKS];
+    BlockIndex num_kept = 0;
+
+    stbds_arr(stbds_arr(DecodedInstruction)) kept = NULL;
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        if (graph->reachable[graph->block_start[b]]) {
+            uint32_t end = graph->block_start[b];
+            for (uint32_t node = end; node < graph->block_start[b + 1]; node++) {
+                if (graph->reachable[node]) end = node + 1;
+            }
+            if (end < graph->block_start[b + 1]) {
+                stbds_arrsetlen(function->blocks[b], end - graph->block_start[b]);
+                stbds_arrpush(function->blocks[b], ((DecodedInstruction) { .opcode = UNREACHABLE }));
+            }
+
+            renumber[b] = num_kept++;
+            stbds_arrpush(kept, function->blocks[b]);
+        } else {
+            stbds_arrfree(function->blocks[b]);
+            report->blocks++;
+        }
+    }
+
+    stbds_arrfree(function->blocks);
+    function->blocks = kept;
+
+    RegisterIndex n = function->num_registers;
+    bool used [MAX_REGISTERS + 1] = {};
+
+    for (BlockIndex b = 0; b < num_kept; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(kept[b]); i++) {
+            DecodedInstruction* instr = kept[b] + i;
+
+            switch (instr->opcode) {
+                case IF_NZ:
+                    instr->b = renumber[instr->b];
+                    // fallthrough
+                case BLOCK:
+                case WHEN_NZ:
+                    instr->a = renumber[instr->a];
+                    break;
+                case SWITCH:
+                    for (uint32_t t = 0; t <= instr->b; t++) function->tables[instr->args + t] = renumber[function->tables[instr->args + t]];
+                    break;
+                default:
+                    break;
+            }
+
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+            for (uint32_t s = 0; s < num_sources; s++) used[*sources[s]] = true;
+        }
+    }
+
+    RegisterIndex pool [MAX_REGISTERS + 1];
+    stbds_arr(uint64_t) constants = NULL;
+
+    for (size_t k = 0; k < stbds_arrlenu(function->constants); k++) {
+        if (!used[n + k]) continue;
+        pool[n + k] = (RegisterIndex) (n + stbds_arrlenu(constants));
+        stbds_arrpush(constants, function->constants[k]);
+    }
+
+    for (BlockIndex b = 0; b < num_kept; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(kept[b]); i++) {
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, function, kept[b] + i, sources);
+            for (uint32_t s = 0; s < num_sources; s++) {
+                if (*sources[s] >= n) *sources[s] = pool[*sources[s]];
+            }
+        }
+    }
+
+    stbds_arrfree(function->constants);
+    function->constants = constants;
+}
+
+// renumbers registers so values whose lifetimes never overlap share one, which shrinks the frame every call pushes
+// and every TAIL_CALL_V copies. arguments keep their slots and registers are colored greedily in index order, taking
+// the register of a COPY_64 partner when it is free so the copy reads and writes the same register and goes away.
+// registers live at the entry may hold garbage a partial write keeps, they stay apart so that garbage stays the same
+void optimize_allocate(Function const* functions, OptimizeGraph const* graph, OptimizeReport* report) {
+    DecodedFunction* function = graph->function;
+    RegisterIndex n = function->num_registers;
+
+    stbds_arr(RegisterSet) live_in = NULL;
+    stbds_arr(RegisterSet) live_out = NULL;
+    optimize_liveness(functions, graph, &live_in, &live_out);
+
+    RegisterSet interferes [MAX_REGISTERS + 1] = {};
+    RegisterSet partners [MAX_REGISTERS + 1] = {};
+    bool used [MAX_REGISTERS + 1] = {};
+
+    for (uint32_t node = 0; node < graph->num_nodes; node++) {
+        DecodedInstruction* instr = optimize_node(graph, node);
+
+        RegisterIndex* sources [MAX_REGISTERS + 1];
+        uint32_t num_sources = decoded_sources(functions, function, instr, sources);
+        for (uint32_t s = 0; s < num_sources; s++) used[*sources[s]] = true;
+
+        RegisterIndex destination;
+        bool whole;
+        if (!decoded_destination(instr, &destination, &whole)) continue;
+        used[destination] = true;
+
+        if (!graph->reachable[node]) continue;
+
+        bool copy = instr->opcode == COPY_64;
+        if (copy && instr->a < n) {
+            REGISTER_SET_ADD(partners[destination], instr->a);
+            REGISTER_SET_ADD(partners[instr->a], destination);
+        }
+
+        for (RegisterIndex r = 0; r < n; r++) {
+            if (r == destination || !REGISTER_SET_HAS(live_out[node], r) || (copy && r == instr->a)) continue;
+            REGISTER_SET_ADD(interferes[destination], r);
+            REGISTER_SET_ADD(interferes[r], destination);
+        }
+    }
+
+    if (graph->num_nodes > 0) {
+        for (RegisterIndex r = 0; r < n; r++) {
+            if (!REGISTER_SET_HAS(live_in[0], r)) continue;
+            for (RegisterIndex s = 0; s < n; s++) {
+                if (s != r && REGISTER_SET_HAS(live_in[0], s)) REGISTER_SET_ADD(interferes[r], s);
+            }
+        }
+    }
+
+    RegisterIndex color [MAX_REGISTERS + 1];
+    bool colored [MAX_REGISTERS + 1] = {};
+    RegisterIndex num_colors = function->num_args;
+
+    for (RegisterIndex r = 0; r < function->num_args; r++) {
+        color[r] = r;
+        colored[r] = true;
+    }
+
+    for (RegisterIndex r = function->num_args; r < n; r++) {
+        if (!used[r]) continue;
+
+        bool taken [MAX_REGISTERS + 1] = {};
+        for (RegisterIndex s = 0; s < n; s++) {
+            if (colored[s] && REGISTER_SET_HAS(interferes[r], s)) taken[color[s]] = true;
+        }
+
+        RegisterIndex choice = 0;
+        while (taken[choice]) choice++;
+
+        for (RegisterIndex s = 0; s < n; s++) {
+            if (colored[s] && REGISTER_SET_HAS(partners[r], s) && !taken[color[s]]) {
+                choice = color[s];
+                break;
+            }
+        }
+
+        color[r] = choice;
+        colored[r] = true;
+        if (choice >= num_colors) num_colors = (RegisterIndex) (choice + 1);
+    }
+
+    for (size_t k = 0; k < stbds_arrlenu(function->constants); k++) color[n + k] = (RegisterIndex) (num_colors + k);
+
+    for (size_t b = 0; b < stbds_arrlenu(function->blocks); b++) {
+        stbds_arr(DecodedInstruction) kept = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(function->blocks[b]); i++) {
+            DecodedInstruction instr = function->blocks[b][i];
+
+            // LOOP_ and SELECT_64 read and write the same operand, rename each operand once
+            RegisterIndex* operands [MAX_REGISTERS + 2];
+            uint32_t num_operands = decoded_sources(functions, function, &instr, operands);
+            bool whole;
+            RegisterIndex* destination = decoded_destination_operand(&instr, &whole);
+            if (destination != NULL) operands[num_operands++] = destination;
+
+            for (uint32_t o = 0; o < num_operands; o++) {
+                bool seen = false;
+                for (uint32_t p = 0; p < o; p++) seen |= operands[p] == operands[o];
+                if (!seen) *operands[o] = color[*operands[o]];
+            }
+
+            if (instr.opcode == COPY_64 && instr.a == instr.b) {
+                report->coalesced++;
+                continue;
+            }
+
+            stbds_arrpush(kept, instr);
+        }
+
+        stbds_arrfree(function->blocks[b]);
+        function->blocks[b] = kept;
+    }
+
+    report->registers_before += n;
+    report->registers_after += num_colors;
+    function->num_registers = num_colors;
+
+    stbds_arrfree(live_in);
+    stbds_arrfree(live_out);
+}
+
+// pool index of value, adding it to the end when it is not there yet
+uint32_t optimize_intern(stbds_arr(uint64_t)* constants, uint64_t value) {
+    size_t num_constants = stbds_arrlenu(*constants);
+    for (size_t k = 0; k < num_constants; k++) {
+        if ((*constants)[k] == value) return (uint32_t) k;
+    }
+
+    stbds_arrpush(*constants, value);
+    return (uint32_t) num_constants;
+}
+
+// the inliner copies a callee's blocks into the caller behind a BLOCK, after COPY_64s that move the arguments into
+// the callee's registers. the callee's registers follow the caller's own and its constant registers come from the
+// caller's pool, which moves up to make room. a RET_V becomes a COPY_64 into the call's out register and a BR out of
+// the copied root block. the bodies inlined into one caller never run at the same time, so they share one range of
+// registers. functions are visited callees first, so a callee already has its own calls inlined when it is copied
+
+void optimize_call_graph(Function const* functions, FunctionIndex index, stbds_arr(FunctionIndex)* callees) {
+    Bytecode const* bytecode = &functions[index].bytecode;
+
+    for (BlockIndex b = 0; b < bytecode->num_blocks; b++) {
+        InstructionPointer ip = bytecode->blocks[b];
+
+        while (true) {
+            Instruction const* instr = bytecode->instructions + ip;
+            OpCode opcode = I_DECODE_OPCODE(*instr);
+            if (opcode == CALL_V || opcode == TAIL_CALL_V) stbds_arrpush(*callees, I_DECODE_W0(*instr));
+
+            ip += instruction_length(functions, instr);
+            if (opcode_ends_block(opcode)) break;
+        }
+    }
+}
+
+bool optimize_reaches(stbds_arr(FunctionIndex) const* calls, FunctionIndex from, FunctionIndex target, bool* visited) {
+    for (size_t i = 0; i < stbds_arrlenu(calls[from]); i++) {
+        FunctionIndex callee = calls[from][i];
+        if (callee == target) return true;
+        if (visited[callee]) continue;
+
+        visited[callee] = true;
+        if (optimize_reaches(calls, callee, target, visited)) return true;
+    }
+
+    return false;
+}
+
+void optimize_postorder(stbds_arr(FunctionIndex) const* calls, FunctionIndex index, bool* visited, stbds_arr(FunctionIndex)* order) {
+    if (visited[index]) return;
+    visited[index] = true;
+
+    for (size_t i = 0; i < stbds_arrlenu(calls[index]); i++) optimize_postorder(calls, calls[index][i], visited, order);
+    stbds_arrpush(*order, index);
+}
+
+InlineOutcome inline_outcome(Function const* callee, DecodedFunction const* decoded, bool recursive) {
+    if (recursive) return INLINE_RECURSIVE;
+    if (callee->memo != NULL) return INLINE_MEMOIZED;
+
+    size_t size = 0;
+    for (size_t b = 0; b < stbds_arrlenu(decoded->blocks); b++) {
+        for (size_t i = 0; i < stbds_arrlenu(decoded->blocks[b]); i++) {
+            OpCode opcode = decoded->blocks[b][i].opcode;
+            if (opcode == LAZY_LINK) return INLINE_NOT_RESIDENT;
+            if (opcode == TAIL_CALL_V) return INLINE_TAIL_CALL;
+        }
+        size += stbds_arrlenu(decoded->blocks[b]);
+    }
+
+    return size > INLINE_MAX_INSTRUCTIONS ? INLINE_TOO_LARGE : INLINE_DONE;
+}
+
+RegisterIndex inline_register(DecodedFunction* caller, RegisterIndex base, DecodedFunction const* callee, RegisterIndex r) {
+    if (r < callee->num_registers) return (RegisterIndex) (base + r);
+    return (RegisterIndex) (caller->num_registers + optimize_intern(&caller->constants, callee->constants[r - callee->num_registers]));
+}
+
+// an instruction of callee moved into caller: registers renamed, block indices offset by first, and call arguments
+// and jump tables copied into the caller's lists
+DecodedInstruction inline_instruction(Function const* functions, DecodedFunction* caller, RegisterIndex base, DecodedFunction const* callee, BlockIndex first, DecodedInstruction const* original) {
+    DecodedInstruction instr = *original;
+
+    if (instr.opcode == CALL_V) {
+        instr.args = (uint32_t) stbds_arrlenu(caller->args);
+        for (RegisterIndex j = 0; j < functions[instr.w].num_args; j++) stbds_arrpush(caller->args, callee->args[original->args + j]);
+    }
+
+    RegisterIndex* sources [MAX_REGISTERS + 1];
+    uint32_t num_sources = decoded_sources(functions, caller, &instr, sources);
+    bool whole;
+    RegisterIndex* destination = decoded_destination_operand(&instr, &whole);
+
+    for (uint32_t s = 0; s < num_sources; s++) {
+        if (sources[s] != destination) *sources[s] = inline_register(caller, base, callee, *sources[s]);
+    }
+    if (destination != NULL) *destination = inline_register(caller, base, callee, *destination);
+
+    switch (instr.opcode) {
+        case IF_NZ:
+            instr.b += first;
+            // fallthrough
+        case BLOCK:
+        case WHEN_NZ:
+            instr.a += first;
+            break;
+        case SWITCH:
+            instr.args = (uint32_t) stbds_arrlenu(caller->tables);
+            for (uint32_t t = 0; t <= instr.b; t++) stbds_arrpush(caller->tables, (BlockIndex) (callee->tables[original->args + t] + first));
+            break;
+        default:
+            break;
+    }
+
+    return instr;
+}
+
+// a callee of one block that only leaves by its final RET_V can go straight into the caller's block
+bool inline_straight(DecodedFunction const* callee) {
+    if (stbds_arrlenu(callee->blocks) != 1) return false;
+
+    stbds_arr(DecodedInstruction) block = callee->blocks[0];
+    for (size_t i = 0; i < stbds_arrlenu(block); i++) {
+        switch (block[i].opcode) {
+            case BR_NZ:
+            case RE:
+            case RE_NZ:
+            case LOOP_F64:
+            case LOOP_IM_F64:
+            case LOOP_I64:
+            case LOOP_IM_I64:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    return block[stbds_arrlenu(block) - 1].opcode == RET_V;
+}
+
+// appends a copy of callee's blocks to caller for a call that writes out, returning the index of the copied root
+BlockIndex inline_body(Function const* functions, DecodedFunction* caller, RegisterIndex base, DecodedFunction const* callee, RegisterIndex out) {
+    BlockIndex first = (BlockIndex) stbds_arrlenu(caller->blocks);
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(callee->blocks);
+
+    // how many blocks each RET_V has to leave; blocks nothing enters keep 0, they never run
+    uint8_t depth [MAX_BLOCKS];
+    bool entered [MAX_BLOCKS];
+    decoded_block_depths(callee, depth, entered);
+
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        stbds_arr(DecodedInstruction) block = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(callee->blocks[b]); i++) {
+            DecodedInstruction instr = inline_instruction(functions, caller, base, callee, first, callee->blocks[b] + i);
+
+            if (instr.opcode == RET_V) {
+                stbds_arrpush(block, ((DecodedInstruction) { .opcode = COPY_64, .a = instr.a, .b = out }));
+                instr = (DecodedInstruction) { .opcode = BR, .a = depth[b] };
+            }
+
+            stbds_arrpush(block, instr);
+        }
+
+        stbds_arrpush(caller->blocks, block);
+    }
+
+    return first;
+}
+
+void inline_calls(Function* functions, FunctionIndex index, bool const* recursive, OptimizeReport* report) {
+    DecodedFunction caller;
+    decode_function(functions, index, &caller);
+
+    RegisterIndex n = caller.num_registers;
+    RegisterIndex shared = 0;
+    size_t num_blocks = stbds_arrlenu(caller.blocks);
+    size_t blocks_needed = num_blocks;
+    // block and instruction of each call that gets inlined, in program order
+    stbds_arr(uint32_t) sites = NULL;
+
+    for (size_t b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(caller.blocks[b]); i++) {
+            DecodedInstruction const* instr = caller.blocks[b] + i;
+            if (instr->opcode != CALL_V) continue;
+
+            DecodedFunction callee;
+            decode_function(functions, instr->w, &callee);
+
+            InlineOutcome outcome = inline_outcome(functions + instr->w, &callee, recursive[instr->w]);
+            if (outcome == INLINE_DONE && blocks_needed + stbds_arrlenu(callee.blocks) > MAX_BLOCKS) outcome = INLINE_NO_BLOCKS;
+
+            if (outcome == INLINE_DONE) {
+                size_t num_constants = stbds_arrlenu(caller.constants);
+                for (size_t k = 0; k < stbds_arrlenu(callee.constants); k++) optimize_intern(&caller.constants, callee.constants[k]);
+
+                RegisterIndex registers = callee.num_registers > shared ? callee.num_registers : shared;
+                if ((uint32_t) n + registers + stbds_arrlenu(caller.constants) > MAX_REGISTERS + 1) {
+                    stbds_arrsetlen(caller.constants, num_constants);
+                    outcome = INLINE_NO_REGISTERS;
+                } else {
+                    shared = registers;
+                    blocks_needed += stbds_arrlenu(callee.blocks);
+                    stbds_arrpush(sites, (uint32_t) (b << 16 | i));
+                }
+            }
+
+            stbds_arrpush(report->decisions, ((InlineDecision) { index, instr->w, outcome }));
+            decoded_function_free(&callee);
+        }
+    }
+
+    if (stbds_arrlenu(sites) == 0) {
+        stbds_arrfree(sites);
+        decoded_function_free(&caller);
+        return;
+    }
+
+    // the caller's constant registers move up past the shared range
+    caller.num_registers = n + shared;
+    for (size_t b = 0; b < num_blocks; b++) {
+        for (size_t i = 0; i < stbds_arrlenu(caller.blocks[b]); i++) {
+            RegisterIndex* sources [MAX_REGISTERS + 1];
+            uint32_t num_sources = decoded_sources(functions, &caller, caller.blocks[b] + i, sources);
+            for (uint32_t s = 0; s < num_sources; s++) {
+                if (*sources[s] >= n) *sources[s] += shared;
+            }
+        }
+    }
+
+    size_t next_site = 0;
+    for (size_t b = 0; b < num_blocks && next_site < stbds_arrlenu(sites); b++) {
+        if (sites[next_site] >> 16 != b) continue;
+
+        stbds_arr(DecodedInstruction) rewritten = NULL;
+
+        for (size_t i = 0; i < stbds_arrlenu(caller.blocks[b]); i++) {
+            DecodedInstruction instr = caller.blocks[b][i];
+
+            if (next_site == stbds_arrlenu(sites) || sites[next_site] != (uint32_t) (b << 16 | i)) {
+                stbds_arrpush(rewritten, instr);
+                continue;
+            }
+            next_site++;
+
+            DecodedFunction callee;
+            decode_function(functions, instr.w, &callee);
+
+            for (RegisterIndex j = 0; j < callee.num_args; j++) {
+                stbds_arrpush(rewritten, ((DecodedInstruction) { .opcode = COPY_64, .a = caller.args[instr.args + j], .b = (RegisterIndex) (n + j) }));
+            }
+
+            if (inline_straight(&callee)) {
+                for (size_t j = 0; j < stbds_arrlenu(callee.blocks[0]); j++) {
+                    DecodedInstruction inlined = inline_instruction(functions, &caller, n, &callee, 0, callee.blocks[0] + j);
+                    if (inlined.opcode == RET_V) inlined = (DecodedInstruction) { .opcode = COPY_64, .a = inlined.a, .b = instr.c };
+                    stbds_arrpush(rewritten, inlined);
+                }
+            } else {
+                BlockIndex root = inline_body(functions, &caller, n, &callee, instr.c);
+                stbds_arrpush(rewritten, ((DecodedInstruction) { .opcode = BLOCK, .a = root }));
+            }
+
+            decoded_function_free(&callee);
+            report->inlined++;
+        }
+
+        stbds_arrfree(caller.blocks[b]);
+        caller.blocks[b] = rewritten;
+    }
+
+    Bytecode* bytecode = &functions[index].bytecode;
+    stbds_arrfree(bytecode->blocks);
+    stbds_arrfree(bytecode->instructions);
+    stbds_arrfree(bytecode->constants);
+    *bytecode = encode_decoded_function(functions, &caller);
+    functions[index].num_registers = caller.num_registers;
+
+    stbds_arrfree(sites);
+    decoded_function_free(&caller);
+}
+
+// inlines small callees into every function of a verified program, recording a decision for each call
+void optimize_inline(Function* functions, FunctionIndex num_functions, OptimizeReport* report) {
+    stbds_arr(FunctionIndex)* calls = calloc(num_functions, sizeof(stbds_arr(FunctionIndex)));
+    bool* recursive = calloc(num_functions, sizeof(bool));
+    bool* visited = calloc(num_functions, sizeof(bool));
+    stbds_arr(FunctionIndex) order = NULL;
+
+    for (FunctionIndex i = 0; i < num_functions; i++) optimize_call_graph(functions, i, calls + i);
+
+    for (FunctionIndex i = 0; i < num_functions; i++) {
+        memset(visited, 0, num_functions * sizeof(bool));
+        recursive[i] = optimize_reaches(calls, i, i, visited);
+    }
+
+    memset(visited, 0, num_functions * sizeof(bool));
+    for (FunctionIndex i = 0; i < num_functions; i++) optimize_postorder(calls, i, visited, &order);
+
+    for (size_t i = 0; i < stbds_arrlenu(order); i++) inline_calls(functions, order[i], recursive, report);
+
+    for (FunctionIndex i = 0; i < num_functions; i++) stbds_arrfree(calls[i]);
+    free(calls);
+    free(recursive);
+    free(visited);
+    stbds_arrfree(order);
+}
+
+// a tail call of a function to itself becomes moves of its arguments into the first registers and an RE of the root
+// block, so the recursion runs as a loop in one frame. the moves are a parallel assignment: a move goes out once no
+// other pending move still reads its destination, and a cycle is broken through a register the call would have
+// discarded, one that is neither an argument nor read by a pending move
+void optimize_self_tail_calls(Function const* functions, FunctionIndex index, DecodedFunction* function, OptimizeReport* report) {
+    if (functions[index].memo != NULL) return;
+
+    BlockIndex num_blocks = (BlockIndex) stbds_arrlenu(function->blocks);
+    uint8_t depth [MAX_BLOCKS];
+    bool entered [MAX_BLOCKS];
+    decoded_block_depths(function, depth, entered);
+
+    RegisterIndex num_args = function->num_args;
+
+    for (BlockIndex b = 0; b < num_blocks; b++) {
+        stbds_arr(DecodedInstruction) block = function->blocks[b];
+        DecodedInstruction call = block[stbds_arrlenu(block) - 1];
+        if (!entered[b] || call.opcode != TAIL_CALL_V || call.w != index) continue;
+
+        RegisterIndex sources [MAX_REGISTERS + 1];
+        bool pending [MAX_REGISTERS + 1] = {};
+        uint32_t num_pending = 0;
+
+        for (RegisterIndex i = 0; i < num_args; i++) {
+            sources[i] = function->args[call.args + i];
+            pending[i] = sources[i] != i;
+            num_pending += pending[i];
+        }
+
+        stbds_arr(DecodedInstruction) moves = NULL;
+        bool ok = true;
+
+        while (ok && num_pending > 0) {
+            RegisterIndex ready = num_args;
+            for (RegisterIndex i = 0; i < num_args && ready == num_args; i++) {
+                if (!pending[i]) continue;
+
+                bool read = false;
+                for (RegisterIndex j = 0; j < num_args; j++) read |= pending[j] && sources[j] == i;
+                if (!read) ready = i;
+            }
+
+            if (ready < num_args) {
+                stbds_arrpush(moves, ((DecodedInstruction) { .opcode = COPY_64, .a = sources[ready], .b = ready }));
+                pending[ready] = false;
+                num_pending--;
+                continue;
+            }
+
+            // every pending destination is still read, so they form cycles; park one of them
+            RegisterIndex parked = num_args;
+            for (RegisterIndex i = 0; i < num_args; i++) {
+                if (pending[i]) { parked = i; break; }
+            }
+
+            RegisterIndex scratch = num_args;
+            for (; scratch < function->num_registers; scratch++) {
+                bool read = false;
+                for (RegisterIndex j = 0; j < num_args; j++) read |= pending[j] && sources[j] == scratch;
+                if (!read) break;
+            }
+
+            if (scratch == function->num_registers) {
+                ok = false;
+                break;
+            }
+
+            stbds_arrpush(moves, ((DecodedInstruction) { .opcode = COPY_64, .a = parked, .b = scratch }));
+            for (RegisterIndex j = 0; j < num_args; j++) {
+                if (pending[j] && sources[j] == parked) sources[j] = scratch;
+            }
+        }
+
+        if (!ok) {
+            stbds_arrfree(moves);
+            continue;
+        }
+
+        size_t at = stbds_arrlenu(block) - 1;
+        block[at] = (DecodedInstruction) { .opcode = RE, .a = depth[b] };
+        for (size_t m = 0; m < stbds_arrlenu(moves); m++) stbds_arrins(block, at + m, moves[m]);
+        function->blocks[b] = block;
+
+        stbds_arrfree(moves);
+        report->loops++;
+    }
+}
+
+// optimizes one function of a verified program, returning its new bytecode and updating its register count
+Bytecode optimize_function(Function* functions, FunctionIndex index, OptimizeReport* report) {
+    DecodedFunction function;
+    decode_function(functions, index, &function);
+
+    optimize_self_tail_calls(functions, index, &function, report);
+
+    OptimizeGraph graph;
+    OptimizeFacts facts;
+
+    // every round either changes an instruction into a cheaper one or removes one, so this terminates quickly; the
+    // bound only guards against two rewrites undoing each other
+    for (int round = 0; round < 16; round++) {
+        optimize_graph_build(&graph, &function);
+        optimize_facts_build(functions, &graph, &facts);
+        bool changed = optimize_rewrite(functions, &graph, &facts, report);
+        optimize_facts_free(&facts);
+        optimize_graph_free(&graph);
+
+        optimize_graph_build(&graph, &function);
+        changed |= optimize_dead_writes(functions, &graph, report);
+        optimize_graph_free(&graph);
+
+        while (optimize_loops(functions, &function, report)) changed = true;
+        while (optimize_selects(functions, &function, report)) changed = true;
+
+        if (!changed) break;
+    }
+
+    optimize_graph_build(&graph, &function);
+    optimize_compact(functions, &graph, report);
+    optimize_graph_free(&graph);
+
+    optimize_graph_build(&graph, &function);
+    optimize_allocate(functions, &graph, report);
+    optimize_graph_free(&graph);
+
+    functions[index].num_registers = function.num_registers;
+    Bytecode bytecode = encode_decoded_function(functions, &function);
+    decoded_function_free(&function);
+
+    return bytecode;
+}
+
+char const* inline_outcome_name(InlineOutcome outcome) {
+    switch (outcome) {
+        case INLINE_DONE: return "inlined";
+        case INLINE_RECURSIVE: return "recursive";
+        case INLINE_TOO_LARGE: return "too large";
+        case INLINE_TAIL_CALL: return "callee tail calls";
+        case INLINE_NOT_RESIDENT: return "callee not resident";
+        case INLINE_MEMOIZED: return "callee memoized";
+        case INLINE_NO_REGISTERS: return "out of registers";
+        case INLINE_NO_BLOCKS: return "out of blocks";
+        default: return "unknown";
+    }
+}
+
+// inlines, then rewrites every function of a verified program in place. the bytecode must be encoder built, the old
+// arrays are freed; a loaded module's bytecode is not, optimize before module_write instead
+void optimize(Function* functions, FunctionIndex num_functions, OptimizeReport* report) {
+    memset(report, 0, sizeof(OptimizeReport));
+
+    for (FunctionIndex i = 0; i < num_functions; i++) report->words_before += functions[i].bytecode.num_instructions;
+
+    optimize_inline(functions, num_functions, report);
+
+    for (FunctionIndex i = 0; i < num_functions; i++) {
+        Bytecode* bytecode = &functions[i].bytecode;
+        Bytecode optimized = optimize_function(functions, i, report);
+
+        stbds_arrfree(bytecode->blocks);
+        stbds_arrfree(bytecode->instructions);
+        stbds_arrfree(bytecode->constants);
+        *bytecode = optimized;
+
+        report->words_after += optimized.num_instructions;
+    }
+}
+
+void optimize_report(FILE* out, OptimizeReport const* report) {
+    fprintf(out, "optimize: %u inlined, %u tail calls looped, %u hoisted, %u counted loops, %u folded, %u copies propagated, %u immediates, %u branches decided, %u selects, %u dead, %u blocks removed, %u copies coalesced, %lu -> %lu registers, %lu -> %lu words\n",
+        report->inlined, report->loops, report->hoisted, report->counted, report->folded, report->propagated, report->immediates, report->branches, report->selects, report->dead, report->blocks,
+        report->coalesced, report->registers_before, report->registers_after, report->words_before, report->words_after);
+
+    for (size_t i = 0; i < stbds_arrlenu(report->decisions); i++) {
+        InlineDecision const* decision = report->decisions + i;
+        fprintf(out, "  call f%d -> f%d: %s\n", decision->caller, decision->callee, inline_outcome_name(decision->outcome));
+    }
+}
+
+void optimize_report_free(OptimizeReport* report) {
+    stbds_arrfree(report->decisions);
+}
@@ -0,0 +1,19 @@
+function sieve(n)
+    local flags = {}
+    for i = 2, n do flags[i] = true end
+
+    local count = 0.0
+    for i = 2, n do
+        if flags[i] then
+            count = count + 1.0
+            for j = i + i, n, i do flags[j] = false end
+        end
+    end
+    return count
+end
+
+local start = os.clock()
+local result = sieve(1000000)
+local stop = os.clock()
+
+print(result, "(in ", stop - start, "s)")
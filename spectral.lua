@@ -0,0 +1,48 @@
+function eval_a(i, j)
+    local t = i + j
+    return 1.0 / (t * (t + 1.0) * 0.5 + i + 1.0)
+end
+
+function mul_av(n, v, out)
+    for i = 0, n - 1 do
+        local sum = 0.0
+        for j = 0, n - 1 do sum = sum + eval_a(i, j) * v[j] end
+        out[i] = sum
+    end
+end
+
+function mul_atv(n, v, out)
+    for i = 0, n - 1 do
+        local sum = 0.0
+        for j = 0, n - 1 do sum = sum + eval_a(j, i) * v[j] end
+        out[i] = sum
+    end
+end
+
+function mul_atav(n, v, out, tmp)
+    mul_av(n, v, tmp)
+    mul_atv(n, tmp, out)
+end
+
+function spectral_norm(n)
+    local u, v, tmp = {}, {}, {}
+    for i = 0, n - 1 do u[i] = 1.0 end
+
+    for k = 1, 10 do
+        mul_atav(n, u, v, tmp)
+        mul_atav(n, v, u, tmp)
+    end
+
+    local vbv, vv = 0.0, 0.0
+    for i = 0, n - 1 do
+        vbv = vbv + u[i] * v[i]
+        vv = vv + v[i] * v[i]
+    end
+    return math.sqrt(vbv / vv)
+end
+
+local start = os.clock()
+local result = spectral_norm(100)
+local stop = os.clock()
+
+print(string.format("%.17g", result), "(in ", stop - start, "s)")
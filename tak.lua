@@ -0,0 +1,10 @@
+function tak(x, y, z)
+    if not (y < x) then return z end
+    return tak(tak(x - 1.0, y, z), tak(y - 1.0, z, x), tak(z - 1.0, x, y))
+end
+
+local start = os.clock()
+local result = tak(24.0, 16.0, 8.0)
+local stop = os.clock()
+
+print(result, "(in ", stop - start, "s)")
@@ -5,7 +5,16 @@ echo "With zig cc:"
 zig cc \
     -o interp \
     -O3 \
-    main.c
+    main.c \
+    -lm
+
+# the native references must round exactly like the interpreter, so no fused multiply adds
+zig cc \
+    -o bench \
+    -O3 \
+    -ffp-contract=off \
+    bench.c \
+    -lm
 
 # time lua ./ack.lua
 time ./interp
@@ -17,13 +26,22 @@ sudo perf stat -d -r 100 ./interp
 
 # rm cachegrind.out.*
 
+# ./bench --json bench.json
+./bench
+
+# ./bench --micro --json micro.json
+
+# the 32-bit instruction encoding, with immediates in a constant pool per function
+# zig cc -o interp_packed -O3 -DPACKED_INSTRUCTIONS=1 main.c -lm && ./interp_packed
+
 
 # echo "With gcc:"
 
 # gcc \
 #     -O3 \
 #     -o interp \
-#     main.c
+#     main.c \
+#     -lm
 
 # time ./interp
 